@@ -61,6 +61,32 @@ struct spasm_triplet {             /* matrix in triplet form */
 	spasm_field field;
 };
 
+struct spasm_rowseg {              /* matrix stored as a sequence of row segments (used to build L) */
+	int n;                         /* number of rows */
+	int m;                         /* number of columns */
+	i64 nz;                        /* number of entries in the segments */
+	i64 nzmax;                     /* maximum number of entries */
+	i64 ns;                        /* number of segments */
+	i64 nsmax;                     /* maximum number of segments */
+	int *si;                       /* size nsmax, segment s is on row si[s] */
+	i64 *sp;                       /* size nsmax+1, segment s is j/x[sp[s]:sp[s+1]] (sp[ns] == nz) */
+	int *j;                        /* column indices, size nzmax */
+	spasm_ZZp *x;                  /* numerical values, size nzmax */
+	bool open;                     /* may spasm_rowseg_add_entry extend the last segment? */
+	struct spasm_triplet *T;       /* isolated entries */
+	spasm_field field;
+};
+
+struct spasm_dense_tail {          /* the last rows of U, stored as a dense block */
+	int i0;                        /* rows i0:U->n of U are in the block (only their pivot is in U) */
+	int n;                         /* number of rows */
+	int m;                         /* number of columns */
+	int *cols;                     /* size m, column k of the block is column cols[k] of U (increasing) */
+	int *cinv;                     /* size U->m, inverse of cols (-1 for columns outside the block) */
+	int *piv;                      /* size n, the pivot of row r is on column piv[r] of the block */
+	spasm_ZZp *x;                  /* size n*m, row-major */
+};
+
 struct spasm_lu {                  /* a PLUQ factorisation */
 	int r;                         /* rank of the input matrix */
 	bool complete;                 /* if L != NULL, indicates whether A == L*U */
@@ -68,7 +94,34 @@ struct spasm_lu {                  /* a PLUQ factorisation */
 	struct spasm_csr *U;
 	int *qinv;                     /* locate pivots in U (on column j, row qinv[j]) */
 	int *p;                        /* locate pivots in L (on column j, row p[j]) */
-	struct spasm_triplet *Ltmp;           /* for internal use during the factorization */
+	spasm_ZZp *Linv;               /* inverse of the pivots of L, which come first in their row (or NULL) */
+	struct spasm_rowseg *Ltmp;     /* for internal use during the factorization */
+	struct spasm_dense_tail *D;    /* hybrid storage for U (dense trailing rows), or NULL */
+	int dense_skipped;             /* #rows never processed by the dense phase (early abort / full rank) */
+};
+
+struct spasm_levels {              /* level schedule for the parallel triangular solve x.T = b */
+	int n;                         /* number of rows of T (size of x) */
+	int m;                         /* number of columns of T (size of b) */
+	int r;                         /* number of pivots */
+	int nlevels;
+	int *lptr;                     /* size nlevels+1, the pivots of level l are lptr[l]:lptr[l+1] */
+	int *row;                      /* size r, the k-th pivot is T[row[k], col[k]] */
+	int *col;                      /* size r */
+	spasm_ZZp *inv;                /* size r, inverse of the k-th pivot */
+	int nfree;                     /* number of non-pivotal columns */
+	int *free_cols;                /* size nfree, the non-pivotal columns */
+	struct spasm_csr *Tt;          /* transpose of T */
+};
+
+struct spasm_solver {              /* prepared solver for x.A = b, with many right-hand sides */
+	const struct spasm_lu *fact;
+	int block;                     /* number of right-hand sides solved together */
+	int *Uq;                       /* size r, the pivot of row i of U is on column Uq[i] */
+	int nthreads;
+	spasm_ZZp **work;              /* per-thread workspaces, each of size block * (m + r + 1) */
+	int **sparse_xj;               /* per-thread workspaces for sparse RHS, each of size 3 * (m + r), zeroed */
+	spasm_ZZp **sparse_y;          /* per-thread workspaces for sparse RHS, each of size m + r + D->m */
 };
 
 struct spasm_dm {      /**** a Dulmage-Mendelson decomposition */
@@ -83,18 +136,24 @@ struct spasm_dm {      /**** a Dulmage-Mendelson decomposition */
 
 struct echelonize_opts {
 	/* pivot search sub-algorithms */
+	bool enable_presolve;
 	bool enable_greedy_pivot_search;
+	bool enable_dm_blocks;          /* first round: echelonize the diagonal blocks of the DM decomposition */
 
 	/* echelonization sub-algorithms */
 	bool enable_tall_and_skinny;
 	bool enable_dense;
 	bool enable_GPLU;
+	bool enable_right_looking;      /* sparse finisher: right-looking elimination with Markowitz pivoting (instead of GPLU) */
 
 	/* Parameters of the "root" echelonization procedure itself */
 	bool L;                         /* should we compute L / Lp in addition to U / Uqinv ? */
 	bool complete;                  /* A == LU / otherwise L is just OK for the pivotal rows */
 	double min_pivot_proportion;    /* minimum number of pivots found to keep going; < 0 = keep going */
 	int max_round;                  /* maximum number of rounds; < 0 = keep going */
+	bool enable_streaming_schur;    /* rounds: build S by chunks, over the memory of A (see spasm_schur_streaming) */
+	bool enable_column_compaction;  /* rounds: renumber the non-pivotal columns of S, then go on in this index space */
+	int presolve_merge_weight;      /* presolve: eliminate weight-2 columns using rows of at most this weight */
  
  	/* Parameters that determine the choice of a finalization strategy */
  	double sparsity_threshold;      /* denser than this --> dense method; < 0 = keep going */
@@ -104,6 +163,9 @@ struct echelonize_opts {
 	double low_rank_ratio;          /* if k rows have rank less than k * low_rank_ratio --> "tall-and-skinny"; <0 = don't */
 	double tall_and_skinny_ratio;   /* aspect ratio (#rows / #cols) higher than this --> "tall-and-skinny"; <0 = don't */
 	double low_rank_start_weight;   /* compute random linear combinations of this many rows; -1 = auto-select */
+	i64 memory_budget;              /* bytes available to the dense methods; > 0 --> overrides dense_block_size */
+	bool enable_dense_tail;         /* store the dense trailing rows of U as a dense block (see spasm_dense_tail.c) */
+	int dense_tree_width;           /* echelonize this many dense blocks independently, then merge them; <= 1 = don't */
 
 };
 
@@ -134,8 +196,53 @@ typedef struct {
         spasm_field field;
 } spasm_prng_ctx;
 
+typedef struct {
+        u64 s[4];        /* xoshiro256** state */
+        u32 prime;
+        u32 mask;        /* 2^i - 1 where i is the smallest s.t. 2^i > prime */
+        spasm_field field;
+} spasm_rng_ctx;
+
 typedef enum {SPASM_DOUBLE, SPASM_FLOAT, SPASM_I64} spasm_datatype;
 
+typedef enum {SPASM_FINISH_NONE, SPASM_FINISH_GPLU, SPASM_FINISH_DENSE, SPASM_FINISH_LOWRANK} spasm_finisher;
+
+struct spasm_symbolic_round {      /* what happened during one round of the echelonization */
+	int n;                         /* #rows of the matrix processed in this round */
+	int npiv;                      /* #structural pivots found */
+	int *p;                        /* row permutation (pivotal rows first), size n */
+	int *qp;                       /* qp[k] == column of the pivot on row p[k], size npiv */
+	struct spasm_csr *R;           /* reach of the non-pivotal rows (NULL if no schur complement was computed) */
+	/*
+	 * Row k of R contains Reach(U, A[p[npiv + k]]) in topological order. Non-pivotal columns
+	 * on which the schur complement had a zero coefficient are encoded as -(j+1).
+	 */
+};
+
+struct spasm_symbolic {            /* recorded pivot sequence of spasm_echelonize, for refactorization */
+	struct echelonize_opts opts;
+	int n;                         /* #rows of the analyzed matrix */
+	int m;                         /* #columns of the analyzed matrix */
+	i64 *Ap;                       /* pattern of the analyzed matrix (size n+1) */
+	int *Aj;                       /* pattern of the analyzed matrix (size nnz) */
+	int nrounds;                   /* the last one did not compute a schur complement */
+	struct spasm_symbolic_round *round;
+	spasm_finisher finisher;
+	struct spasm_csr *G;           /* GPLU: reach of each processed row (same encoding as R) */
+	int *Gpiv;                     /* GPLU: pivot column found on each processed row, or -1 */
+	bool G_completion;             /* GPLU stopped after a successful completion test */
+	int refactorizations;          /* statistics */
+	int fallbacks;
+};
+
+struct spasm_schur_estimate {     /* predicted size of a schur complement */
+	double density;                /* w.r.t. the non-pivotal columns */
+	i64 nnz;                       /* predicted #nonzero entries */
+	i64 nnz_lo;                    /* 95%-confidence interval on nnz */
+	i64 nnz_hi;
+	int samples;                   /* #rows actually sampled */
+};
+
 #define SPASM_IDENTITY_PERMUTATION NULL
 #define SPASM_IGNORE NULL
 #define SPASM_IGNORE_VALUES 0
@@ -159,6 +266,12 @@ void spasm_prng_seed(const u8 *seed, i64 prime, u32 seq, spasm_prng_ctx *ctx);
 void spasm_prng_seed_simple(i64 prime, u64 seed, u32 seq, spasm_prng_ctx *ctx);
 u32 spasm_prng_u32(spasm_prng_ctx *ctx);
 spasm_ZZp spasm_prng_ZZp(spasm_prng_ctx *ctx);
+void spasm_rng_seed(i64 prime, u64 seed, u32 seq, spasm_rng_ctx *ctx);
+u64 spasm_rng_u64(spasm_rng_ctx *ctx);
+u32 spasm_rng_below(spasm_rng_ctx *ctx, u32 n);
+spasm_ZZp spasm_rng_ZZp(spasm_rng_ctx *ctx);
+spasm_ZZp spasm_rng_nonzero_ZZp(spasm_rng_ctx *ctx);
+struct spasm_csr *spasm_sparse_sketch(int N, int n, int w, i64 prime, u64 seed);
 
 /* spasm_util.c */
 double spasm_wtime();
@@ -186,6 +299,16 @@ void spasm_add_entry(struct spasm_triplet *T, int i, int j, i64 x);
 void spasm_triplet_transpose(struct spasm_triplet * T);
 struct spasm_csr *spasm_compress(const struct spasm_triplet * T);
 
+/* spasm_rowseg.c */
+struct spasm_rowseg * spasm_rowseg_alloc(int n, int m, i64 nzmax, i64 prime);
+void spasm_rowseg_free(struct spasm_rowseg *L);
+void spasm_rowseg_realloc(struct spasm_rowseg *L, i64 nzmax, i64 nsmax);
+i64 spasm_rowseg_reserve(struct spasm_rowseg *L, int i, i64 k);
+void spasm_rowseg_add_entry(struct spasm_rowseg *L, int i, int j, spasm_ZZp x);
+void spasm_rowseg_close(struct spasm_rowseg *L);
+void spasm_rowseg_squeeze(struct spasm_rowseg *L, i64 s0, const i64 *len, const bool *keep);
+struct spasm_csr * spasm_rowseg_assemble(struct spasm_rowseg *L);
+
 /* spasm_io.c */
 struct spasm_triplet *spasm_triplet_load(FILE * f, i64 prime, u8 *hash);
 void spasm_triplet_save(const struct spasm_triplet * A, FILE * f);
@@ -218,21 +341,67 @@ void spasm_xApy(const spasm_ZZp *x, const struct spasm_csr *A, spasm_ZZp *y);
 void spasm_Axpy(const struct spasm_csr *A, const spasm_ZZp *x, spasm_ZZp *y);
 
 /* spasm_triangular.c */
-void spasm_dense_back_solve(const struct spasm_csr *L, spasm_ZZp *b, spasm_ZZp *x, const int *p);
+void spasm_dense_back_solve(const struct spasm_csr *L, spasm_ZZp *b, spasm_ZZp *x, const int *p, const spasm_ZZp *Linv);
 bool spasm_dense_forward_solve(const struct spasm_csr * U, spasm_ZZp * b, spasm_ZZp * x, const int *q);
 int spasm_sparse_triangular_solve(const struct spasm_csr *U, const struct spasm_csr *B, int k, int *xj, spasm_ZZp * x, const int *qinv);
 
+/* spasm_dense_tail.c */
+void spasm_dense_tail_free(struct spasm_dense_tail *D);
+bool spasm_lu_pack_dense_tail(struct spasm_lu *fact);
+void spasm_lu_unpack_dense_tail(struct spasm_lu *fact);
+struct spasm_csr * spasm_dense_tail_expand(const struct spasm_csr *U, const struct spasm_dense_tail *D);
+int spasm_dense_tail_gather(const struct spasm_dense_tail *D, int top, int m, int *xj, const spasm_ZZp *x, spasm_ZZp *y);
+int spasm_dense_tail_scatter(const struct spasm_dense_tail *D, int top, int *xj, spasm_ZZp *x, const spasm_ZZp *y);
+void spasm_dense_tail_eliminate(const struct spasm_dense_tail *D, const spasm_field F, spasm_ZZp *y, const int *qinv, spasm_ZZp *z);
+int spasm_dense_tail_solve(const struct spasm_dense_tail *D, const spasm_field F, int top, int m, int *xj, spasm_ZZp *x,
+	spasm_ZZp *y, const int *qinv);
+bool spasm_dense_tail_forward_solve(const struct spasm_csr *U, const struct spasm_dense_tail *D, spasm_ZZp *b, spasm_ZZp *x,
+	const int *q, const int *qinv);
+
+/* spasm_levels.c */
+void spasm_levels_free(struct spasm_levels *S);
+struct spasm_levels * spasm_levels_U(const struct spasm_lu *fact);
+struct spasm_levels * spasm_levels_L(const struct spasm_lu *fact);
+bool spasm_levels_solve(const struct spasm_levels *S, const spasm_ZZp *b, spasm_ZZp *x);
+bool spasm_solve_levels(const struct spasm_levels *SU, const struct spasm_levels *SL, const spasm_ZZp *b, spasm_ZZp *x, spasm_ZZp *z);
+
+/* spasm_schedule.c */
+int * spasm_schedule_heavy_first(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv);
+
 /* spasm_schur.c */
 struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, 
-                   double est_density, struct spasm_triplet *L, const int *p_in, int *p_out);
+                   i64 est_nnz, struct spasm_rowseg *L, const int *p_in, int *p_out);
+struct spasm_csr *spasm_schur_streaming(struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, 
+                   i64 est_nnz, int nchunks, struct spasm_rowseg *L, const int *p_in, int *p_out);
+struct spasm_csr *spasm_schur_symbolic(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv);
+struct spasm_csr *spasm_schur_numeric(const struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, 
+                   struct spasm_csr *R, bool record, struct spasm_rowseg *L, const int *p_in, int *p_out);
+void spasm_schur_estimate(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv, 
+	int R, double rel_error, struct spasm_schur_estimate *est);
 double spasm_schur_estimate_density(const struct spasm_csr * A, const int *p, int n, const struct spasm_csr *U, const int *qinv, int R);
+void spasm_schur_dense_rows(const struct spasm_csr *A, const int *p, int n, const int *p_in, 
+	struct spasm_lu *fact, void *S, spasm_datatype datatype, const int *q, const int *order, int *p_out);
+int * spasm_schur_dense_prepare(const struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, int *q);
 void spasm_schur_dense(const struct spasm_csr *A, const int *p, int n, const int *p_in, 
 	struct spasm_lu *fact, void *S, spasm_datatype datatype,int *q, int *p_out);
 void spasm_schur_dense_randomized(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv, 
-	void *S, spasm_datatype datatype, int *q, int N, int w);
+	void *S, spasm_datatype datatype, int *q, int N, int w, u64 seed);
 
 /* spasm_pivots.c */
 int spasm_pivots_extract_structural(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, int *p, struct echelonize_opts *opts);
+bool spasm_pivots_copy(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, const int *p, const int *qp, int npiv);
+
+/* spasm_presolve.c */
+struct spasm_csr *spasm_presolve(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, int merge_weight, int *p_out);
+
+/* spasm_right_looking.c */
+struct spasm_csr *spasm_right_looking(const struct spasm_csr *A, const int *p, int n, const int *p_in, struct spasm_lu *fact, double dense_threshold, int *p_out);
+
+/* spasm_blocks.c */
+int spasm_pivots_extract_dm(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, int *p, struct echelonize_opts *opts);
+int spasm_connected_components(const struct spasm_csr *A, int *rcomp, int *ccomp);
+struct spasm_lu * spasm_echelonize_components(const struct spasm_csr *A, struct echelonize_opts *opts);
+struct spasm_lu * spasm_echelonize_tree(const struct spasm_csr *A, struct echelonize_opts *opts);
 
 /* spasm_matching.c */
 int spasm_maximum_matching(const struct spasm_csr *A, int *jmatch, int *imatch);
@@ -250,26 +419,47 @@ struct spasm_dm *spasm_strongly_connected_components(const struct spasm_csr *A);
 /* spasm_ffpack.cpp */
 int spasm_ffpack_rref(i64 prime, int n, int m, void *A, int ldA, spasm_datatype datatype, size_t *qinv);
 int spasm_ffpack_LU(i64 prime, int n, int m, void *A, int ldA, spasm_datatype datatype, size_t *p, size_t *qinv);
+void spasm_ffpack_gemm_sub(i64 prime, int n, int m, int k, const void *A, int ldA, const void *B, int ldB, 
+	void *C, int ldC, spasm_datatype datatype);
+
+/* spasm_datatype.cpp */
 spasm_ZZp spasm_datatype_read(const void *A, size_t i, spasm_datatype datatype);
 void spasm_datatype_write(void *A, size_t i, spasm_datatype datatype, spasm_ZZp value);
 size_t spasm_datatype_size(spasm_datatype datatype);
 spasm_datatype spasm_datatype_choose(i64 prime);
 const char * spasm_datatype_name(spasm_datatype datatype);
+void spasm_dense_to_ZZp(i64 n, const void *A, spasm_ZZp *x, spasm_datatype datatype);
+void spasm_dense_from_ZZp(i64 n, const spasm_ZZp *x, void *A, spasm_datatype datatype);
+void spasm_dense_gather(int n, const int *xj, const spasm_ZZp *x, void *A, spasm_datatype datatype);
+void spasm_dense_gather_columns(int n, int m, const void *A, i64 ldA, const int *cols, void *B, i64 ldB, spasm_datatype datatype);
+void spasm_dense_append_rows(struct spasm_csr *U, int n, int m, const void *S, i64 ldS, spasm_datatype datatype, 
+	const int *cols, bool shifted);
 
 /* spasm_echelonize */
 void spasm_echelonize_init_opts(struct echelonize_opts *opts);
 struct spasm_lu* spasm_echelonize(const struct spasm_csr *A, struct echelonize_opts *opts);
+struct spasm_lu* spasm_echelonize_analyze(const struct spasm_csr *A, struct echelonize_opts *opts, struct spasm_symbolic **sym);
+struct spasm_lu* spasm_echelonize_refactor(const struct spasm_csr *A, struct spasm_symbolic *sym);
+void spasm_symbolic_free(struct spasm_symbolic *sym);
 
 /* spasm_rref.c */
 struct spasm_csr * spasm_rref(const struct spasm_lu *fact, int *Rqinv);
 
 /* spasm_kernel.c */
+typedef void (*spasm_kernel_writer)(void *data, int k, int nz, const int *Kj, const spasm_ZZp *Kx);
+i64 spasm_kernel_stream(const struct spasm_lu *fact, spasm_kernel_writer writer, void *data);
+i64 spasm_kernel_from_rref_stream(const struct spasm_csr *R, const int *qinv, spasm_kernel_writer writer, void *data);
 struct spasm_csr * spasm_kernel(const struct spasm_lu *fact);
 struct spasm_csr * spasm_kernel_from_rref(const struct spasm_csr *R, const int *qinv);
 
 /* spasm_solve.c */
+void spasm_lu_index_diagonal(struct spasm_lu *fact);
 bool spasm_solve(const struct spasm_lu *fact, const spasm_ZZp *b, spasm_ZZp *x);
 struct spasm_csr * spasm_gesv(const struct spasm_lu *fact, const struct spasm_csr *B, bool *ok);
+struct spasm_solver * spasm_solver_alloc(const struct spasm_lu *fact, int block);
+void spasm_solver_free(struct spasm_solver *S);
+void spasm_solver_solve(const struct spasm_solver *S, int k, const spasm_ZZp *B, spasm_ZZp *X, bool *ok);
+int spasm_solver_sparse_solve(const struct spasm_solver *S, const struct spasm_csr *B, int k, int *xi, spasm_ZZp *x);
 
 /* spasm_certificate.c */
 struct spasm_rank_certificate * spasm_certificate_rank_create(const struct spasm_csr *A, const u8 *hash, const struct spasm_lu *fact);
@@ -0,0 +1,711 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "spasm.h"
+
+/*
+ * Block-wise echelonization.
+ *
+ * When A is block upper-triangular (e.g. after the Dulmage-Mendelsohn permutation),
+ * the diagonal blocks can be echelonized independently. Let the pivotal rows of block k
+ * (in pivot order) be A[i_0], A[i_1], ... and let L_k be the block's L. The rows
+ *
+ *     U[t] = (A[i_t] - sum_{s < t} L_k[i_t, s] * U[s]) / L_k[i_t, t]
+ *
+ * coincide with the block's U on the columns of the block, and have additional entries
+ * on the columns of subsequent blocks (the "off-diagonal" part). Taken together, they
+ * form a valid U for A. The non-pivotal rows of each block are then only coupled to the
+ * rest through the off-diagonal blocks, and are handled by the usual schur complement.
+ */
+
+struct block {
+	int r0, r1, c0, c1;           /* rows / columns of the diagonal block */
+	i64 nnz;
+	struct spasm_lu *fact;        /* echelonization of the diagonal block */
+	struct spasm_csr *O;          /* off-diagonal part of the pivotal rows (in U) */
+};
+
+/* sort (pointers to blocks) by decreasing #nnz */
+static int block_cmp(const void *a, const void *b)
+{
+	const struct block *x = *(struct block * const *) a;
+	const struct block *y = *(struct block * const *) b;
+	if (x->nnz > y->nnz)
+		return -1;
+	if (x->nnz < y->nnz)
+		return 1;
+	return 0;
+}
+
+/* 
+ * Scheduling of independent blocks (DM diagonal blocks, connected components): blocks with
+ * more than this many nnz are echelonized one at a time, using all threads. The other ones are
+ * echelonized concurrently, one thread each.
+ */
+static i64 large_block_threshold(i64 nnz)
+{
+	int nthreads = omp_get_max_threads();
+	if (nthreads == 1)
+		return nnz;
+	return nnz / nthreads;
+}
+
+/* returns L[i, j], or 0 */
+static spasm_ZZp csr_get(const struct spasm_csr *L, int i, int j)
+{
+	for (i64 px = L->p[i]; px < L->p[i + 1]; px++)
+		if (L->j[px] == j)
+			return L->x[px];
+	return 0;
+}
+
+/*
+ * echelonize the diagonal block of B and compute the off-diagonal part of the pivotal rows.
+ * y, mark and list are scratch space of size B->m (mark must be initialized to zero).
+ */
+static void block_echelonize(const struct spasm_csr *B, struct block *blk, const struct echelonize_opts *opts,
+	spasm_ZZp *y, int *mark, int *list, int *stamp)
+{
+	struct echelonize_opts block_opts = *opts;
+	block_opts.L = 1;
+	block_opts.complete = 0;
+	block_opts.enable_dm_blocks = 0;
+	block_opts.enable_dense_tail = 0;
+	struct spasm_csr *D = spasm_submatrix(B, blk->r0, blk->r1, blk->c0, blk->c1, true);
+	struct spasm_lu *fact = spasm_echelonize(D, &block_opts);
+	spasm_csr_free(D);
+	blk->fact = fact;
+
+	const i64 *Bp = B->p;
+	const int *Bj = B->j;
+	const spasm_ZZp *Bx = B->x;
+	const struct spasm_csr *L = fact->L;
+	int r = fact->r;
+	struct spasm_csr *O = spasm_csr_alloc(r, B->m, Bp[blk->r1] - Bp[blk->r0], spasm_get_prime(B), true);
+	i64 onz = 0;
+	for (int t = 0; t < r; t++) {
+		int i = fact->p[t];
+		/* scatter the off-diagonal part of the row of A */
+		*stamp += 1;
+		int top = 0;
+		for (i64 px = Bp[blk->r0 + i]; px < Bp[blk->r0 + i + 1]; px++) {
+			int j = Bj[px];
+			if (j < blk->c1)
+				continue;
+			mark[j] = *stamp;
+			y[j] = Bx[px];
+			list[top++] = j;
+		}
+		/* subtract the previous rows */
+		for (i64 px = L->p[i]; px < L->p[i + 1]; px++) {
+			int s = L->j[px];
+			if (s >= t)
+				continue;
+			spasm_ZZp v = L->x[px];
+			for (i64 qx = O->p[s]; qx < O->p[s + 1]; qx++) {
+				int j = O->j[qx];
+				if (mark[j] != *stamp) {
+					mark[j] = *stamp;
+					y[j] = 0;
+					list[top++] = j;
+				}
+				y[j] = spasm_ZZp_sub(B->field, y[j], spasm_ZZp_mul(B->field, v, O->x[qx]));
+			}
+		}
+		/* divide by the pivot and store */
+		spasm_ZZp alpha = spasm_ZZp_inverse(B->field, csr_get(L, i, t));
+		if (onz + top > O->nzmax)
+			spasm_csr_realloc(O, 2 * O->nzmax + top);
+		for (int k = 0; k < top; k++) {
+			int j = list[k];
+			if (y[j] == 0)
+				continue;
+			O->j[onz] = j;
+			O->x[onz] = spasm_ZZp_mul(B->field, alpha, y[j]);
+			onz += 1;
+		}
+		O->p[t + 1] = onz;
+	}
+	blk->O = O;
+}
+
+/*
+ * Find pivots using the block triangular (Dulmage-Mendelsohn) form of A: the diagonal
+ * blocks are echelonized independently, in parallel (see large_block_threshold).
+ *
+ * The pivotal rows are added to U (and L). Same interface as spasm_pivots_extract_structural:
+ * p is filled with the pivotal rows first, then the others ; returns the number of pivots.
+ */
+int spasm_pivots_extract_dm(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, int *p, struct echelonize_opts *opts)
+{
+	int n = A->n;
+	int m = A->m;
+	double start = spasm_wtime();
+	struct spasm_dm *DM = spasm_dulmage_mendelsohn(A);
+	int *rr = DM->rr;
+	int *cc = DM->cc;
+
+	/* delimit diagonal blocks */
+	int nb;
+	int *br, *bc;
+	int coarse_r[3] = {0, rr[1], n};
+	int coarse_c[3] = {0, cc[2], m};
+	if (rr[2] - rr[1] == 0) {
+		nb = 2;              /* S is empty: H and V */
+		br = coarse_r;
+		bc = coarse_c;
+	} else {
+		nb = DM->nb;
+		br = DM->r;
+		bc = DM->c;
+	}
+	int *qinv = spasm_pinv(DM->q, m);
+	struct spasm_csr *B = spasm_permute(A, DM->p, qinv, true);
+	free(qinv);
+	const i64 *Bp = B->p;
+	const int *Bj = B->j;
+
+	/* check that B is block upper-triangular */
+	for (int k = 0; k < nb; k++)
+		for (i64 px = Bp[br[k]]; px < Bp[br[k + 1]]; px++)
+			if (Bj[px] < bc[k]) {
+				fprintf(stderr, "[pivots] DM form is not block upper-triangular; fallback\n");
+				spasm_csr_free(B);
+				spasm_dm_free(DM);
+				return spasm_pivots_extract_structural(A, p_in, fact, p, opts);
+			}
+
+	struct block *blocks = spasm_malloc(nb * sizeof(*blocks));
+	int nblocks = 0;
+	for (int k = 0; k < nb; k++) {
+		if (br[k] == br[k + 1] || bc[k] == bc[k + 1])
+			continue;
+		struct block *blk = &blocks[nblocks++];
+		blk->r0 = br[k];
+		blk->r1 = br[k + 1];
+		blk->c0 = bc[k];
+		blk->c1 = bc[k + 1];
+		blk->nnz = Bp[br[k + 1]] - Bp[br[k]];
+		blk->fact = NULL;
+		blk->O = NULL;
+	}
+	/* the blocks are echelonized by decreasing size, but U is assembled in DM order */
+	struct block **sched = spasm_malloc(nblocks * sizeof(*sched));
+	for (int k = 0; k < nblocks; k++)
+		sched[k] = &blocks[k];
+	qsort(sched, nblocks, sizeof(*sched), block_cmp);
+	fprintf(stderr, "[pivots] DM: %d non-trivial diagonal blocks, largest has %" PRId64 " nnz\n",
+		nblocks, (nblocks > 0) ? sched[0]->nnz : 0);
+
+	/* large blocks: one at a time, using all threads */
+	i64 large = large_block_threshold(spasm_nnz(B));
+	int nlarge = 0;
+	while (nlarge < nblocks && sched[nlarge]->nnz > large)
+		nlarge += 1;
+	spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+	int *mark = spasm_calloc(m, sizeof(*mark));
+	int *list = spasm_malloc(m * sizeof(*list));
+	int stamp = 0;
+	for (int k = 0; k < nlarge; k++)
+		block_echelonize(B, sched[k], opts, y, mark, list, &stamp);
+	free(y);
+	free(mark);
+	free(list);
+
+	/* small blocks: concurrently */
+	#pragma omp parallel
+	{
+		spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+		int *mark = spasm_calloc(m, sizeof(*mark));
+		int *list = spasm_malloc(m * sizeof(*list));
+		int stamp = 0;
+		#pragma omp for schedule(dynamic, 1)
+		for (int k = nlarge; k < nblocks; k++)
+			block_echelonize(B, sched[k], opts, y, mark, list, &stamp);
+		free(y);
+		free(mark);
+		free(list);
+	}
+	free(sched);
+
+	/* assemble U, L (in DM order: the off-diagonal parts are on the columns of the next blocks) */
+	struct spasm_csr *U = fact->U;
+	struct spasm_rowseg *L = fact->Ltmp;
+	int *Uqinv = fact->qinv;
+	int *Lp = fact->p;
+	const int *Dp = DM->p;
+	const int *Dq = DM->q;
+	i64 unz = spasm_nnz(U);
+	bool *pivotal = spasm_calloc(n, sizeof(*pivotal));
+	int npiv = 0;
+	for (int b = 0; b < nblocks; b++) {
+		struct block *blk = &blocks[b];
+		struct spasm_lu *bfact = blk->fact;
+		const struct spasm_csr *bU = bfact->U;
+		const struct spasm_csr *bL = bfact->L;
+		const struct spasm_csr *O = blk->O;
+		if (unz + spasm_nnz(bU) + spasm_nnz(O) > U->nzmax)
+			spasm_csr_realloc(U, 2 * U->nzmax + spasm_nnz(bU) + spasm_nnz(O));
+		int base = U->n;
+		for (int t = 0; t < bfact->r; t++) {
+			int bi = bfact->p[t];
+			int i = Dp[blk->r0 + bi];
+			int k = U->n;
+			pivotal[i] = 1;
+			p[npiv++] = i;
+			for (i64 px = bU->p[t]; px < bU->p[t + 1]; px++) {
+				U->j[unz] = Dq[blk->c0 + bU->j[px]];
+				U->x[unz] = bU->x[px];
+				unz += 1;
+			}
+			for (i64 px = O->p[t]; px < O->p[t + 1]; px++) {
+				U->j[unz] = Dq[O->j[px]];
+				U->x[unz] = O->x[px];
+				unz += 1;
+			}
+			Uqinv[U->j[U->p[k]]] = k;     /* the pivot comes first */
+			U->n += 1;
+			U->p[U->n] = unz;
+			if (L != NULL) {
+				int i_out = (p_in != NULL) ? p_in[i] : i;
+				Lp[k] = i_out;
+				for (i64 px = bL->p[bi]; px < bL->p[bi + 1]; px++)
+					spasm_rowseg_add_entry(L, i_out, base + bL->j[px], bL->x[px]);
+			}
+		}
+		spasm_lu_free(bfact);
+		spasm_csr_free(blk->O);
+	}
+
+	/* non-pivotal rows */
+	int k = npiv;
+	for (int i = 0; i < n; i++)
+		if (!pivotal[i])
+			p[k++] = i;
+	assert(k == n);
+
+	free(pivotal);
+	free(blocks);
+	spasm_csr_free(B);
+	spasm_dm_free(DM);
+	fprintf(stderr, "[pivots] DM: %d pivots found [%.1fs]\n", npiv, spasm_wtime() - start);
+	return npiv;
+}
+
+/*************************** connected components *****************************/
+
+static int uf_find(int *parent, int x)
+{
+	for (;;) {
+		int p, gp;
+		#pragma omp atomic read
+		p = parent[x];
+		#pragma omp atomic read
+		gp = parent[p];
+		if (p == gp)
+			return p;
+		__sync_bool_compare_and_swap(&parent[x], p, gp);   /* path halving; may fail harmlessly */
+		x = gp;
+	}
+}
+
+/* link the largest root to the smallest one, without locks */
+static void uf_union(int *parent, int a, int b)
+{
+	for (;;) {
+		a = uf_find(parent, a);
+		b = uf_find(parent, b);
+		if (a == b)
+			return;
+		int lo = spasm_min(a, b);
+		int hi = spasm_max(a, b);
+		if (__sync_bool_compare_and_swap(&parent[hi], hi, lo))
+			return;
+	}
+}
+
+/*
+ * Connected components of the bipartite (rows, columns) graph of A, using a concurrent
+ * union-find. On output, rcomp[i] is the component of row i and ccomp[j] that of column j
+ * (or -1 for empty rows/columns). Returns the number of (non-empty) components, numbered
+ * by increasing smallest row.
+ */
+int spasm_connected_components(const struct spasm_csr *A, int *rcomp, int *ccomp)
+{
+	int n = A->n;
+	int m = A->m;
+	const i64 *Ap = A->p;
+	const int *Aj = A->j;
+	int *parent = spasm_malloc((n + m) * sizeof(*parent));    /* rows, then columns */
+	int *root = spasm_malloc((n + m) * sizeof(*root));
+
+	#pragma omp parallel
+	{
+		#pragma omp for
+		for (int u = 0; u < n + m; u++)
+			parent[u] = u;
+
+		#pragma omp for schedule(dynamic, 1024)
+		for (int i = 0; i < n; i++)
+			for (i64 px = Ap[i]; px < Ap[i + 1]; px++)
+				uf_union(parent, i, n + Aj[px]);
+
+		#pragma omp for
+		for (int u = 0; u < n + m; u++)
+			root[u] = uf_find(parent, u);
+	}
+	free(parent);
+
+	/* roots are rows (they are smaller than columns), except for empty columns */
+	int ncomp = 0;
+	for (int i = 0; i < n; i++) {
+		rcomp[i] = -1;
+		if (root[i] == i && Ap[i + 1] > Ap[i])
+			rcomp[i] = ncomp++;
+	}
+	for (int i = 0; i < n; i++)
+		rcomp[i] = rcomp[root[i]];
+	for (int j = 0; j < m; j++) {
+		int r = root[n + j];
+		ccomp[j] = (r < n) ? rcomp[r] : -1;
+	}
+	free(root);
+	return ncomp;
+}
+
+struct component {
+	int n, m;
+	int *rows;                    /* rows of A in this component */
+	int *cols;                    /* columns of A in this component */
+	i64 nnz;
+	struct spasm_lu *fact;
+};
+
+static int component_cmp(const void *a, const void *b)
+{
+	const struct component *x = a;
+	const struct component *y = b;
+	if (x->nnz > y->nnz)
+		return -1;
+	if (x->nnz < y->nnz)
+		return 1;
+	return 0;
+}
+
+/* extract the component as a matrix of its own (jloc maps columns of A to columns of the component) */
+static void component_echelonize(const struct spasm_csr *A, struct component *C, const int *jloc, struct echelonize_opts *opts)
+{
+	struct spasm_csr *B = spasm_csr_alloc(C->n, C->m, C->nnz, spasm_get_prime(A), true);
+	i64 bnz = 0;
+	for (int k = 0; k < C->n; k++) {
+		int i = C->rows[k];
+		for (i64 px = A->p[i]; px < A->p[i + 1]; px++) {
+			B->j[bnz] = jloc[A->j[px]];
+			B->x[bnz] = A->x[px];
+			bnz += 1;
+		}
+		B->p[k + 1] = bnz;
+	}
+	struct echelonize_opts comp_opts = *opts;
+	comp_opts.enable_dense_tail = 0;          /* U is assembled from the components */
+	C->fact = spasm_echelonize(B, &comp_opts);
+	spasm_csr_free(B);
+}
+
+/*
+ * Echelonize each connected component of A on its own, scheduled as the DM blocks (see
+ * large_block_threshold). The rank is the sum of the ranks of the components; U (and L) are block-diagonal.
+ */
+struct spasm_lu * spasm_echelonize_components(const struct spasm_csr *A, struct echelonize_opts *opts)
+{
+	int n = A->n;
+	int m = A->m;
+	double start = spasm_wtime();
+	int *rcomp = spasm_malloc(n * sizeof(*rcomp));
+	int *ccomp = spasm_malloc(m * sizeof(*ccomp));
+	int ncomp = spasm_connected_components(A, rcomp, ccomp);
+	fprintf(stderr, "[components] %d connected components [%.1fs]\n", ncomp, spasm_wtime() - start);
+	if (ncomp <= 1) {
+		free(rcomp);
+		free(ccomp);
+		return spasm_echelonize(A, opts);
+	}
+
+	/* collect rows and columns of each component */
+	struct component *comps = spasm_malloc(ncomp * sizeof(*comps));
+	int *rows = spasm_malloc(n * sizeof(*rows));
+	int *cols = spasm_malloc(m * sizeof(*cols));
+	int *jloc = spasm_malloc(m * sizeof(*jloc));
+	for (int c = 0; c < ncomp; c++) {
+		comps[c].n = 0;
+		comps[c].m = 0;
+		comps[c].nnz = 0;
+		comps[c].fact = NULL;
+	}
+	for (int i = 0; i < n; i++)
+		if (rcomp[i] >= 0) {
+			comps[rcomp[i]].n += 1;
+			comps[rcomp[i]].nnz += spasm_row_weight(A, i);
+		}
+	for (int j = 0; j < m; j++)
+		if (ccomp[j] >= 0)
+			comps[ccomp[j]].m += 1;
+	int rsum = 0, csum = 0;
+	for (int c = 0; c < ncomp; c++) {
+		comps[c].rows = rows + rsum;
+		comps[c].cols = cols + csum;
+		rsum += comps[c].n;
+		csum += comps[c].m;
+		comps[c].n = 0;
+		comps[c].m = 0;
+	}
+	for (int i = 0; i < n; i++)
+		if (rcomp[i] >= 0) {
+			struct component *C = &comps[rcomp[i]];
+			C->rows[C->n++] = i;
+		}
+	for (int j = 0; j < m; j++)
+		if (ccomp[j] >= 0) {
+			struct component *C = &comps[ccomp[j]];
+			jloc[j] = C->m;
+			C->cols[C->m++] = j;
+		}
+	free(rcomp);
+	free(ccomp);
+	qsort(comps, ncomp, sizeof(*comps), component_cmp);
+
+	/* echelonize: large components one at a time, small ones concurrently */
+	i64 large = large_block_threshold(spasm_nnz(A));
+	int nlarge = 0;
+	while (nlarge < ncomp && comps[nlarge].nnz > large)
+		nlarge += 1;
+	for (int c = 0; c < nlarge; c++)
+		component_echelonize(A, &comps[c], jloc, opts);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = nlarge; c < ncomp; c++)
+		component_echelonize(A, &comps[c], jloc, opts);
+	free(jloc);
+
+	/* assemble the block-diagonal factorization */
+	bool with_L = (comps[0].fact->L != NULL);
+	int r = 0;
+	i64 unz = 0;
+	i64 lnz = 0;
+	for (int c = 0; c < ncomp; c++) {
+		r += comps[c].fact->r;
+		unz += spasm_nnz(comps[c].fact->U);
+		if (with_L)
+			lnz += spasm_nnz(comps[c].fact->L);
+	}
+	i64 prime = spasm_get_prime(A);
+	struct spasm_csr *U = spasm_csr_alloc(r, m, unz, prime, true);
+	struct spasm_csr *L = with_L ? spasm_csr_alloc(n, r, lnz, prime, true) : NULL;
+	int *Uqinv = spasm_malloc(m * sizeof(*Uqinv));
+	int *Lp = with_L ? spasm_malloc(r * sizeof(*Lp)) : NULL;
+	int *Lrow = with_L ? spasm_calloc(n + 1, sizeof(*Lrow)) : NULL;     /* row i of L comes from (comp, row) */
+	for (int j = 0; j < m; j++)
+		Uqinv[j] = -1;
+	int k = 0;
+	unz = 0;
+	U->p[0] = 0;
+	for (int c = 0; c < ncomp; c++) {
+		const struct component *C = &comps[c];
+		const struct spasm_lu *cfact = C->fact;
+		const struct spasm_csr *cU = cfact->U;
+		for (int t = 0; t < cfact->r; t++) {
+			for (i64 px = cU->p[t]; px < cU->p[t + 1]; px++) {
+				U->j[unz] = C->cols[cU->j[px]];
+				U->x[unz] = cU->x[px];
+				unz += 1;
+			}
+			U->p[k + t + 1] = unz;
+			Uqinv[U->j[U->p[k + t]]] = k + t;
+			if (with_L)
+				Lp[k + t] = C->rows[cfact->p[t]];
+		}
+		if (with_L)
+			for (int i = 0; i < C->n; i++)
+				Lrow[C->rows[i] + 1] = spasm_row_weight(cfact->L, i);
+		k += cfact->r;
+	}
+	if (with_L) {
+		/* rows of L are interleaved: compute row pointers first */
+		L->p[0] = 0;
+		for (int i = 0; i < n; i++)
+			L->p[i + 1] = L->p[i] + Lrow[i + 1];
+		k = 0;
+		for (int c = 0; c < ncomp; c++) {
+			const struct component *C = &comps[c];
+			const struct spasm_csr *cL = C->fact->L;
+			for (int i = 0; i < C->n; i++) {
+				i64 lx = L->p[C->rows[i]];
+				for (i64 px = cL->p[i]; px < cL->p[i + 1]; px++) {
+					L->j[lx] = k + cL->j[px];
+					L->x[lx] = cL->x[px];
+					lx += 1;
+				}
+			}
+			k += C->fact->r;
+		}
+	}
+	free(Lrow);
+
+	struct spasm_lu *fact = spasm_malloc(sizeof(*fact));
+	fact->r = r;
+	fact->complete = with_L && comps[0].fact->complete;
+	fact->U = U;
+	fact->qinv = Uqinv;
+	fact->L = L;
+	fact->p = Lp;
+	fact->Linv = NULL;
+	fact->Ltmp = NULL;
+	fact->D = NULL;
+	fact->dense_skipped = 0;
+	for (int c = 0; c < ncomp; c++)
+		fact->dense_skipped += comps[c].fact->dense_skipped;
+	if (L != NULL)
+		spasm_lu_index_diagonal(fact);
+	for (int c = 0; c < ncomp; c++)
+		spasm_lu_free(comps[c].fact);
+	free(comps);
+	free(rows);
+	free(cols);
+	fprintf(stderr, "[components] Done in %.1fs. Rank %d, %" PRId64 " nz in basis\n", spasm_wtime() - start, r, unz);
+	if (opts->enable_dense_tail)
+		spasm_lu_pack_dense_tail(fact);
+	return fact;
+}
+
+/*************************** tree-parallel echelonization *****************************/
+
+/* echelonize A[r0:r1] */
+static struct spasm_lu * tree_leaf(const struct spasm_csr *A, int r0, int r1, const struct echelonize_opts *opts)
+{
+	struct spasm_csr *B = spasm_submatrix(A, r0, r1, 0, A->m, true);
+	struct echelonize_opts leaf_opts = *opts;
+	leaf_opts.enable_dense_tail = 0;          /* the rows of U are merged */
+	struct spasm_lu *fact = spasm_echelonize(B, &leaf_opts);
+	spasm_csr_free(B);
+	return fact;
+}
+
+/*
+ * Merge two echelon forms: reduce the rows of U2 w.r.t. U1, echelonize what is left
+ * and append it to U1. F2 is freed; F1 is returned.
+ */
+static struct spasm_lu * tree_merge(struct spasm_lu *F1, struct spasm_lu *F2, const struct echelonize_opts *opts)
+{
+	/* an empty echelon form may have been trimmed to nothing (no room for values) */
+	if (F1->r == 0) {
+		spasm_lu_free(F1);
+		return F2;
+	}
+	if (F2->r == 0) {
+		spasm_lu_free(F2);
+		return F1;
+	}
+	struct spasm_csr *U2 = F2->U;
+	int n2 = U2->n;
+	int *p = spasm_malloc(n2 * sizeof(*p));
+	for (int i = 0; i < n2; i++)
+		p[i] = i;
+	struct spasm_csr *S = spasm_schur(U2, p, n2, F1, -1, NULL, NULL, NULL);
+	free(p);
+	spasm_lu_free(F2);
+	if (spasm_nnz(S) == 0) {
+		spasm_csr_free(S);
+		return F1;
+	}
+
+	/* the pivots of S are on columns that are not pivotal in U1 */
+	struct echelonize_opts merge_opts = *opts;
+	merge_opts.enable_dense_tail = 0;
+	struct spasm_lu *FS = spasm_echelonize(S, &merge_opts);
+	spasm_csr_free(S);
+	struct spasm_csr *U = F1->U;
+	const struct spasm_csr *US = FS->U;
+	int r1 = U->n;
+	i64 unz = spasm_nnz(U);
+	spasm_csr_resize(U, r1 + US->n, U->m);
+	spasm_csr_realloc(U, unz + spasm_nnz(US));
+	for (int t = 0; t < US->n; t++) {
+		for (i64 px = US->p[t]; px < US->p[t + 1]; px++) {
+			U->j[unz] = US->j[px];
+			U->x[unz] = US->x[px];
+			unz += 1;
+		}
+		U->p[r1 + t + 1] = unz;
+		int j = US->j[US->p[t]];
+		assert(F1->qinv[j] < 0);
+		F1->qinv[j] = r1 + t;
+	}
+	F1->r = U->n;
+	spasm_lu_free(FS);
+	return F1;
+}
+
+/*
+ * Tree-parallel echelonization: the rows of A are split into blocks that are echelonized
+ * independently; then pairs of echelon forms are merged, up a binary tree. When there are
+ * fewer tasks than threads at a given level, they are processed one at a time, using all
+ * the threads. Only U / qinv are computed (not L).
+ */
+struct spasm_lu * spasm_echelonize_tree(const struct spasm_csr *A, struct echelonize_opts *opts)
+{
+	struct echelonize_opts default_opts;
+	if (opts == NULL) {
+		opts = &default_opts;
+		spasm_echelonize_init_opts(opts);
+	}
+	if (opts->L || opts->complete) {
+		fprintf(stderr, "[tree] L is not supported; using spasm_echelonize\n");
+		return spasm_echelonize(A, opts);
+	}
+	int n = A->n;
+	int nthreads = omp_get_max_threads();
+	int nleaves = spasm_max(1, spasm_min(2 * nthreads, n));
+	double start = spasm_wtime();
+	fprintf(stderr, "[tree] Start on %d x %d matrix with %" PRId64 " nnz; %d leaves\n", n, A->m, spasm_nnz(A), nleaves);
+
+	struct spasm_lu **F = spasm_malloc(nleaves * sizeof(*F));
+	if (nleaves >= nthreads) {
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int k = 0; k < nleaves; k++)
+			F[k] = tree_leaf(A, (i64) k * n / nleaves, (i64) (k + 1) * n / nleaves, opts);
+	} else {
+		for (int k = 0; k < nleaves; k++)
+			F[k] = tree_leaf(A, (i64) k * n / nleaves, (i64) (k + 1) * n / nleaves, opts);
+	}
+
+	/* merge (the results go to G: F[k] may still be needed by another pair) */
+	struct spasm_lu **G = spasm_malloc(nleaves * sizeof(*G));
+	int level = 0;
+	for (int width = nleaves; width > 1; width = (width + 1) / 2) {
+		int npairs = width / 2;
+		if (npairs >= nthreads) {
+			#pragma omp parallel for schedule(dynamic, 1)
+			for (int k = 0; k < npairs; k++)
+				G[k] = tree_merge(F[2 * k], F[2 * k + 1], opts);
+		} else {
+			for (int k = 0; k < npairs; k++)
+				G[k] = tree_merge(F[2 * k], F[2 * k + 1], opts);
+		}
+		if (width % 2 == 1)
+			G[npairs] = F[width - 1];          /* odd one out */
+		struct spasm_lu **tmp = F;
+		F = G;
+		G = tmp;
+		level += 1;
+		fprintf(stderr, "[tree] level %d done [%.1fs]\n", level, spasm_wtime() - start);
+	}
+
+	struct spasm_lu *fact = F[0];
+	free(F);
+	free(G);
+	struct spasm_csr *U = fact->U;
+	spasm_csr_realloc(U, -1);
+	fprintf(stderr, "[tree] Done in %.1fs. Rank %d, %" PRId64 " nz in basis\n", spasm_wtime() - start, U->n, spasm_nnz(U));
+	if (opts->enable_dense_tail)
+		spasm_lu_pack_dense_tail(fact);
+	return fact;
+}
@@ -21,6 +21,7 @@
 struct spasm_rank_certificate * spasm_certificate_rank_create(const struct spasm_csr *A, const u8 *hash, const struct spasm_lu *fact)
 {
 	assert(fact->L != NULL);
+	assert(fact->D == NULL);         /* see spasm_lu_unpack_dense_tail() */
 	const struct spasm_csr *U = fact->U;
 	const struct spasm_csr *L = fact->L;
 	int n = L->n;
@@ -164,6 +165,7 @@ bool spasm_certificate_rank_verify(const struct spasm_csr *A, const u8 *hash, co
 bool spasm_factorization_verify(const struct spasm_csr *A, const struct spasm_lu *fact, u64 seed)
 {
 	assert(fact->L != NULL);
+	assert(fact->D == NULL);         /* see spasm_lu_unpack_dense_tail() */
 	const struct spasm_csr *U = fact->U;
 	const struct spasm_csr *L = fact->L;
 	// const int *Uqinv = fact->qinv;
@@ -0,0 +1,204 @@
+/*
+ * The dense matrices given to FFLAS-FFPACK hold double, float or i64 (see spasm_datatype_choose).
+ * This file contains the conversions between them and the sparse / spasm_ZZp world. The
+ * datatype is dispatched once per call; the loops are instantiated for each datatype.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "spasm.h"
+}
+
+/* code to make the "runtime type selection" mechanisme work */
+
+spasm_ZZp spasm_datatype_read(const void *A, size_t i, spasm_datatype datatype)
+{
+	switch (datatype) {	
+	case SPASM_DOUBLE: return ((double *) A)[i];
+	case SPASM_FLOAT: return ((float *) A)[i];
+	case SPASM_I64: return ((i64 *) A)[i];
+	}	
+	assert(false);
+}
+
+void spasm_datatype_write(void *A, size_t i, spasm_datatype datatype, spasm_ZZp value)
+{
+	switch (datatype) {	
+	case SPASM_DOUBLE: ((double *) A)[i] = value; return;
+	case SPASM_FLOAT: ((float *) A)[i] = value; return;
+	case SPASM_I64: ((i64 *) A)[i] = value; return;
+	}	
+	assert(false);
+}
+
+size_t spasm_datatype_size(spasm_datatype datatype)
+{
+	switch (datatype) {	
+	case SPASM_DOUBLE: return sizeof(double);
+	case SPASM_FLOAT: return sizeof(float);
+	case SPASM_I64: return sizeof(i64);
+	}	
+	assert(false);	
+}
+
+spasm_datatype spasm_datatype_choose(i64 prime)
+{
+	// return SPASM_DOUBLE;
+	if (prime <= 8191)
+		return SPASM_FLOAT;
+	else if (prime <= 189812531)
+		return SPASM_DOUBLE;
+	else
+		return SPASM_I64;
+}
+
+const char * spasm_datatype_name(spasm_datatype datatype)
+{
+	switch (datatype) {	
+	case SPASM_DOUBLE: return "double";
+	case SPASM_FLOAT: return "float";
+	case SPASM_I64: return "i64";
+	}	
+	assert(false);	
+}
+
+/* dispatch a call to f<T>(...), where the void * arguments are cast to T * */
+#define DISPATCH(datatype, f, ...)                                                 \
+	switch (datatype) {                                                        \
+	case SPASM_DOUBLE: { typedef double T; f<T>(__VA_ARGS__); return; }        \
+	case SPASM_FLOAT:  { typedef float T;  f<T>(__VA_ARGS__); return; }        \
+	case SPASM_I64:    { typedef i64 T;    f<T>(__VA_ARGS__); return; }        \
+	}                                                                          \
+	assert(false);
+
+/* entries of A processed by a single thread */
+#define SEQUENTIAL_THRESHOLD 100000
+
+template<typename T>
+static void to_ZZp(i64 n, const T *A, spasm_ZZp *x)
+{
+	#pragma omp simd
+	for (i64 k = 0; k < n; k++)
+		x[k] = A[k];
+}
+
+template<typename T>
+static void from_ZZp(i64 n, const spasm_ZZp *x, T *A)
+{
+	#pragma omp simd
+	for (i64 k = 0; k < n; k++)
+		A[k] = x[k];
+}
+
+template<typename T>
+static void gather(int n, const int *xj, const spasm_ZZp *x, T *A)
+{
+	#pragma omp simd
+	for (int k = 0; k < n; k++)
+		A[k] = x[xj[k]];
+}
+
+template<typename T>
+static void gather_columns(int n, int m, const T *A, i64 ldA, const int *cols, T *B, i64 ldB)
+{
+	bool inplace = (A == B);
+	assert(!inplace || ldA == ldB);
+	#pragma omp parallel if ((i64) n * m > SEQUENTIAL_THRESHOLD)
+	{
+		T *tmp = inplace ? (T *) spasm_malloc(m * sizeof(T)) : NULL;
+		#pragma omp for schedule(static)
+		for (int i = 0; i < n; i++) {
+			const T *Ai = A + i * ldA;
+			T *Bi = inplace ? tmp : B + i * ldB;
+			#pragma omp simd
+			for (int k = 0; k < m; k++)
+				Bi[k] = Ai[cols[k]];
+			if (inplace)
+				memcpy(B + i * ldB, tmp, m * sizeof(T));
+		}
+		free(tmp);
+	}
+}
+
+template<typename T>
+static void append_rows(struct spasm_csr *U, int n, int m, const T *S, i64 ldS, const int *cols, bool shifted)
+{
+	int r0 = U->n;
+	i64 *Up = U->p;
+	bool parallel = ((i64) n * m > SEQUENTIAL_THRESHOLD);
+
+	/* count */
+	#pragma omp parallel for schedule(static) if (parallel)
+	for (int i = 0; i < n; i++) {
+		const T *Si = S + i * ldS;
+		i64 nz = 1;
+		#pragma omp simd reduction(+:nz)
+		for (int k = shifted ? i + 1 : n; k < m; k++)
+			nz += (Si[k] != 0);
+		Up[r0 + i + 1] = nz;
+	}
+	for (int i = 0; i < n; i++)
+		Up[r0 + i + 1] += Up[r0 + i];
+	if (Up[r0 + n] > U->nzmax)
+		spasm_csr_realloc(U, Up[r0 + n]);
+
+	/* fill */
+	int *Uj = U->j;
+	spasm_ZZp *Ux = U->x;
+	#pragma omp parallel for schedule(static) if (parallel)
+	for (int i = 0; i < n; i++) {
+		const T *Si = S + i * ldS;
+		i64 px = Up[r0 + i];
+		Uj[px] = cols[i];          /* implicit 1 */
+		Ux[px] = 1;
+		px += 1;
+		for (int k = shifted ? i + 1 : n; k < m; k++)
+			if (Si[k] != 0) {
+				Uj[px] = cols[k];
+				Ux[px] = Si[k];
+				px += 1;
+			}
+	}
+	U->n += n;
+}
+
+/* x[0:n] <-- A[0:n] */
+void spasm_dense_to_ZZp(i64 n, const void *A, spasm_ZZp *x, spasm_datatype datatype)
+{
+	DISPATCH(datatype, to_ZZp, n, (const T *) A, x);
+}
+
+/* A[0:n] <-- x[0:n] */
+void spasm_dense_from_ZZp(i64 n, const spasm_ZZp *x, void *A, spasm_datatype datatype)
+{
+	DISPATCH(datatype, from_ZZp, n, x, (T *) A);
+}
+
+/* A[k] <-- x[xj[k]] for k in [0:n] */
+void spasm_dense_gather(int n, const int *xj, const spasm_ZZp *x, void *A, spasm_datatype datatype)
+{
+	DISPATCH(datatype, gather, n, xj, x, (T *) A);
+}
+
+/* 
+ * B[i, k] <-- A[i, cols[k]] for i in [0:n] and k in [0:m] (parallel). A and B may be the same 
+ * matrix (with the same leading dimension).
+ */
+void spasm_dense_gather_columns(int n, int m, const void *A, i64 ldA, const int *cols, void *B, i64 ldB, spasm_datatype datatype)
+{
+	DISPATCH(datatype, gather_columns, n, m, (const T *) A, ldA, cols, (T *) B, ldB);
+}
+
+/*
+ * Append the n rows of the echelonized dense matrix S (n x m, leading dimension ldS) to U 
+ * (parallel). Row i of S has an implicit pivot (== 1) on column i. If shifted, its other 
+ * entries are S[i, i+1:m] (LU); otherwise they are S[i, n:m] (RREF). Column k of S is column 
+ * cols[k] of U. Zero entries are not stored. U is enlarged if necessary; qinv is not updated.
+ */
+void spasm_dense_append_rows(struct spasm_csr *U, int n, int m, const void *S, i64 ldS, spasm_datatype datatype, 
+	const int *cols, bool shifted)
+{
+	DISPATCH(datatype, append_rows, U, n, m, (const T *) S, ldS, cols, shifted);
+}
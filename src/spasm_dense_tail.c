@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+
+#include "spasm.h"
+
+/*
+ * Hybrid storage for U: the last rows of U (typically those produced by the dense
+ * finishers) are stored as a dense block over the columns they touch, with a column map.
+ * In the sparse part of U, these rows only keep their pivot (== 1, first entry), so
+ * that qinv and the "pivot first" property remain valid.
+ *
+ * The dense rows are in echelon order: row r of the block is zero on the pivotal columns
+ * of the rows that precede it. The sparse rows have no pivot on the columns of the block.
+ * Therefore, a triangular solve can be done by eliminating the sparse rows first (the
+ * dense rows are then only seen through their pivot), then the dense rows, with dense
+ * row operations.
+ */
+
+static int cmp_int(const void *a, const void *b)
+{
+	int x = *((const int *) a);
+	int y = *((const int *) b);
+	return (x > y) - (x < y);
+}
+
+void spasm_dense_tail_free(struct spasm_dense_tail *D)
+{
+	if (D == NULL)
+		return;
+	free(D->cols);
+	free(D->cinv);
+	free(D->piv);
+	free(D->x);
+	free(D);
+}
+
+/*
+ * Move the longest suffix of the rows of U that is worth it into a dense block (i.e. when this
+ * saves memory). Returns true if something has been done.
+ */
+bool spasm_lu_pack_dense_tail(struct spasm_lu *fact)
+{
+	struct spasm_csr *U = fact->U;
+	const int *qinv = fact->qinv;
+	if (fact->D != NULL || U->n == 0)
+		return 0;
+	int n = U->n;
+	int m = U->m;
+	i64 *Up = U->p;
+	int *Uj = U->j;
+	spasm_ZZp *Ux = U->x;
+
+	/* scan the rows backwards, and find the suffix that saves most memory */
+	int *cinv = spasm_malloc(m * sizeof(*cinv));
+	int *cols = spasm_malloc(m * sizeof(*cols));
+	for (int j = 0; j < m; j++)
+		cinv[j] = -1;
+	int ncols = 0;
+	i64 nnz = 0;
+	i64 best_gain = 0;
+	int i0 = n;
+	int Dm = 0;
+	for (int i = n - 1; i >= 0; i--) {
+		int pivot = Uj[Up[i]];
+		if (cinv[pivot] >= 0)
+			break;            /* a subsequent row is nonzero on this pivot */
+		bool ok = 1;
+		for (i64 px = Up[i]; px < Up[i + 1]; px++) {
+			int j = Uj[px];
+			if (0 <= qinv[j] && qinv[j] < i)
+				ok = 0;   /* row i is nonzero on the pivot of a previous row */
+		}
+		if (!ok)
+			break;
+		for (i64 px = Up[i]; px < Up[i + 1]; px++) {
+			int j = Uj[px];
+			if (cinv[j] < 0) {
+				cinv[j] = ncols;
+				cols[ncols] = j;
+				ncols += 1;
+			}
+		}
+		nnz += Up[i + 1] - Up[i];
+		i64 k = n - i;
+		i64 sparse = nnz * (sizeof(int) + sizeof(spasm_ZZp));
+		i64 dense = k * ncols * sizeof(spasm_ZZp) + ncols * sizeof(int) + k * (sizeof(int) + sizeof(spasm_ZZp));
+		if (sparse - dense > best_gain) {
+			best_gain = sparse - dense;
+			i0 = i;
+			Dm = ncols;
+		}
+	}
+	if (i0 == n) {
+		free(cinv);
+		free(cols);
+		return 0;
+	}
+
+	/* build the dense block */
+	int Dn = n - i0;
+	struct spasm_dense_tail *D = spasm_malloc(sizeof(*D));
+	D->i0 = i0;
+	D->n = Dn;
+	D->m = Dm;
+	D->cols = spasm_realloc(cols, Dm * sizeof(*cols));
+	qsort(D->cols, Dm, sizeof(int), cmp_int);
+	for (int j = 0; j < m; j++)
+		cinv[j] = -1;
+	for (int k = 0; k < Dm; k++)
+		cinv[D->cols[k]] = k;
+	D->cinv = cinv;
+	D->piv = spasm_malloc(Dn * sizeof(*D->piv));
+	D->x = spasm_calloc((i64) Dn * Dm, sizeof(*D->x));
+	for (int r = 0; r < Dn; r++) {
+		int i = i0 + r;
+		spasm_ZZp *Dr = D->x + (i64) r * Dm;
+		D->piv[r] = cinv[Uj[Up[i]]];
+		for (i64 px = Up[i]; px < Up[i + 1]; px++)
+			Dr[cinv[Uj[px]]] = Ux[px];
+	}
+
+	/* only keep the pivots in the sparse part */
+	i64 unz = Up[i0];
+	for (int i = i0; i < n; i++) {
+		i64 px = Up[i];
+		Uj[unz] = Uj[px];
+		Ux[unz] = Ux[px];
+		Up[i] = unz;
+		unz += 1;
+	}
+	Up[n] = unz;
+	spasm_csr_realloc(U, -1);
+	fact->D = D;
+
+	char hsaved[8];
+	spasm_human_format(best_gain, hsaved);
+	fprintf(stderr, "[dense tail] last %d rows of U stored as a dense %d x %d block (%sB saved)\n", Dn, Dn, Dm, hsaved);
+	return 1;
+}
+
+/* Move the dense rows back in the sparse part of U (pivots first) */
+void spasm_lu_unpack_dense_tail(struct spasm_lu *fact)
+{
+	struct spasm_dense_tail *D = fact->D;
+	if (D == NULL)
+		return;
+	struct spasm_csr *U = fact->U;
+	int i0 = D->i0;
+	int Dm = D->m;
+	i64 unz = U->p[i0];
+	i64 dnz = 0;
+	for (i64 k = 0; k < (i64) D->n * Dm; k++)
+		if (D->x[k] != 0)
+			dnz += 1;
+	spasm_csr_realloc(U, unz + dnz);
+	i64 *Up = U->p;
+	int *Uj = U->j;
+	spasm_ZZp *Ux = U->x;
+	for (int r = 0; r < D->n; r++) {
+		const spasm_ZZp *Dr = D->x + (i64) r * Dm;
+		int c = D->piv[r];
+		Uj[unz] = D->cols[c];
+		Ux[unz] = Dr[c];
+		unz += 1;
+		for (int k = 0; k < Dm; k++)
+			if (k != c && Dr[k] != 0) {
+				Uj[unz] = D->cols[k];
+				Ux[unz] = Dr[k];
+				unz += 1;
+			}
+		Up[i0 + r + 1] = unz;
+	}
+	spasm_dense_tail_free(D);
+	fact->D = NULL;
+}
+
+/* Returns a copy of U where the rows of the dense tail are back in sparse form (pivots first) */
+struct spasm_csr * spasm_dense_tail_expand(const struct spasm_csr *U, const struct spasm_dense_tail *D)
+{
+	int n = U->n;
+	int m = U->m;
+	i64 dnz = 0;
+	for (i64 k = 0; k < (i64) D->n * D->m; k++)
+		if (D->x[k] != 0)
+			dnz += 1;
+	struct spasm_csr *V = spasm_csr_alloc(n, m, U->p[D->i0] + dnz, spasm_get_prime(U), true);
+	i64 vnz = 0;
+	for (int i = 0; i < D->i0; i++) {
+		for (i64 px = U->p[i]; px < U->p[i + 1]; px++) {
+			V->j[vnz] = U->j[px];
+			V->x[vnz] = U->x[px];
+			vnz += 1;
+		}
+		V->p[i + 1] = vnz;
+	}
+	for (int t = 0; t < D->n; t++) {
+		const spasm_ZZp *Dr = D->x + (i64) t * D->m;
+		for (int k = 0; k < D->m; k++)
+			if (Dr[k] != 0) {
+				V->j[vnz] = D->cols[k];
+				V->x[vnz] = Dr[k];
+				vnz += 1;
+			}
+		V->p[D->i0 + t + 1] = vnz;
+	}
+	return V;
+}
+
+/*
+ * Remove the columns of the dense block from the pattern xj[top:m] of x, and gather them in y
+ * (of size D->m). Returns the new top.
+ */
+int spasm_dense_tail_gather(const struct spasm_dense_tail *D, int top, int m, int *xj, const spasm_ZZp *x, spasm_ZZp *y)
+{
+	for (int k = 0; k < D->m; k++)
+		y[k] = 0;
+	int ptr = m;
+	for (int px = m - 1; px >= top; px--) {
+		int j = xj[px];
+		int k = D->cinv[j];
+		if (k >= 0)
+			y[k] = x[j];
+		else
+			xj[--ptr] = j;
+	}
+	return ptr;
+}
+
+/* Scatter y (of size D->m) into x and add its nonzero columns to the pattern xj[top:m]. Returns the new top. */
+int spasm_dense_tail_scatter(const struct spasm_dense_tail *D, int top, int *xj, spasm_ZZp *x, const spasm_ZZp *y)
+{
+	for (int k = D->m - 1; k >= 0; k--) {
+		if (y[k] == 0)
+			continue;
+		int j = D->cols[k];
+		top -= 1;
+		xj[top] = j;
+		x[j] = y[k];
+	}
+	return top;
+}
+
+/*
+ * Eliminate y (of size D->m) with the dense rows, in order. Only the rows i such that
+ * qinv[pivot of i] == i are used. On output, y[k] contains the coefficient of the row
+ * with pivot on column k if there is one, and what remains otherwise (the semantics is
+ * that of spasm_sparse_triangular_solve). If z != NULL, then z[r] is the coefficient of
+ * row r of the block (it must be zeroed out beforehand).
+ */
+void spasm_dense_tail_eliminate(const struct spasm_dense_tail *D, const spasm_field F, spasm_ZZp *y, const int *qinv, spasm_ZZp *z)
+{
+	int Dm = D->m;
+	for (int r = 0; r < D->n; r++) {
+		int c = D->piv[r];
+		if (qinv[D->cols[c]] != D->i0 + r)
+			continue;
+		spasm_ZZp a = y[c];
+		if (a == 0)
+			continue;
+		if (z != NULL)
+			z[r] = a;
+		const spasm_ZZp *Dr = D->x + (i64) r * Dm;
+		for (int k = 0; k < Dm; k++)
+			y[k] = spasm_ZZp_axpy(F, -a, Dr[k], y[k]);
+		y[c] = a;
+	}
+}
+
+/*
+ * Complete spasm_sparse_triangular_solve(U, ...) when U has a dense tail: the input is the
+ * output of the sparse solve (pattern in xj[top:m]). y is a workspace of size D->m.
+ * Returns the new top.
+ */
+int spasm_dense_tail_solve(const struct spasm_dense_tail *D, const spasm_field F, int top, int m, int *xj, spasm_ZZp *x,
+	spasm_ZZp *y, const int *qinv)
+{
+	top = spasm_dense_tail_gather(D, top, m, xj, x, y);
+	spasm_dense_tail_eliminate(D, F, y, qinv, NULL);
+	return spasm_dense_tail_scatter(D, top, xj, x, y);
+}
+
+/*
+ * Same as spasm_dense_forward_solve(U, b, x, q), when U has a dense tail D.
+ */
+bool spasm_dense_tail_forward_solve(const struct spasm_csr *U, const struct spasm_dense_tail *D, spasm_ZZp *b, spasm_ZZp *x,
+	const int *q, const int *qinv)
+{
+	int n = U->n;
+	int m = U->m;
+	for (int i = 0; i < n; i++)
+		x[i] = 0;
+
+	/* sparse rows */
+	for (int i = 0; i < D->i0; i++) {
+		int j = q[i];
+		if (b[j] == 0)
+			continue;
+		x[i] = b[j];
+		spasm_scatter(U, i, -b[j], b);
+		assert(b[j] == 0);
+	}
+
+	/* dense rows */
+	spasm_ZZp *y = spasm_malloc(D->m * sizeof(*y));
+	for (int k = 0; k < D->m; k++) {
+		int j = D->cols[k];
+		y[k] = b[j];
+		b[j] = 0;
+	}
+	spasm_dense_tail_eliminate(D, U->field, y, qinv, x + D->i0);
+	bool ok = 1;
+	for (int k = 0; k < D->m; k++)
+		if (qinv[D->cols[k]] < 0 && y[k] != 0)
+			ok = 0;
+	free(y);
+	for (int j = 0; j < m; j++)   /* check that everything has been eliminated */
+		if (b[j] != 0)
+			return 0;
+	return ok;
+}
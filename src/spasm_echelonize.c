@@ -2,29 +2,39 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 #include "spasm.h"
 
 /* provide sensible defaults */
 void spasm_echelonize_init_opts(struct echelonize_opts *opts)
 {
+	opts->enable_presolve = 0;
 	opts->enable_greedy_pivot_search = 1;
+	opts->enable_dm_blocks = 0;
 	
 	opts->enable_tall_and_skinny = 1;
 	opts->enable_dense = 1;
 	opts->enable_GPLU = 1;
+	opts->enable_right_looking = 0;
 
 	// options of the main procedure
 	opts->L = 0;
 	opts->complete = 0;
 	opts->min_pivot_proportion = 0.1;
 	opts->max_round = 3;
+	opts->enable_streaming_schur = 0;
+	opts->enable_column_compaction = 0;
+	opts->presolve_merge_weight = 3;
 	opts->sparsity_threshold = 0.05;
 	opts->tall_and_skinny_ratio = 5;
 
 	opts->dense_block_size = 1000;
 	opts->low_rank_ratio = 0.5;
 	opts->low_rank_start_weight = -1;
+	opts->memory_budget = 0;
+	opts->enable_dense_tail = 0;
+	opts->dense_tree_width = 0;
 }
 
 bool spasm_echelonize_test_completion(const struct spasm_csr *A, const int *p, int n, struct spasm_csr *U, int *Uqinv)
@@ -42,7 +52,7 @@ bool spasm_echelonize_test_completion(const struct spasm_csr *A, const int *p, i
 	size_t *Sp = spasm_malloc(Sm * sizeof(*Sp));       /* for FFPACK */
 	fprintf(stderr, "[echelonize/completion] Testing completion with %" PRId64" random linear combinations (rank %d)\n", Sn, U->n);
 	fflush(stderr);
-	spasm_schur_dense_randomized(A, p, n, U, Uqinv, S, datatype, q, Sn, 0);
+	spasm_schur_dense_randomized(A, p, n, U, Uqinv, S, datatype, q, Sn, 0, U->n);
 	int rr = spasm_ffpack_rref(prime, Sn, Sm, S, Sm, datatype, Sp);
 	free(S);
 	free(Sp);
@@ -51,21 +61,263 @@ bool spasm_echelonize_test_completion(const struct spasm_csr *A, const int *p, i
 }
 
 
-static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, const int *p_in, struct spasm_lu *fact, struct echelonize_opts *opts)
+/*
+ * Append the reach of the current row to the GPLU record.
+ * Non-pivotal columns with a zero coefficient are encoded as -(j+1).
+ */
+static void record_GPLU_row(struct spasm_symbolic *sym, const int *xj, int top, const spasm_ZZp *x, const int *Uqinv, int jpiv)
+{
+	struct spasm_csr *G = sym->G;
+	int m = G->m;
+	i64 gnz = spasm_nnz(G);
+	if (gnz + m - top > G->nzmax)
+		spasm_csr_realloc(G, 2 * G->nzmax + m - top);
+	int *Gj = G->j;
+	for (int px = top; px < m; px++) {
+		int j = xj[px];
+		Gj[gnz] = (Uqinv[j] < 0 && x[j] == 0) ? -j - 1 : j;
+		gnz += 1;
+	}
+	sym->Gpiv[G->n] = (jpiv < m) ? jpiv : -1;
+	G->n += 1;
+	G->p[G->n] = gnz;
+}
+
+/*
+ * Parallel speculative GPLU. Batches of rows are solved concurrently against a snapshot of U.
+ * Then, sequentially and in order, each solved row is reduced w.r.t. the pivots found since
+ * the snapshot (they form a triangular system in creation order) before it is committed.
+ * This produces exactly the same U / L as the sequential version.
+ */
+static void echelonize_GPLU_speculative(const struct spasm_csr *A, const int *p, int n, const int *p_in, struct spasm_lu *fact)
+{
+	int m = A->m;
+	int r = spasm_min(A->n, m);  /* upper-bound on rank */
+	int nthreads = omp_get_max_threads();
+	int batch = 8 * nthreads;
+	fprintf(stderr, "[echelonize/GPLU] processing matrix of dimension %d x %d (speculative, batches of %d rows)\n", n, m, batch);
+	double start = spasm_wtime();
+
+	struct spasm_csr *U = fact->U;
+	struct spasm_rowseg *L = fact->Ltmp;
+	int *Uqinv = fact->qinv;
+	int *Lp = fact->p;
+
+	/* initialize early abort */
+	int rows_since_last_pivot = 0;
+	bool early_abort_done = 0;
+	bool stop = 0;
+
+	/* speculative solutions: row k of the batch is in Sj/Sx[owner[k]][where[k]:where[k] + Sw[k]] */
+	int **Sj = spasm_malloc(nthreads * sizeof(*Sj));
+	spasm_ZZp **Sx = spasm_malloc(nthreads * sizeof(*Sx));
+	i64 *snzmax = spasm_malloc(nthreads * sizeof(*snzmax));
+	int *owner = spasm_malloc(batch * sizeof(*owner));
+	i64 *where = spasm_malloc(batch * sizeof(*where));
+	int *Sw = spasm_malloc(batch * sizeof(*Sw));
+	/* per-thread workspace of the triangular solver (it leaves xj clean, so it is reused) */
+	spasm_ZZp **Wx = spasm_malloc(nthreads * sizeof(*Wx));
+	int **Wxj = spasm_malloc(nthreads * sizeof(*Wxj));
+	for (int t = 0; t < nthreads; t++) {
+		snzmax[t] = m;
+		Sj[t] = spasm_malloc(m * sizeof(**Sj));
+		Sx[t] = spasm_malloc(m * sizeof(**Sx));
+		Wx[t] = spasm_malloc(m * sizeof(**Wx));
+		Wxj[t] = spasm_calloc(3 * m, sizeof(**Wxj));
+	}
+
+	/* workspace for the commit phase */
+	spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+	int *mark = spasm_calloc(m, sizeof(*mark));
+	int *list = spasm_malloc(m * sizeof(*list));
+	int stamp = 0;
+	i64 speculated = 0;
+	i64 corrected = 0;
+
+	for (int i0 = 0; i0 < n && !stop; i0 += batch) {
+		int b = spasm_min(batch, n - i0);
+		int n0 = U->n;          /* snapshot */
+
+		/* solve the batch concurrently (U is not modified) */
+		#pragma omp parallel
+		{
+			int tid = spasm_get_thread_num();
+			spasm_ZZp *x = Wx[tid];
+			int *xj = Wxj[tid];
+			i64 snz = 0;
+
+			#pragma omp for schedule(dynamic, 1)
+			for (int k = 0; k < b; k++) {
+				int top = spasm_sparse_triangular_solve(U, A, p[i0 + k], xj, x, Uqinv);
+				if (snz + m - top > snzmax[tid]) {
+					snzmax[tid] = 2 * snzmax[tid] + m - top;
+					Sj[tid] = spasm_realloc(Sj[tid], snzmax[tid] * sizeof(**Sj));
+					Sx[tid] = spasm_realloc(Sx[tid], snzmax[tid] * sizeof(**Sx));
+				}
+				owner[k] = tid;
+				where[k] = snz;
+				for (int px = top; px < m; px++) {
+					int j = xj[px];
+					if (x[j] == 0)
+						continue;
+					Sj[tid][snz] = j;
+					Sx[tid][snz] = x[j];
+					snz += 1;
+				}
+				Sw[k] = snz - where[k];
+			}
+		}
+		speculated += b;
+
+		/* commit, sequentially */
+		for (int k = 0; k < b; k++) {
+			int i = i0 + k;
+			if (L == NULL && U->n == r) {
+				fprintf(stderr, "\n[echelonize/GPLU] full rank reached\n");
+				stop = 1;
+				break;
+			}
+			if (L == NULL && !early_abort_done && rows_since_last_pivot > 10 && (rows_since_last_pivot > (n / 100))) {
+				fprintf(stderr, "\n[echelonize/GPLU] testing for early abort...\n");
+				if (spasm_echelonize_test_completion(A, p, n, U, Uqinv)) {
+					stop = 1;
+					break;
+				}
+				early_abort_done = 1;
+			}
+			rows_since_last_pivot += 1;
+			int inew = p[i];
+			int i_orig = (p_in != NULL) ? p_in[inew] : inew;
+
+			/* scatter the speculative solution */
+			stamp += 1;
+			int top = 0;
+			const int *kj = Sj[owner[k]] + where[k];
+			const spasm_ZZp *kx = Sx[owner[k]] + where[k];
+			for (int px = 0; px < Sw[k]; px++) {
+				int j = kj[px];
+				mark[j] = stamp;
+				y[j] = kx[px];
+				list[top++] = j;
+			}
+
+			/* eliminate the pivots found since the snapshot, in creation order */
+			if (U->n > n0)
+				corrected += 1;
+			for (int t = n0; t < U->n; t++) {
+				int jpiv = U->j[U->p[t]];
+				if (mark[jpiv] != stamp || y[jpiv] == 0)
+					continue;
+				spasm_ZZp c = y[jpiv];
+				if (L != NULL)
+					spasm_rowseg_add_entry(L, i_orig, t, c);
+				y[jpiv] = 0;
+				for (i64 px = U->p[t] + 1; px < U->p[t + 1]; px++) {
+					int j = U->j[px];
+					if (mark[j] != stamp) {
+						mark[j] = stamp;
+						y[j] = 0;
+						list[top++] = j;
+					}
+					y[j] = spasm_ZZp_sub(A->field, y[j], spasm_ZZp_mul(A->field, c, U->x[px]));
+				}
+			}
+
+			/* find pivot column (leftmost); the rest goes into L */
+			int jpiv = m;
+			int row_unz = 0;
+			for (int px = 0; px < top; px++) {
+				int j = list[px];
+				if (y[j] == 0)
+					continue;
+				if (Uqinv[j] < 0) {
+					row_unz += 1;
+					if (j < jpiv)
+						jpiv = j;
+				} else if (L != NULL && Uqinv[j] < n0) {
+					spasm_rowseg_add_entry(L, i_orig, Uqinv[j], y[j]);
+				}
+			}
+			if (jpiv == m)
+				continue;        /* no pivot found */
+
+			if (L != NULL) {
+				Lp[U->n] = i_orig;
+				spasm_rowseg_add_entry(L, i_orig, U->n, y[jpiv]);
+			}
+
+			/* store new pivotal row into U */
+			i64 unz = spasm_nnz(U);
+			if (unz + row_unz > U->nzmax)
+				spasm_csr_realloc(U, 2 * U->nzmax + m);
+			Uqinv[jpiv] = U->n;
+			U->j[unz] = jpiv;
+			U->x[unz] = 1;
+			unz += 1;
+			spasm_ZZp beta = spasm_ZZp_inverse(A->field, y[jpiv]);
+			for (int px = 0; px < top; px++) {
+				int j = list[px];
+				if (y[j] != 0 && Uqinv[j] < 0) {
+					U->j[unz] = j;
+					U->x[unz] = spasm_ZZp_mul(A->field, beta, y[j]);
+					unz += 1;
+				}
+			}
+			U->n += 1;
+			U->p[U->n] = unz;
+
+			/* reset early abort */
+			rows_since_last_pivot = 0;
+			early_abort_done = 0;
+		}
+		fprintf(stderr, "\r[echelonize/GPLU] %d / %d [|U| = %" PRId64 "] --- rank >= %d [%.1fs]", 
+			spasm_min(i0 + b, n), n, spasm_nnz(U), U->n, spasm_wtime() - start);
+		fflush(stderr);
+	}
+	if (L)
+		L->m = U->n;
+	fprintf(stderr, "\n[echelonize/GPLU] %" PRId64 " rows solved speculatively, %" PRId64 " needed a correction\n", speculated, corrected);
+	for (int t = 0; t < nthreads; t++) {
+		free(Sj[t]);
+		free(Sx[t]);
+		free(Wx[t]);
+		free(Wxj[t]);
+	}
+	free(Sj);
+	free(Sx);
+	free(Wx);
+	free(Wxj);
+	free(snzmax);
+	free(owner);
+	free(where);
+	free(Sw);
+	free(y);
+	free(mark);
+	free(list);
+}
+
+/*
+ * if sym != NULL, the reach of each processed row and the pivots are recorded
+ */
+static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, const int *p_in, struct spasm_lu *fact, 
+	struct echelonize_opts *opts, struct spasm_symbolic *sym)
 {
 	(void) opts;
 	assert(p != NULL);
+	if (sym == NULL && omp_get_max_threads() > 1) {
+		echelonize_GPLU_speculative(A, p, n, p_in, fact);
+		return;
+	}
 	int m = A->m;
 	int r = spasm_min(A->n, m);  /* upper-bound on rank */
 	int verbose_step = spasm_max(1, n / 1000);
 	fprintf(stderr, "[echelonize/GPLU] processing matrix of dimension %d x %d\n", n, m);
 	
 	struct spasm_csr *U = fact->U;
-	struct spasm_triplet *L = fact->Ltmp;
+	struct spasm_rowseg *L = fact->Ltmp;
 	int *Uqinv = fact->qinv;
 	i64 *Up = U->p;
 	i64 unz = spasm_nnz(U);
-	i64 lnz = (L != NULL) ? L->nz : 0;
 	int *Lp = fact->p;
 
 	/* initialize early abort */
@@ -77,6 +329,12 @@ static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, cons
 	int *xj = spasm_malloc(3 * m * sizeof(*xj));
 	for (int j = 0; j < 3*m; j++)
 		xj[j] = 0;
+	if (sym != NULL) {
+		sym->G = spasm_csr_alloc(n, m, spasm_nnz(A), spasm_get_prime(A), false);
+		sym->G->n = 0;
+		sym->Gpiv = spasm_malloc(n * sizeof(*sym->Gpiv));
+		sym->G_completion = 0;
+	}
 
 	/* Main loop : compute L[i] and U[i] */
 	int i;
@@ -89,22 +347,20 @@ static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, cons
 		/* TODO: make these hard-coded values options */
 		if (L == NULL && !early_abort_done && rows_since_last_pivot > 10 && (rows_since_last_pivot > (n / 100))) {
 			fprintf(stderr, "\n[echelonize/GPLU] testing for early abort...\n");
-			if (spasm_echelonize_test_completion(A, p, n, U, Uqinv))
+			if (spasm_echelonize_test_completion(A, p, n, U, Uqinv)) {
+				if (sym != NULL)
+					sym->G_completion = 1;
 				break;
+			}
 			early_abort_done = 1;
 		}
 		rows_since_last_pivot += 1;
 
-		/* ensure enough room in L / U for an extra row */
+		/* ensure enough room in U for an extra row */
 		if (unz + m > U->nzmax)
 			spasm_csr_realloc(U, 2 * U->nzmax + m);
 		int *Uj = U->j;
 		spasm_ZZp *Ux = U->x;
-		if (L && lnz + m > L->nzmax)
-			spasm_triplet_realloc(L, 2 * L->nzmax + m);
-		int *Li = (L != NULL) ? L->i : NULL;
-		int *Lj = (L != NULL) ? L->j : NULL;
-		spasm_ZZp *Lx = (L != NULL) ? L->x : NULL;
 
 		/* Triangular solve: x * U = A[i] */
 		int inew = p[i];
@@ -123,12 +379,11 @@ static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, cons
 					jpiv = j;
 			} else if (L != NULL) {
 				/* everything under pivotal columns goes into L */
-				Li[lnz] = i_orig;
-				Lj[lnz] = Uqinv[j];
-				Lx[lnz] = x[j];
-				lnz += 1;
+				spasm_rowseg_add_entry(L, i_orig, Uqinv[j], x[j]);
 			}	
 		}
+		if (sym != NULL)
+			record_GPLU_row(sym, xj, top, x, Uqinv, jpiv);
 		
 		if (jpiv == m)
 			continue;        /* no pivot found */
@@ -137,10 +392,7 @@ static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, cons
 		if (L != NULL) {
 			assert(x[jpiv] != 0);
 			Lp[U->n] = i_orig;
-			Li[lnz] = i_orig;
-			Lj[lnz] = U->n;
-			Lx[lnz] = x[jpiv];
-			lnz += 1;
+			spasm_rowseg_add_entry(L, i_orig, U->n, x[jpiv]);
 		}
 
 		/* store new pivotal row into U */
@@ -172,144 +424,237 @@ static void echelonize_GPLU(const struct spasm_csr *A, const int *p, int n, cons
 
 		if ((i % verbose_step) == 0) {
 			fprintf(stderr, "\r[echelonize/GPLU] %d / %d [|U| = %" PRId64 " / |L| = %" PRId64"] -- current density= (%.3f vs %.3f) --- rank >= %d", 
-				i, n, unz, lnz, 1.0 * (m - top) / (m), 1.0 * (unz - old_unz) / m, U->n);
+				i, n, unz, (L != NULL) ? L->nz : 0, 1.0 * (m - top) / (m), 1.0 * (unz - old_unz) / m, U->n);
 			fflush(stderr);
 		}
 	}
 	/* cleanup */
-	if (L) {
-		L->nz = lnz;
+	if (L)
 		L->m = U->n;
-	}
 	fprintf(stderr, "\n");
 	free(x);
 	free(xj);
 }
 
 /*
- * Transfer echelonized rows from (dense) S to (sparse) U
+ * Replay a recorded run of GPLU on (P*A)[0:n], where A has new numerical values.
+ * Returns false if the recorded pivots / patterns are not valid for A.
  */
-static void update_U_after_rref(int rr, int Sm, const void *S, spasm_datatype datatype, 
-	const size_t *Sqinv, const int *q, struct spasm_lu *fact)
+static bool replay_GPLU(const struct spasm_csr *A, const int *p, int n, const int *p_in, struct spasm_lu *fact, 
+	const struct spasm_symbolic *sym)
 {
+	const struct spasm_csr *G = sym->G;
+	const i64 *Gp = G->p;
+	const int *Gj = G->j;
+	const int *Gpiv = sym->Gpiv;
+	int m = A->m;
+	fprintf(stderr, "[echelonize/GPLU/replay] processing %d rows of a matrix of dimension %d x %d\n", G->n, n, m);
+
 	struct spasm_csr *U = fact->U;
+	struct spasm_rowseg *L = fact->Ltmp;
 	int *Uqinv = fact->qinv;
-	i64 extra_nnz = ((i64) (1 + Sm - rr)) * rr;     /* maximum size increase */
-	i64 unz = spasm_nnz(U);
-	fprintf(stderr, "[dense update] enlarging U from %" PRId64 " to %" PRId64 " entries\n", unz, unz + extra_nnz);
-	spasm_csr_realloc(U, unz + extra_nnz);
 	i64 *Up = U->p;
-	int *Uj = U->j;
-	spasm_ZZp *Ux = U->x;
-	for (i64 i = 0; i < rr; i++) {
-		int j = Sqinv[i];   /* column (of S) with the pivot on row i of S; the pivot is implicitly 1 */
-		Uj[unz] = q[j];  /* column of A with the pivot */
+	i64 unz = spasm_nnz(U);
+	int *Lp = fact->p;
+	spasm_ZZp *x = spasm_malloc(m * sizeof(*x));
+	bool ok = 1;
+
+	for (int i = 0; ok && i < G->n; i++) {
+		/* ensure enough room in U for an extra row */
+		int w = Gp[i + 1] - Gp[i];
+		if (unz + w > U->nzmax)
+			spasm_csr_realloc(U, 2 * U->nzmax + w);
+		int *Uj = U->j;
+		spasm_ZZp *Ux = U->x;
+
+		/* Triangular solve x * U = A[i] along the recorded pattern */
+		int inew = p[i];
+		int i_orig = (p_in != NULL) ? p_in[inew] : inew;
+		for (i64 px = Gp[i]; px < Gp[i + 1]; px++) {
+			int j = Gj[px];
+			x[(j < 0) ? -j - 1 : j] = 0;
+		}
+		spasm_scatter(A, inew, 1, x);
+		for (i64 px = Gp[i]; px < Gp[i + 1]; px++) {
+			int j = Gj[px];
+			if (j < 0 || Uqinv[j] < 0 || x[j] == 0)
+				continue;
+			spasm_ZZp backup = x[j];
+			spasm_scatter(U, Uqinv[j], -x[j], x);
+			x[j] = backup;
+		}
+
+		/* check the pattern; fill L */
+		for (i64 px = Gp[i]; px < Gp[i + 1]; px++) {
+			int j = Gj[px];
+			if (j < 0) {
+				if (x[-j - 1] != 0)
+					ok = 0;
+				continue;
+			}
+			if (L != NULL && Uqinv[j] >= 0 && x[j] != 0)
+				spasm_rowseg_add_entry(L, i_orig, Uqinv[j], x[j]);
+		}
+		int jpiv = Gpiv[i];
+		if (!ok || jpiv < 0)
+			continue;
+		if (x[jpiv] == 0) {
+			ok = 0;          /* numerical cancellation of the pivot */
+			continue;
+		}
+
+		/* add entry entry in L for the pivot */
+		if (L != NULL) {
+			Lp[U->n] = i_orig;
+			spasm_rowseg_add_entry(L, i_orig, U->n, x[jpiv]);
+		}
+
+		/* store new pivotal row into U */
+		Uqinv[jpiv] = U->n;
+		Uj[unz] = jpiv;
 		Ux[unz] = 1;
 		unz += 1;
-		Uqinv[q[j]] = U->n;
-		for (i64 k = rr; k < Sm; k++) {
-			i64 j = Sqinv[k];
-			spasm_ZZp x = spasm_datatype_read(S, i * Sm + k, datatype);
-			if (x == 0)
-				continue;   /* don't store zero */
-			Uj[unz] = q[j];
-			Ux[unz] = x;  // reduce?
-			unz += 1;
+		spasm_ZZp beta = spasm_ZZp_inverse(A->field, x[jpiv]);
+		for (i64 px = Gp[i]; px < Gp[i + 1]; px++) {
+			int j = Gj[px];
+			if (j >= 0 && x[j] != 0 && Uqinv[j] < 0) {
+				Uj[unz] = j;
+				Ux[unz] = spasm_ZZp_mul(A->field, beta, x[j]);
+				unz += 1;
+			}
 		}
 		U->n += 1;
 		Up[U->n] = unz;
 	}
-	assert(unz == spasm_nnz(U));
+	if (L)
+		L->m = U->n;
+	free(x);
+	if (ok && sym->G_completion) {
+		fprintf(stderr, "[echelonize/GPLU/replay] testing for early abort...\n");
+		ok = spasm_echelonize_test_completion(A, p, n, U, Uqinv);
+	}
+	return ok;
+}
+
+/*
+ * Choose the number of rows of the dense blocks and their datatype. Without a memory budget, 
+ * this is opts->dense_block_size and the smallest datatype that works mod p. Otherwise, the 
+ * budget must hold:
+ * - the current U, plus the rows it may gain during the dense phase (at most min(n, Sm));
+ * - copies x (b x Sm) dense coefficients (the blocks, plus the FFPACK workspace);
+ * - if L is needed, the entries of L created for each row of the blocks.
+ * When the prime is small enough for float, double is preferred if it does not shrink the blocks
+ * below opts->dense_block_size rows (FFLAS delays the modular reductions much longer).
+ */
+static int dense_block_rows(int n, int Sm, i64 prime, const struct spasm_lu *fact, const struct echelonize_opts *opts,
+	int copies, spasm_datatype *datatype)
+{
+	*datatype = spasm_datatype_choose(prime);
+	if (opts->memory_budget <= 0)
+		return opts->dense_block_size;
+	const struct spasm_csr *U = fact->U;
+	i64 csr_entry = sizeof(int) + sizeof(spasm_ZZp);
+	i64 segment = sizeof(int) + sizeof(i64);
+	i64 rank_ub = spasm_min(n, Sm);
+	i64 fixed = (spasm_nnz(U) + rank_ub * (Sm - (rank_ub - 1) / 2)) * csr_entry;
+	if (fact->Ltmp != NULL)
+		fixed += fact->Ltmp->nz * csr_entry + fact->Ltmp->ns * segment;
+	i64 available = opts->memory_budget - fixed;
+	i64 per_row_L = (opts->L) ? ((i64) U->n + Sm) * csr_entry + 2 * segment : 0;
+	
+	int b = 0;
+	int nmax = spasm_max(1, n);
+	spasm_datatype candidates[2] = {SPASM_DOUBLE, *datatype};
+	for (int k = (*datatype == SPASM_FLOAT) ? 0 : 1; k < 2; k++) {
+		i64 per_row = (i64) copies * Sm * spasm_datatype_size(candidates[k]) + per_row_L + 1;
+		i64 rows = (available > 0) ? available / per_row : 0;
+		b = (rows < nmax) ? spasm_max(1, rows) : nmax;
+		if (k == 0 && b < spasm_min(nmax, opts->dense_block_size))
+			continue;      /* double would make the blocks too small */
+		*datatype = candidates[k];
+		break;
+	}
+	char tmp[8];
+	spasm_human_format(opts->memory_budget, tmp);
+	fprintf(stderr, "[echelonize/dense] memory budget %s byte: blocks of %d rows, type %s%s\n", tmp, b, 
+		spasm_datatype_name(*datatype), (available > 0) ? "" : " (budget too small!)");
+	return b;
+}
+
+/*
+ * Transfer echelonized rows from (dense) S to (sparse) U
+ */
+static void update_U_after_rref(int rr, int Sm, const void *S, int ldS, spasm_datatype datatype, 
+	const size_t *Sqinv, const int *q, struct spasm_lu *fact)
+{
+	struct spasm_csr *U = fact->U;
+	int *Uqinv = fact->qinv;
+	i64 unz = spasm_nnz(U);
+	int *cols = spasm_malloc(Sm * sizeof(*cols));     /* column k of S is column cols[k] of A */
+	for (int k = 0; k < Sm; k++)
+		cols[k] = q[Sqinv[k]];
+	for (int i = 0; i < rr; i++)
+		Uqinv[cols[i]] = U->n + i;   /* the pivot of row i of S is (implicitly 1) on column i */
+	spasm_dense_append_rows(U, rr, Sm, S, ldS, datatype, cols, false);
+	fprintf(stderr, "[dense update] U enlarged from %" PRId64 " to %" PRId64 " entries\n", unz, spasm_nnz(U));
+	free(cols);
 }
 
 /*
  * Transfer dense LU factorization to fact
  */
 static void update_fact_after_LU(int n, int Sm, int r, const void *S, spasm_datatype datatype, 
-	const size_t *Sp, const size_t *Sqinv, const int *q, const int *p_in, i64 lnz_before, 
+	const size_t *Sp, const size_t *Sqinv, const int *q, const int *p_in, i64 ls_before, 
 	bool complete, bool *pivotal, struct spasm_lu *fact)
 {
 	struct spasm_csr *U = fact->U;
-	struct spasm_triplet *L = fact->Ltmp;
+	struct spasm_rowseg *L = fact->Ltmp;
 	int *Uqinv = fact->qinv;
 	int *Lp = fact->p;
-	i64 extra_unz = ((i64) (1 + 2*Sm - r)) * r;     /* maximum size increase */
-	i64 extra_lnz = ((i64) (2*n - r + 1)) * r / 2;
-	i64 unz = spasm_nnz(U);
-	i64 lnz = L->nz;
-	spasm_csr_realloc(U, unz + extra_unz);
-	spasm_triplet_realloc(L, lnz + extra_lnz);
-	i64 *Up = U->p;
-	int *Uj = U->j;
-	spasm_ZZp *Ux = U->x;
-	int *Li = L->i;
-	int *Lj = L->j;
-	spasm_ZZp *Lx = L->x;
 	
 	/* build L */
 	if (!complete) {
 		for (i64 i = 0; i < r; i++) {   /* mark pivotal rows */
 			int pi = Sp[i];
 			int iorig = (p_in != NULL) ? p_in[pi] : pi;
+			assert(iorig < L->n);
 			pivotal[iorig] = 1;
 		}
 
 		/* stack L (ignore non-pivotal rows) */
-		lnz = lnz_before;
-		for (i64 px = lnz_before; px < L->nz; px++) {
-			int i = Li[px];
-			if (!pivotal[i])
-				continue;
-			int j = Lj[px];
-			spasm_ZZp x = Lx[px];
-			Li[lnz] = i;
-			Lj[lnz] = j;
-			Lx[lnz] = x;
-			lnz += 1;
-		}
-		fprintf(stderr, "L : %" PRId64 " --> %" PRId64 " --> %" PRId64 " ---> ", lnz_before, L->nz, lnz);
+		i64 lnz_before = L->sp[ls_before];
+		i64 lnz = L->nz;
+		spasm_rowseg_squeeze(L, ls_before, NULL, pivotal);
+		fprintf(stderr, "L : %" PRId64 " --> %" PRId64 " --> %" PRId64 " ---> ", lnz_before, lnz, L->nz);
 	}
 
 	/* add new entries from S */
+	i64 extra_lnz = ((i64) (2*n - r + 1)) * r / 2;     /* maximum size increase */
+	spasm_rowseg_realloc(L, L->nz + extra_lnz, L->ns + n);
+	spasm_ZZp *Mi = spasm_malloc(r * sizeof(*Mi));
 	for (i64 i = 0; i < (complete ? n : r); i++) {
 		int pi = Sp[i];
 		int iorig = (p_in != NULL) ? p_in[pi] : pi;
+		spasm_dense_to_ZZp(spasm_min(i + 1, r), (const char *) S + i * Sm * spasm_datatype_size(datatype), Mi, datatype);
 		for (i64 j = 0; j < spasm_min(i + 1, r); j++) {
-			spasm_ZZp Mij = spasm_datatype_read(S, i  * Sm + j, datatype);
-			if (Mij == 0)
-				continue;
-			Li[lnz] = iorig;
-			Lj[lnz] = U->n + j;
-			Lx[lnz] = Mij;
-			lnz += 1;
+			spasm_ZZp Mij = Mi[j];
+			if (Mij != 0)
+				spasm_rowseg_add_entry(L, iorig, U->n + j, Mij);
 		}
 		if (i < r)   /* register pivot */
 			Lp[U->n + i] = iorig;
 	}
-	L->nz = lnz;
-	fprintf(stderr, "%" PRId64 "\n", lnz);
+	free(Mi);
+	fprintf(stderr, "%" PRId64 "\n", L->nz);
 
-	/* fill U */
-	for (i64 i = 0; i < r; i++) {
-		/* implicit 1 in U */
-		int j = Sqinv[i];
-		int jorig = q[j];
-		Uj[unz] = jorig;
-		Ux[unz] = 1;
-		unz += 1;
-		/* register pivot */
-		Uqinv[jorig] = U->n;
-		for (i64 j = i+1; j < Sm; j++) {
-			int jnew = Sqinv[j];
-			int jorig = q[jnew];
-			spasm_ZZp x = spasm_datatype_read(S, i * Sm + j, datatype);
-			Uj[unz] = jorig;
-			Ux[unz] = x;
-			unz += 1;
-		}
-		U->n += 1;
-		Up[U->n] = unz;
-	}
+	/* fill U (the pivots are implicitly 1) */
+	int *cols = spasm_malloc(Sm * sizeof(*cols));     /* column k of S is column cols[k] of A */
+	for (int k = 0; k < Sm; k++)
+		cols[k] = q[Sqinv[k]];
+	for (int i = 0; i < r; i++)
+		Uqinv[cols[i]] = U->n + i;
+	spasm_dense_append_rows(U, r, Sm, S, Sm, datatype, cols, true);
+	free(cols);
 }
 
 static void echelonize_dense_lowrank(const struct spasm_csr *A, const int *p, int n, struct spasm_lu *fact, struct echelonize_opts *opts)
@@ -320,9 +665,10 @@ static void echelonize_dense_lowrank(const struct spasm_csr *A, const int *p, in
 	int m = A->m;
 	int Sm = m - U->n;
 	i64 prime = spasm_get_prime(A);
-	spasm_datatype datatype = spasm_datatype_choose(prime);
+	spasm_datatype datatype;
+	int bs = dense_block_rows(n, Sm, prime, fact, opts, 2, &datatype);
 
-	i64 size_S = (i64) opts->dense_block_size * (i64) Sm * spasm_datatype_size(datatype);
+	i64 size_S = (i64) bs * (i64) Sm * spasm_datatype_size(datatype);
 	void *S = spasm_malloc(size_S);
 	int *q = spasm_malloc(Sm * sizeof(*q));
 	size_t *Sp = spasm_malloc(Sm * sizeof(*Sp));       /* for FFPACK */
@@ -330,11 +676,11 @@ static void echelonize_dense_lowrank(const struct spasm_csr *A, const int *p, in
 	int old_un = U->n;
 	int round = 0;
 	fprintf(stderr, "[echelonize/dense/low-rank] processing dense schur complement of dimension %d x %d; block size=%d, type %s\n", 
-		n, Sm, opts->dense_block_size, spasm_datatype_name(datatype));
+		n, Sm, bs, spasm_datatype_name(datatype));
 	
 	/* 
 	 * stupid algorithm to decide a starting weight:
-	 * - estimate the number of passes as rank_ub / opts->dense_block_size
+	 * - estimate the number of passes as rank_ub / bs
 	 * - thus rank_ub * w rows are selected in total
 	 * - a single row is never selected with proba (1 - 1/n) ** (rank_ub * w)
 	 * - choose w such that this is less than 0.01
@@ -346,12 +692,12 @@ static void echelonize_dense_lowrank(const struct spasm_csr *A, const int *p, in
 
 	for (;;) {
 		/* compute a chunk of the schur complement, then echelonize with FFPACK */
-		int Sn = spasm_min(rank_ub, opts->dense_block_size);
+		int Sn = spasm_min(rank_ub, bs);
 		if (Sn <= 0)
 			break;		
 		fprintf(stderr, "[echelonize/dense/low-rank] Round %d. Weight %d. Processing chunk (%d x %d), |U| = %"PRId64"\n", 
 			round, w, Sn, Sm, spasm_nnz(U));
-		spasm_schur_dense_randomized(A, p, n, U, Uqinv, S, datatype, q, Sn, w);
+		spasm_schur_dense_randomized(A, p, n, U, Uqinv, S, datatype, q, Sn, w, ((u64) round << 32) | (u64) old_un);
 		int rr = spasm_ffpack_rref(prime, Sn, Sm, S, Sm, datatype, Sp);
 
 		if (rr == 0) {
@@ -365,7 +711,7 @@ static void echelonize_dense_lowrank(const struct spasm_csr *A, const int *p, in
 			w *= 2;
 			fprintf(stderr, "[echelonize/dense/low-rank] Not enough pivots, increasing weight to %d\n", w);
 		}
-		update_U_after_rref(rr, Sm, S, datatype, Sp, q, fact);
+		update_U_after_rref(rr, Sm, S, Sm, datatype, Sp, q, fact);
 		n -= rr;
 		Sm -= rr;
 		rank_ub -= rr;
@@ -378,6 +724,339 @@ static void echelonize_dense_lowrank(const struct spasm_csr *A, const int *p, in
 	free(Sp);
 }
 
+/*
+ * Pipelined dense phase (L not needed). While FFPACK computes the RREF of block k, the next
+ * block is computed against the pivots known so far (i.e. without those of block k). Then
+ * it is corrected for the new pivots with a dense update: with R = rref(block k), 
+ * S <-- S - S[:, pivots] * R[:, non-pivots] (lookahead). S[:, non-pivots] is the next block.
+ */
+static void echelonize_dense_pipelined(const struct spasm_csr *A, const int *p, int n, struct spasm_lu *fact, struct echelonize_opts *opts,
+	int bs, spasm_datatype datatype)
+{
+	struct spasm_csr *U = fact->U;
+	int m = A->m;
+	int Sm = m - U->n;
+	i64 prime = spasm_get_prime(A);
+	size_t dsize = spasm_datatype_size(datatype);
+
+	/* two blocks: the one being echelonized and the lookahead one */
+	void *S[2];
+	int *q[2];
+	for (int k = 0; k < 2; k++) {
+		S[k] = spasm_malloc((i64) bs * Sm * dsize);
+		q[k] = spasm_malloc(Sm * sizeof(*q[k]));
+	}
+	void *X = spasm_malloc((i64) bs * Sm * dsize);
+	size_t *Sqinv = spasm_malloc(Sm * sizeof(*Sqinv));
+	int *p_out = spasm_malloc(bs * sizeof(*p_out));
+	int *pos = spasm_malloc(m * sizeof(*pos));
+	int *perm = spasm_malloc(Sm * sizeof(*perm));
+	int nthreads = omp_get_max_threads();
+
+	double start = spasm_wtime();
+	int old_un = U->n;
+	fprintf(stderr, "[echelonize/dense] processing dense schur complement of dimension %d x %d; block size=%d, type %s (pipelined)\n", 
+		n, Sm, bs, spasm_datatype_name(datatype));
+
+	/* first block */
+	int cur = 0;
+	int Sn = spasm_min(bs, n);
+	spasm_schur_dense(A, p, Sn, NULL, fact, S[cur], datatype, q[cur], p_out);
+	int ld = Sm;                   /* the current block is Sn x Sm, with leading dimension ld */
+	int done = 0;                  /* rows of A already echelonized */
+	int processed = Sn;            /* rows of A already in a block */
+	bool lowrank_mode = 0;
+	int dependent = 0;
+	int next_test = spasm_max(10, n / 100);
+	int round = 0;
+
+	for (;;) {
+		/* echelonize the current block while computing the next one */
+		int nxt = 1 - cur;
+		int Tn = spasm_min(bs, n - processed);
+		int rr = 0;
+		fprintf(stderr, "[echelonize/dense] Round %d. processing S[%d:%d] (%d x %d), lookahead S[%d:%d]\n", 
+			round, done, done + Sn, Sn, Sm, processed, processed + Tn);
+		int *order = (Tn > 0) ? spasm_schur_dense_prepare(A, p + processed, Tn, fact, q[nxt]) : NULL;
+		#pragma omp parallel
+		{
+			/* one thread echelonizes, the others compute the lookahead block; it joins them when done */
+			#pragma omp single nowait
+			rr = spasm_ffpack_rref(prime, Sn, Sm, S[cur], ld, datatype, Sqinv);
+			if (Tn > 0)
+				spasm_schur_dense_rows(A, p + processed, Tn, NULL, fact, S[nxt], datatype, q[nxt], order, p_out);
+		}
+		free(order);
+		update_U_after_rref(rr, Sm, S[cur], ld, datatype, Sqinv, q[cur], fact);
+		fprintf(stderr, "[echelonize/dense] found %d new pivots\n", rr);
+		round += 1;
+		done += Sn;
+		if (Tn == 0)
+			break;
+
+		/* 
+		 * The lookahead block T is (Tn x Sm), with columns q[nxt]. Gather the columns of T in 
+		 * the order of the current block (pivots first) : X <-- T[:, pivots], T <-- T[:, non-pivots].
+		 */
+		int ldT = Sm;
+		for (int j = 0; j < Sm; j++)
+			pos[q[nxt][j]] = j;
+		for (int k = 0; k < Sm; k++)
+			perm[k] = pos[q[cur][Sqinv[k]]];
+		spasm_dense_gather_columns(Tn, rr, S[nxt], ldT, perm, X, rr, datatype);
+		spasm_dense_gather_columns(Tn, Sm - rr, S[nxt], ldT, perm + rr, S[nxt], ldT, datatype);
+		
+		/* T <-- T - X * R, where R = rref(current block)[:, non-pivots] (parallel over slices of rows) */
+		if (rr > 0 && rr < Sm) {
+			const void *R = (const char *) S[cur] + rr * dsize;
+			int slice = (Tn + nthreads - 1) / nthreads;
+			#pragma omp parallel for schedule(static, 1)
+			for (int i = 0; i < Tn; i += slice) {
+				int h = spasm_min(slice, Tn - i);
+				spasm_ffpack_gemm_sub(prime, h, Sm - rr, rr, (const char *) X + (i64) i * rr * dsize, rr, R, ld, 
+					(char *) S[nxt] + (i64) i * ldT * dsize, ldT, datatype);
+			}
+		}
+		for (int k = rr; k < Sm; k++)
+			q[nxt][k - rr] = q[cur][Sqinv[k]];
+
+		/* the lookahead block becomes the current one */
+		int old_Sn = Sn;
+		cur = nxt;
+		Sn = Tn;
+		Sm -= rr;
+		ld = ldT;
+		processed += Tn;
+
+		/* early abort (see echelonize_dense) */
+		if (Sm == 0) {
+			fprintf(stderr, "[echelonize/dense] full rank reached\n");
+			break;
+		}
+		dependent += old_Sn - rr;
+		if (dependent >= next_test) {
+			fprintf(stderr, "[echelonize/dense] testing for early abort...\n");
+			if (spasm_echelonize_test_completion(A, p + done, n - done, U, fact->qinv)) {
+				fprintf(stderr, "[echelonize/dense] early abort: the remaining %d rows are in the row space of U\n", n - done);
+				break;
+			}
+			next_test = 2 * dependent;
+		}
+		if (opts->enable_tall_and_skinny && (rr < opts->low_rank_ratio * old_Sn)) {
+			lowrank_mode = 1;
+			break;
+		}
+	}
+	for (int k = 0; k < 2; k++) {
+		free(S[k]);
+		free(q[k]);
+	}
+	free(X);
+	free(Sqinv);
+	free(p_out);
+	free(pos);
+	free(perm);
+	int rank_ub = spasm_min(A->n - U->n, A->m - U->n);
+	if (rank_ub > 0 && n - done > 0 && lowrank_mode) {
+		fprintf(stderr, "[echelonize/dense] Too few pivots; switching to low-rank mode\n");
+		echelonize_dense_lowrank(A, p + done, n - done, fact, opts);
+	} else {
+		fact->dense_skipped += n - done;
+		fprintf(stderr, "[echelonize/dense] completed in %.1fs. %d new pivots found\n", spasm_wtime() - start, U->n - old_un);
+	}
+}
+
+/*
+ * Merge two reduced echelon forms E1 (r1 rows) and E2 (r2 rows), both with Sm columns and
+ * leading dimension Sm, in the format of spasm_ffpack_rref: the pivots of Ek are on the
+ * columns Sqk[0:rk], and Ek[:, rk:Sm] holds the non-pivotal columns Sqk[rk:Sm].
+ * The rows of E2 are reduced w.r.t. E1, the result is echelonized and the rows of E1 are
+ * reduced w.r.t. the new pivots. The merged form (the rref of [E1; E2]) is written over E1 and
+ * Sq1; the new rows are moved right after those of E1 (this overwrites E2, which must come after
+ * E1 in memory). Returns the rank of the merged form. iota is the identity (size Sm).
+ */
+static int dense_tree_merge(i64 prime, int Sm, void *E1, int r1, size_t *Sq1, void *E2, int r2, const size_t *Sq2, 
+	spasm_datatype datatype, const int *iota)
+{
+	if (r2 == 0 || r1 == Sm)
+		return r1;
+	size_t dsize = spasm_datatype_size(datatype);
+	i64 ld = (i64) Sm * dsize;
+	char *T = E2;
+	char *R = E1;
+	int *pos = spasm_malloc(Sm * sizeof(*pos));
+	int *perm = spasm_malloc(Sm * sizeof(*perm));
+	spasm_ZZp *e = spasm_malloc(r2 * sizeof(*e));
+
+	/* write the rows of E2 in full (pivots included), with the columns in the order of E1 */
+	for (int k = 0; k < Sm; k++)
+		pos[Sq2[k]] = k;
+	for (int k = 0; k < Sm; k++)
+		perm[k] = pos[Sq1[k]];
+	for (int k = 0; k < r2; k++)
+		e[k] = 0;
+	for (int i = 0; i < r2; i++) {
+		e[i] = 1;
+		spasm_dense_from_ZZp(r2, e, T + i * ld, datatype);
+		e[i] = 0;
+	}
+	spasm_dense_gather_columns(r2, Sm, T, Sm, perm, T, Sm, datatype);
+
+	/* T[:, r1:Sm] <-- T[:, r1:Sm] - T[:, 0:r1] * E1[:, r1:Sm] */
+	if (r1 > 0) {
+		void *X = spasm_malloc((i64) r2 * r1 * dsize);
+		spasm_dense_gather_columns(r2, r1, T, Sm, iota, X, r1, datatype);
+		spasm_ffpack_gemm_sub(prime, r2, Sm - r1, r1, X, r1, R + r1 * dsize, Sm, T + r1 * dsize, Sm, datatype);
+		free(X);
+	}
+
+	/* echelonize what is left */
+	size_t *Sq = spasm_malloc((Sm - r1) * sizeof(*Sq));
+	int rr = spasm_ffpack_rref(prime, r2, Sm - r1, T + r1 * dsize, Sm, datatype, Sq);
+	if (rr > 0) {
+		/* the new pivots come after those of E1 */
+		for (int k = 0; k < Sm - r1; k++) {
+			perm[k] = Sq[k];
+			pos[k] = Sq1[r1 + Sq[k]];
+		}
+		for (int k = 0; k < Sm - r1; k++)
+			Sq1[r1 + k] = pos[k];
+
+		/* E1[:, r1+rr:Sm] <-- E1[:, r1+rr:Sm] - E1[:, r1:r1+rr] * T[:, r1+rr:Sm] */
+		if (r1 > 0) {
+			spasm_dense_gather_columns(r1, Sm - r1, R + r1 * dsize, Sm, perm, R + r1 * dsize, Sm, datatype);
+			if (r1 + rr < Sm) {
+				void *X = spasm_malloc((i64) r1 * rr * dsize);
+				spasm_dense_gather_columns(r1, rr, R + r1 * dsize, Sm, iota, X, rr, datatype);
+				spasm_ffpack_gemm_sub(prime, r1, Sm - r1 - rr, rr, X, rr, T + (r1 + rr) * dsize, Sm, 
+					R + (r1 + rr) * dsize, Sm, datatype);
+				free(X);
+			}
+		}
+
+		/* move the new rows right after those of E1 */
+		for (int i = 0; i < rr; i++)
+			memmove(R + (r1 + i) * ld, T + i * ld, ld);
+	}
+	free(Sq);
+	free(pos);
+	free(perm);
+	free(e);
+	return r1 + rr;
+}
+
+/*
+ * Tree-parallel dense echelonization (U only). Several blocks of the schur complement are computed 
+ * at once; they are echelonized independently and in parallel; then their echelon forms are merged 
+ * pairwise, up a binary tree. This is useful when S is wide and the blocks are thin (FFPACK does not 
+ * parallelize well on them). The blocks are contiguous in memory, so the merged forms always fit 
+ * in the space of the blocks they come from.
+ */
+static void echelonize_dense_tree(const struct spasm_csr *A, const int *p, int n, struct spasm_lu *fact, struct echelonize_opts *opts,
+	int bs, spasm_datatype datatype)
+{
+	struct spasm_csr *U = fact->U;
+	int m = A->m;
+	int Sm = m - U->n;
+	i64 prime = spasm_get_prime(A);
+	size_t dsize = spasm_datatype_size(datatype);
+	int width = opts->dense_tree_width;
+
+	void *S = spasm_malloc((i64) width * bs * Sm * dsize);
+	int *q = spasm_malloc(Sm * sizeof(*q));
+	int *p_out = spasm_malloc((i64) width * bs * sizeof(*p_out));
+	int *iota = spasm_malloc(Sm * sizeof(*iota));
+	for (int j = 0; j < Sm; j++)
+		iota[j] = j;
+	int *r = spasm_malloc(width * sizeof(*r));
+	size_t **Sq = spasm_malloc(width * sizeof(*Sq));
+	for (int b = 0; b < width; b++)
+		Sq[b] = spasm_malloc(Sm * sizeof(**Sq));
+
+	int processed = 0;
+	double start = spasm_wtime();
+	int old_un = U->n;
+	int round = 0;
+	fprintf(stderr, "[echelonize/dense] processing dense schur complement of dimension %d x %d; %d blocks of size %d, type %s (tree)\n", 
+		n, Sm, width, bs, spasm_datatype_name(datatype));
+	bool lowrank_mode = 0;
+	int dependent = 0;
+	int next_test = spasm_max(10, n / 100);
+
+	for (;;) {
+		int Sn = spasm_min(width * bs, n - processed);
+		if (Sn <= 0)
+			break;
+		int nblocks = (Sn + bs - 1) / bs;
+		fprintf(stderr, "[echelonize/dense] Round %d. processing S[%d:%d] (%d x %d) in %d blocks\n", 
+			round, processed, processed + Sn, Sn, Sm, nblocks);
+		spasm_schur_dense(A, p, Sn, NULL, fact, S, datatype, q, p_out);
+
+		/* echelonize the blocks independently */
+		#pragma omp parallel for schedule(dynamic, 1) if (nblocks > 1)
+		for (int b = 0; b < nblocks; b++) {
+			int h = spasm_min(bs, Sn - b * bs);
+			r[b] = spasm_ffpack_rref(prime, h, Sm, (char *) S + (i64) b * bs * Sm * dsize, Sm, datatype, Sq[b]);
+		}
+
+		/* merge */
+		for (int step = 1; step < nblocks; step *= 2) {
+			int npairs = (nblocks - step + 2 * step - 1) / (2 * step);
+			#pragma omp parallel for schedule(dynamic, 1) if (npairs > 1)
+			for (int k = 0; k < npairs; k++) {
+				int b1 = 2 * step * k;
+				int b2 = b1 + step;
+				r[b1] = dense_tree_merge(prime, Sm, (char *) S + (i64) b1 * bs * Sm * dsize, r[b1], Sq[b1], 
+					(char *) S + (i64) b2 * bs * Sm * dsize, r[b2], Sq[b2], datatype, iota);
+			}
+		}
+		int rr = r[0];
+		update_U_after_rref(rr, Sm, S, Sm, datatype, Sq[0], q, fact);
+
+		/* move on to the next chunk (see echelonize_dense) */
+		round += 1;
+		processed += Sn;
+		p += Sn;
+		Sm = m - U->n;
+		fprintf(stderr, "[echelonize/dense] found %d new pivots\n", rr);
+		if (processed < n) {
+			if (Sm == 0) {
+				fprintf(stderr, "[echelonize/dense] full rank reached\n");
+				break;
+			}
+			dependent += Sn - rr;
+			if (dependent >= next_test) {
+				fprintf(stderr, "[echelonize/dense] testing for early abort...\n");
+				if (spasm_echelonize_test_completion(A, p, n - processed, U, fact->qinv)) {
+					fprintf(stderr, "[echelonize/dense] early abort: the remaining %d rows are in the row space of U\n", n - processed);
+					break;
+				}
+				next_test = 2 * dependent;
+			}
+		}
+		if (opts->enable_tall_and_skinny && (rr < opts->low_rank_ratio * Sn)) {
+			lowrank_mode = 1;
+			break;
+		}
+	}
+	free(S);
+	free(q);
+	free(p_out);
+	free(iota);
+	free(r);
+	for (int b = 0; b < width; b++)
+		free(Sq[b]);
+	free(Sq);
+	int rank_ub = spasm_min(A->n - U->n, A->m - U->n);
+	if (rank_ub > 0 && n - processed > 0 && lowrank_mode) {
+		fprintf(stderr, "[echelonize/dense] Too few pivots; switching to low-rank mode\n");
+		echelonize_dense_lowrank(A, p, n - processed, fact, opts);
+	} else {
+		fact->dense_skipped += n - processed;
+		fprintf(stderr, "[echelonize/dense] completed in %.1fs. %d new pivots found\n", spasm_wtime() - start, U->n - old_un);
+	}
+}
+
 /* 
  * the schur complement (on non-pivotal rows of A) w.r.t. U is dense.
  * process (P*A)[0:n]
@@ -389,48 +1068,77 @@ static void echelonize_dense(const struct spasm_csr *A, const int *p, int n, con
 	int m = A->m;
 	int Sm = m - U->n;
 	i64 prime = spasm_get_prime(A);
-	spasm_datatype datatype = spasm_datatype_choose(prime);
+	spasm_datatype datatype;
 
-	void *S = spasm_malloc((i64) opts->dense_block_size * Sm * spasm_datatype_size(datatype));
-	int *p_out = spasm_malloc(opts->dense_block_size * sizeof(*p_out));
+	/* tree: the blocks + the FFPACK workspace */
+	bool tree = !opts->L && opts->dense_tree_width > 1 && Sm > 0;
+	if (tree) {
+		int bs = dense_block_rows(n, Sm, prime, fact, opts, 2 * opts->dense_tree_width, &datatype);
+		if (n > bs) {
+			echelonize_dense_tree(A, p, n, fact, opts, bs, datatype);
+			return;
+		}
+	}
+
+	/* pipelined: two blocks + the pivotal columns of one + FFPACK workspace (not when nested in a parallel driver) */
+	bool pipelined = !opts->L && omp_get_max_threads() > 1 && !omp_in_parallel() && Sm > 0;
+	int bs = dense_block_rows(n, Sm, prime, fact, opts, pipelined ? 4 : 2, &datatype);
+	if (pipelined && n > bs) {
+		echelonize_dense_pipelined(A, p, n, fact, opts, bs, datatype);
+		return;
+	}
+
+	void *S = spasm_malloc((i64) bs * Sm * spasm_datatype_size(datatype));
+	int *p_out = spasm_malloc(bs * sizeof(*p_out));
 	int *q = spasm_malloc(Sm * sizeof(*q));
 	size_t *Sqinv = spasm_malloc(Sm * sizeof(*Sqinv));                   /* for FFPACK */
-	size_t *Sp = spasm_malloc(opts->dense_block_size * sizeof(*Sp));     /* for FFPACK / LU only */
-	bool *pivotal = spasm_malloc(A->n * sizeof(*pivotal));
-	for (int i = 0; i < A->n; i++)
-		pivotal[i] = 0;
+	size_t *Sp = spasm_malloc(bs * sizeof(*Sp));     /* for FFPACK / LU only */
+	/* indexed by the rows of L, i.e. of the original matrix (A may be the output of the presolve) */
+	bool *pivotal = NULL;
+	if (opts->L) {
+		int Ln = fact->Ltmp->n;
+		pivotal = spasm_malloc(Ln * sizeof(*pivotal));
+		for (int i = 0; i < Ln; i++)
+			pivotal[i] = 0;
+	}
 
 	int processed = 0;
 	double start = spasm_wtime();
 	int old_un = U->n;
 	int round = 0;
 	fprintf(stderr, "[echelonize/dense] processing dense schur complement of dimension %d x %d; block size=%d, type %s\n", 
-		n, Sm, opts->dense_block_size, spasm_datatype_name(datatype));
+		n, Sm, bs, spasm_datatype_name(datatype));
 	bool lowrank_mode = 0;
 	int rank_ub = spasm_min(A->n - U->n, A->m - U->n);
 
+	/* early abort: test completion once enough dependent rows have been seen (with exponential backoff) */
+	int dependent = 0;
+	int next_test = spasm_max(10, n / 100);
+
 	for (;;) {
 		/* compute a chunk of the schur complement, then echelonize with FFPACK */
-		int Sn = spasm_min(opts->dense_block_size, n - processed);
+		int Sn = spasm_min(bs, n - processed);
 		if (Sn <= 0)
 			break;
 		
 		fprintf(stderr, "[echelonize/dense] Round %d. processing S[%d:%d] (%d x %d)\n", round, processed, processed + Sn, Sn, Sm);	
 
-		i64 lnz_before = (opts->L) ? fact->Ltmp->nz : -1;
+		i64 ls_before = -1;               /* L segments of the chunk start here */
+		if (opts->L) {
+			spasm_rowseg_close(fact->Ltmp);
+			ls_before = fact->Ltmp->ns;
+		}
 		spasm_schur_dense(A, p, Sn, p_in, fact, S, datatype, q, p_out);
 
 		int rr;
 		if (opts->L) {
 			rr = spasm_ffpack_LU(prime, Sn, Sm, S, Sm, datatype, Sp, Sqinv);
-			update_fact_after_LU(Sn, Sm, rr, S, datatype, Sp, Sqinv, q, p_out, lnz_before, opts->complete, pivotal, fact);
+			update_fact_after_LU(Sn, Sm, rr, S, datatype, Sp, Sqinv, q, p_out, ls_before, opts->complete, pivotal, fact);
 		} else {
 			rr = spasm_ffpack_rref(prime, Sn, Sm, S, Sm, datatype, Sqinv);
-			update_U_after_rref(rr, Sm, S, datatype, Sqinv, q, fact);
+			update_U_after_rref(rr, Sm, S, Sm, datatype, Sqinv, q, fact);
 		}
 
-		// TODO: test completion and allow early abort
-
 		/* move on to the next chunk */
 		round += 1;
 		processed += Sn;
@@ -439,6 +1147,23 @@ static void echelonize_dense(const struct spasm_csr *A, const int *p, int n, con
 		rank_ub = spasm_min(A->n - U->n, A->m - U->n);
 		fprintf(stderr, "[echelonize/dense] found %d new pivots\n", rr);
 
+		/* test completion and allow early abort (if L not needed) */
+		if (!opts->L && processed < n) {
+			if (Sm == 0) {
+				fprintf(stderr, "[echelonize/dense] full rank reached\n");
+				break;
+			}
+			dependent += Sn - rr;
+			if (dependent >= next_test) {
+				fprintf(stderr, "[echelonize/dense] testing for early abort...\n");
+				if (spasm_echelonize_test_completion(A, p, n - processed, U, fact->qinv)) {
+					fprintf(stderr, "[echelonize/dense] early abort: the remaining %d rows are in the row space of U\n", n - processed);
+					break;
+				}
+				next_test = 2 * dependent;
+			}
+		}
+
 		/* 
 		 * switch to low-rank mode if yield drops too much 
 		 * This will early abort if a full factorization is not needed
@@ -458,69 +1183,271 @@ static void echelonize_dense(const struct spasm_csr *A, const int *p, int n, con
 		fprintf(stderr, "[echelonize/dense] Too few pivots; switching to low-rank mode\n");
 		echelonize_dense_lowrank(A, p, n - processed, fact, opts);
 	} else {
+		fact->dense_skipped += n - processed;
 		fprintf(stderr, "[echelonize/dense] completed in %.1fs. %d new pivots found\n", spasm_wtime() - start, U->n - old_un);
 	}
 }
 
 
 /*
- * (main entry point)
- * Returns the row echelon form of A. 
- * Initializes Uqinv (must be preallocated of size m [==#columns of A]).
- * Modifies A (permutes entries in rows)
- * FIXME potential memleak (>= 1 rounds then status == 1...)
+ * Right-looking sparse elimination. If the active submatrix becomes too dense,
+ * the remaining rows are handed over to the dense code.
  */
-struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_opts *opts)
+static void echelonize_right_looking(const struct spasm_csr *A, const int *p, int n, const int *p_in, struct spasm_lu *fact, 
+	struct echelonize_opts *opts)
 {
-	struct echelonize_opts default_opts;
-	if (opts == NULL) {
-		fprintf(stderr, "[echelonize] using default settings\n");
-		opts = &default_opts;
-		spasm_echelonize_init_opts(opts);
+	if (n == 0)
+		return;
+	int *p_out = spasm_malloc(n * sizeof(*p_out));
+	double threshold = opts->enable_dense ? opts->sparsity_threshold : 2;
+	struct spasm_csr *D = spasm_right_looking(A, p, n, p_in, fact, threshold, p_out);
+	if (D->n > 0) {
+		int *q = spasm_malloc(D->n * sizeof(*q));
+		for (int i = 0; i < D->n; i++)
+			q[i] = i;
+		echelonize_dense(D, q, D->n, p_out, fact, opts);
+		free(q);
 	}
+	spasm_csr_free(D);
+	free(p_out);
+}
+
+
+/* allocate an empty factorization of A */
+static struct spasm_lu * echelonize_alloc(const struct spasm_csr *A, const struct echelonize_opts *opts)
+{
 	int n = A->n;
 	int m = A->m;
 	i64 prime = spasm_get_prime(A);
-	fprintf(stderr, "[echelonize] Start on %d x %d matrix with %" PRId64 " nnz\n", n, m, spasm_nnz(A));
-	
-	/* options sanity check */
-	if (opts->complete)
-		opts->L = 1;
-	if (opts->L)
-		opts->enable_tall_and_skinny = 0;   // for now
-
-	/* allocate result */
 	struct spasm_csr *U = spasm_csr_alloc(n, m, spasm_nnz(A), prime, true);
 	int *Uqinv = spasm_malloc(m * sizeof(*Uqinv));
 	U->n = 0;
 	for (int j = 0; j < m; j++)
 		Uqinv[j] = -1;
 	
-	struct spasm_triplet *L = NULL;
+	struct spasm_rowseg *L = NULL;
 	int *Lp = NULL;
 	if (opts->L) {
-		L = spasm_triplet_alloc(n, n, spasm_nnz(A), prime, true);
+		L = spasm_rowseg_alloc(n, n, spasm_nnz(A), prime);
 		Lp = spasm_malloc(n * sizeof(*Lp));
 		for (int j = 0; j < n; j++)
 			Lp[j] = -1;
-		assert(L->x != NULL);
 	}
 	
 	struct spasm_lu *fact = spasm_malloc(sizeof(*fact));
 	fact->L = NULL;
 	fact->p = Lp;
+	fact->Linv = NULL;
+	fact->dense_skipped = 0;
 	fact->U = U;
 	fact->qinv = Uqinv;
 	fact->Ltmp = L;
+	fact->D = NULL;
+	return fact;
+}
+
+/* trim U, build L */
+static void echelonize_finalize(struct spasm_lu *fact, int m, const struct echelonize_opts *opts)
+{
+	struct spasm_csr *U = fact->U;
+	spasm_csr_resize(U, U->n, m);
+	spasm_csr_realloc(U, -1);
+	if (opts->L) {
+		struct spasm_rowseg *L = fact->Ltmp;
+		L->m = U->n; 
+		fact->p = spasm_realloc(fact->p, U->n * sizeof(*fact->p));
+		fact->Ltmp = NULL;
+		fact->L = spasm_rowseg_assemble(L);
+		fact->complete = opts->complete;
+		spasm_lu_index_diagonal(fact);
+	}
+	fact->r = U->n;
+	if (opts->enable_dense_tail)
+		spasm_lu_pack_dense_tail(fact);
+}
+
+/* register the structural pivots found in a round (they are the last npiv rows of U) */
+static void record_round(struct spasm_symbolic *sym, int n, const int *p, int npiv, const struct spasm_csr *U)
+{
+	sym->round = spasm_realloc(sym->round, (sym->nrounds + 1) * sizeof(*sym->round));
+	struct spasm_symbolic_round *R = &sym->round[sym->nrounds];
+	sym->nrounds += 1;
+	R->n = n;
+	R->npiv = npiv;
+	R->p = NULL;
+	R->qp = NULL;
+	R->R = NULL;
+	if (p != NULL) {
+		R->p = spasm_malloc(n * sizeof(*R->p));
+		for (int i = 0; i < n; i++)
+			R->p[i] = p[i];
+	}
+	R->qp = spasm_malloc(npiv * sizeof(*R->qp));
+	for (int k = 0; k < npiv; k++)
+		R->qp[k] = U->j[U->p[U->n - npiv + k]];
+}
+
+/* forget everything recorded in sym (but not the statistics) */
+static void symbolic_clear(struct spasm_symbolic *sym)
+{
+	for (int r = 0; r < sym->nrounds; r++) {
+		free(sym->round[r].p);
+		free(sym->round[r].qp);
+		spasm_csr_free(sym->round[r].R);
+	}
+	free(sym->round);
+	free(sym->Ap);
+	free(sym->Aj);
+	spasm_csr_free(sym->G);
+	free(sym->Gpiv);
+	sym->round = NULL;
+	sym->nrounds = 0;
+	sym->Ap = NULL;
+	sym->Aj = NULL;
+	sym->G = NULL;
+	sym->Gpiv = NULL;
+	sym->G_completion = 0;
+	sym->finisher = SPASM_FINISH_NONE;
+}
+
+void spasm_symbolic_free(struct spasm_symbolic *sym)
+{
+	if (sym == NULL)
+		return;
+	symbolic_clear(sym);
+	free(sym);
+}
+
+/*
+ * Renumber the non-pivotal columns of S into a dense range [0:Sm): the columns that occur in S 
+ * come first, in order of first appearance (so that the columns of neighbouring rows are close), 
+ * then the others. On output, cmap[k] is the former index of column k. Returns Sm.
+ */
+static int compact_columns(struct spasm_csr *S, const int *qinv, int *cmap)
+{
+	int m = S->m;
+	int *local = spasm_malloc(m * sizeof(*local));
+	for (int j = 0; j < m; j++)
+		local[j] = -1;
+	int k = 0;
+	i64 snz = spasm_nnz(S);
+	int *Sj = S->j;
+	for (i64 px = 0; px < snz; px++) {
+		int j = Sj[px];
+		if (local[j] < 0) {
+			local[j] = k;
+			cmap[k] = j;
+			k += 1;
+		}
+		Sj[px] = local[j];
+	}
+	for (int j = 0; j < m; j++)
+		if (qinv[j] < 0 && local[j] < 0) {
+			local[j] = k;
+			cmap[k] = j;
+			k += 1;
+		}
+	free(local);
+	S->m = k;
+	return k;
+}
+
+/*
+ * Echelonize S (whose columns have been compacted, see compact_columns) in its own index space, 
+ * with the remaining rounds. Then append the rows found to U, back in the original columns.
+ * Each level of recursion consumes at least one round, so the depth is at most opts->max_round.
+ */
+static void echelonize_compacted(const struct spasm_csr *S, const int *cmap, struct spasm_lu *fact, 
+	const struct echelonize_opts *opts, int rounds_left)
+{
+	assert(0 <= rounds_left && rounds_left < opts->max_round);
+	struct echelonize_opts sub_opts = *opts;
+	sub_opts.max_round = rounds_left;
+	sub_opts.enable_presolve = 0;             /* it has already been done */
+	sub_opts.enable_dm_blocks = 0;            /* first round only */
+	sub_opts.enable_dense_tail = 0;           /* F->U is copied row by row below */
+	struct spasm_lu *F = spasm_echelonize(S, &sub_opts);
+	const struct spasm_csr *US = F->U;
+	struct spasm_csr *U = fact->U;
+	int r0 = U->n;
+	i64 unz = spasm_nnz(U);
+	spasm_csr_realloc(U, unz + spasm_nnz(US));
+	for (int t = 0; t < US->n; t++) {
+		for (i64 px = US->p[t]; px < US->p[t + 1]; px++) {
+			U->j[unz] = cmap[US->j[px]];
+			U->x[unz] = US->x[px];
+			unz += 1;
+		}
+		U->p[r0 + t + 1] = unz;
+		int j = cmap[US->j[US->p[t]]];
+		assert(fact->qinv[j] < 0);
+		fact->qinv[j] = r0 + t;
+	}
+	U->n = r0 + US->n;
+	fact->dense_skipped += F->dense_skipped;
+	spasm_lu_free(F);
+}
+
+/*
+ * Returns the row echelon form of A. 
+ * if sym != NULL, then everything that depends only on the pattern of A
+ * (pivots, reaches, choice of the finalization strategy) is recorded in it.
+ */
+static struct spasm_lu * echelonize(const struct spasm_csr *A, struct echelonize_opts *opts, struct spasm_symbolic *sym)
+{
+	struct echelonize_opts default_opts;
+	if (opts == NULL) {
+		fprintf(stderr, "[echelonize] using default settings\n");
+		opts = &default_opts;
+		spasm_echelonize_init_opts(opts);
+	}
+	int n = A->n;
+	int m = A->m;
+	fprintf(stderr, "[echelonize] Start on %d x %d matrix with %" PRId64 " nnz\n", n, m, spasm_nnz(A));
+	
+	/* options sanity check */
+	if (opts->complete)
+		opts->L = 1;
+	if (opts->L)
+		opts->enable_tall_and_skinny = 0;   // for now
+
+	/* allocate result */
+	struct spasm_lu *fact = echelonize_alloc(A, opts);
+	struct spasm_csr *U = fact->U;
+	int *Uqinv = fact->qinv;
+	struct spasm_rowseg *L = fact->Ltmp;
+
+	if (sym != NULL) {
+		sym->opts = *opts;
+		sym->n = n;
+		sym->m = m;
+		sym->Ap = spasm_malloc((n + 1) * sizeof(*sym->Ap));
+		sym->Aj = spasm_malloc(spasm_nnz(A) * sizeof(*sym->Aj));
+		for (int i = 0; i <= n; i++)
+			sym->Ap[i] = A->p[i];
+		for (i64 px = 0; px < spasm_nnz(A); px++)
+			sym->Aj[px] = A->j[px];
+	}
 
 	/* local stuff */
+	const struct spasm_csr *A_in = A;
 	int *p = spasm_malloc(n * sizeof(*p)); /* pivotal rows come first in P*A */
 	double start = spasm_wtime();
-	double density = (double) spasm_nnz(A) / n / m;
 	int npiv = 0;
-	int status = 0;  /* 0 == max_round reached; 1 == full rank reached; 2 == early abort */
+	int status = 0;  /* 0 == max_round reached; 1 == full rank reached; 2 == early abort; 3 == compacted */
 	int *p_in = NULL;
 
+	/* 
+	 * structured gaussian elimination. Not (yet) recorded for refactorization, 
+	 * because the eliminations it performs depend on the cancellations.
+	 */
+	if (opts->enable_presolve && sym == NULL) {
+		p_in = spasm_malloc(n * sizeof(*p_in));
+		A = spasm_presolve(A, NULL, fact, opts->presolve_merge_weight, p_in);
+		n = A->n;
+	}
+	double density = (double) spasm_nnz(A) / n / m;
+
 	int round;
 	for (round = 0; round < opts->max_round; round++) {
 		/* decide whether to move on to the next iteration */
@@ -531,7 +1458,12 @@ struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_
 		}
 		
 		fprintf(stderr, "[echelonize] round %d\n", round);
-		npiv = spasm_pivots_extract_structural(A, p_in, fact, p, opts);
+		if (round == 0 && opts->enable_dm_blocks && sym == NULL)
+			npiv = spasm_pivots_extract_dm(A, p_in, fact, p, opts);
+		else
+			npiv = spasm_pivots_extract_structural(A, p_in, fact, p, opts);
+		if (sym != NULL)
+			record_round(sym, n, p, npiv, U);
 
 		if (npiv < opts->min_pivot_proportion * spasm_min(n, m - U->n)) {
 			fprintf(stderr, "[echelonize] not enough pivots found; stopping\n");
@@ -542,7 +1474,9 @@ struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_
 		// 	fprintf(stderr, "Schur complement is dense, tall and skinny (#rows / #cols = %.1f)\n", aspect_ratio);
 		// 	break;
 		// }
-		density = spasm_schur_estimate_density(A, p + npiv, n - npiv, U, Uqinv, 100);
+		struct spasm_schur_estimate est;
+		spasm_schur_estimate(A, p + npiv, n - npiv, U, Uqinv, 100, 0.05, &est);
+		density = est.density;
 		if (density > opts->sparsity_threshold) {
 			fprintf(stderr, "[echelonize] Schur complement is dense (estimated %.2f%%)\n", 100 * density);
 			status = 2;
@@ -550,23 +1484,46 @@ struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_
 		}
 
 		/* compute the next schur complement */
-		i64 nnz = (density * (n - npiv)) * (m - U->n);
+		i64 nnz = est.nnz;
 		char tmp[8];
 		spasm_human_format(sizeof(int) * (n - npiv + nnz) + sizeof(spasm_ZZp) * nnz, tmp);
-		fprintf(stderr, "Schur complement is %d x %d, estimated density : %.2f (%s byte)\n", n - npiv, m - U->n, density, tmp);
+		fprintf(stderr, "Schur complement is %d x %d, estimated density : %.2f (%s byte, %d rows sampled)\n", n - npiv, m - U->n, density, tmp, est.samples);
 		int *p_out = spasm_malloc((n - npiv) * sizeof(*p_out));
-		struct spasm_csr *S = spasm_schur(A, p + npiv, n - npiv, fact, density, L, p_in, p_out);
-		if (round > 0)
+		struct spasm_csr *S;
+		if (sym == NULL && opts->enable_streaming_schur && A != A_in) {
+			/* A is consumed (discard const, it is not the input argument) */
+			S = spasm_schur_streaming((struct spasm_csr *) A, p + npiv, n - npiv, fact, est.nnz_hi, 16, L, p_in, p_out);
+		} else if (sym == NULL) {
+			S = spasm_schur(A, p + npiv, n - npiv, fact, est.nnz_hi, L, p_in, p_out);
+		} else {
+			struct spasm_csr *R = spasm_schur_symbolic(A, p + npiv, n - npiv, U, Uqinv);
+			S = spasm_schur_numeric(A, p + npiv, n - npiv, fact, R, true, L, p_in, p_out);
+			sym->round[sym->nrounds - 1].R = R;
+		}
+		if (A != A_in && A != S)
 			spasm_csr_free((struct spasm_csr *) A);       /* discard const, only if it is not the input argument */
 		A = S;
 		n = n - npiv;
 		free(p_in);
 		p_in = p_out;
+
+		/* continue in a compact index space */
+		if (opts->enable_column_compaction && !opts->L && sym == NULL) {
+			int *cmap = spasm_malloc(m * sizeof(*cmap));
+			int Sm = compact_columns(S, Uqinv, cmap);
+			fprintf(stderr, "[echelonize] %d non-pivotal columns renumbered\n", Sm);
+			int rounds_left = opts->max_round - round - 1;
+			echelonize_compacted(S, cmap, fact, opts, rounds_left);
+			free(cmap);
+			status = 3;
+			break;
+		}
 	}
 	/*
 	 * status == 0. Exit because opts->max_round reached. Just factor A.
 	 * status == 1. Exit because A == 0. Nothing more to do.
 	 * status == 2. Some pivots found (U/L updated), but schur complement not computed (too few pivots / too dense).
+	 * status == 3. The rest has been done on the schur complement, with compacted columns.
 	 */
 
 	if (status == 0) {
@@ -574,7 +1531,9 @@ struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_
 		for (int i = 0; i < n; i++)
 			p[i] = i;
 	}
-	if (status == 1)
+	if (sym != NULL && status != 2)
+		record_round(sym, n, (status == 0) ? p : NULL, 0, U);
+	if (status == 1 || status == 3)
 		goto cleanup;  /* nothing else to do */
 
 	/* finish */
@@ -584,34 +1543,177 @@ struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_
 		fprintf(stderr, "[echelonize] regular dense mode disabled\n");
 	if (!opts->enable_GPLU)
 		fprintf(stderr, "[echelonize] GPLU mode disabled\n");
+	if (opts->enable_right_looking && sym != NULL)
+		fprintf(stderr, "[echelonize] right-looking mode cannot be recorded; using GPLU instead\n");
 	
 	double aspect_ratio = (double) (n - npiv) / (m - U->n);
 	fprintf(stderr, "[echelonize] finishing; density = %.3f; aspect ratio = %.1f\n", density, aspect_ratio);
-	if (opts->enable_tall_and_skinny && aspect_ratio > opts->tall_and_skinny_ratio)
+	spasm_finisher finisher = SPASM_FINISH_NONE;
+	if (opts->enable_tall_and_skinny && aspect_ratio > opts->tall_and_skinny_ratio) {
+		finisher = SPASM_FINISH_LOWRANK;
 		echelonize_dense_lowrank(A, p + npiv, n - npiv, fact, opts);
-	else if (opts->enable_dense && density > opts->sparsity_threshold)
+	} else if (opts->enable_dense && density > opts->sparsity_threshold) {
+		finisher = SPASM_FINISH_DENSE;
 		echelonize_dense(A, p + npiv, n - npiv, p_in, fact, opts);
-	else if (opts->enable_GPLU)
-		echelonize_GPLU(A, p + npiv, n - npiv, p_in, fact, opts);
-	else
+	} else if (opts->enable_right_looking && sym == NULL) {
+		echelonize_right_looking(A, p + npiv, n - npiv, p_in, fact, opts);
+	} else if (opts->enable_GPLU) {
+		finisher = SPASM_FINISH_GPLU;
+		echelonize_GPLU(A, p + npiv, n - npiv, p_in, fact, opts, sym);
+	} else
 		fprintf(stderr, "[echelonize] Cannot finish (no valid method enabled). Incomplete echelonization returned\n");
+	if (sym != NULL)
+		sym->finisher = finisher;
 
 cleanup:
 	free(p);
 	free(p_in);
 	fprintf(stderr, "[echelonize] Done in %.1fs. Rank %d, %" PRId64 " nz in basis\n", spasm_wtime() - start, U->n, spasm_nnz(U));
-	spasm_csr_resize(U, U->n, m);
-	spasm_csr_realloc(U, -1);
-	if (round > 0)
+	if (A != A_in)
 		spasm_csr_free((struct spasm_csr *) A);
-	if (opts->L) {
-		L->m = U->n; 
-		fact->p = spasm_realloc(Lp, U->n * sizeof(*Lp));
-		fact->L = spasm_compress(L);
-		spasm_triplet_free(L);
-		fact->Ltmp = NULL;
-		fact->complete = opts->complete;
-	}
-	fact->r = U->n;
+	echelonize_finalize(fact, m, opts);
 	return fact;
-}
\ No newline at end of file
+}
+
+/*
+ * (main entry point)
+ * Returns the row echelon form of A. 
+ * Initializes Uqinv (must be preallocated of size m [==#columns of A]).
+ * Modifies A (permutes entries in rows)
+ * FIXME potential memleak (>= 1 rounds then status == 1...)
+ */
+struct spasm_lu * spasm_echelonize(const struct spasm_csr *A, struct echelonize_opts *opts)
+{
+	return echelonize(A, opts, NULL);
+}
+
+/*
+ * Same as spasm_echelonize, but also returns (in *sym) a record of the pivots and
+ * of the patterns that have been found. It can then be used to echelonize other
+ * matrices with the same pattern but different values (possibly modulo another prime) 
+ * using spasm_echelonize_refactor().
+ * This is about as expensive as spasm_echelonize, but requires more memory.
+ */
+struct spasm_lu * spasm_echelonize_analyze(const struct spasm_csr *A, struct echelonize_opts *opts, struct spasm_symbolic **sym)
+{
+	struct spasm_symbolic *S = spasm_malloc(sizeof(*S));
+	S->round = NULL;
+	S->nrounds = 0;
+	S->Ap = NULL;
+	S->Aj = NULL;
+	S->G = NULL;
+	S->Gpiv = NULL;
+	S->G_completion = 0;
+	S->finisher = SPASM_FINISH_NONE;
+	S->refactorizations = 0;
+	S->fallbacks = 0;
+	*sym = S;
+	return echelonize(A, opts, S);
+}
+
+static bool same_pattern(const struct spasm_csr *A, const struct spasm_symbolic *sym)
+{
+	if (A->n != sym->n || A->m != sym->m)
+		return 0;
+	const i64 *Ap = A->p;
+	const int *Aj = A->j;
+	for (int i = 0; i <= A->n; i++)
+		if (Ap[i] != sym->Ap[i])
+			return 0;
+	for (i64 px = 0; px < spasm_nnz(A); px++)
+		if (Aj[px] != sym->Aj[px])
+			return 0;
+	return 1;
+}
+
+/*
+ * Echelonize A, which must have the same pattern (including the order of entries
+ * in each row) as the matrix given to spasm_echelonize_analyze(), by replaying 
+ * the recorded pivots. The pivot search, the choice of the finalization strategy
+ * and the computation of reaches are skipped; the dense finalization (if any) is 
+ * done normally.
+ *
+ * If a numerical cancellation invalidates a pivot or creates an entry outside
+ * the recorded pattern, then a full echelonization is done instead, and sym is
+ * updated.
+ */
+struct spasm_lu * spasm_echelonize_refactor(const struct spasm_csr *A, struct spasm_symbolic *sym)
+{
+	struct echelonize_opts *opts = &sym->opts;
+	int m = A->m;
+	sym->refactorizations += 1;
+	if (!same_pattern(A, sym)) {
+		fprintf(stderr, "[echelonize/refactor] the pattern of the matrix has changed\n");
+		goto fallback;
+	}
+	fprintf(stderr, "[echelonize/refactor] Start on %d x %d matrix with %" PRId64 " nnz\n", A->n, m, spasm_nnz(A));
+	double start = spasm_wtime();
+	struct spasm_lu *fact = echelonize_alloc(A, opts);
+	struct spasm_rowseg *L = fact->Ltmp;
+	const struct spasm_csr *B = A;           /* current matrix */
+	int *p_in = NULL;
+	bool ok = 1;
+	struct spasm_symbolic_round *R = NULL;
+
+	for (int r = 0; r < sym->nrounds; r++) {
+		R = &sym->round[r];
+		if (R->p != NULL && !spasm_pivots_copy(B, p_in, fact, R->p, R->qp, R->npiv)) {
+			fprintf(stderr, "[echelonize/refactor] zero pivot in round %d\n", r);
+			ok = 0;
+			break;
+		}
+		if (R->R == NULL)
+			break;          /* last round */
+		int Sn = R->n - R->npiv;
+		int *p_out = spasm_malloc(Sn * sizeof(*p_out));
+		struct spasm_csr *S = spasm_schur_numeric(B, R->p + R->npiv, Sn, fact, R->R, false, L, p_in, p_out);
+		if (B != A)
+			spasm_csr_free((struct spasm_csr *) B);
+		B = A;
+		free(p_in);
+		p_in = p_out;
+		if (S == NULL) {
+			fprintf(stderr, "[echelonize/refactor] pattern mismatch in round %d\n", r);
+			ok = 0;
+			break;
+		}
+		B = S;
+	}
+
+	if (ok) {
+		const int *p = (R->p != NULL) ? R->p + R->npiv : NULL;
+		int n = R->n - R->npiv;
+		switch (sym->finisher) {
+		case SPASM_FINISH_NONE:
+			break;
+		case SPASM_FINISH_GPLU:
+			ok = replay_GPLU(B, p, n, p_in, fact, sym);
+			break;
+		case SPASM_FINISH_DENSE:
+			echelonize_dense(B, p, n, p_in, fact, opts);
+			break;
+		case SPASM_FINISH_LOWRANK:
+			echelonize_dense_lowrank(B, p, n, fact, opts);
+			break;
+		}
+	}
+	free(p_in);
+	if (B != A)
+		spasm_csr_free((struct spasm_csr *) B);
+	if (ok) {
+		fprintf(stderr, "[echelonize/refactor] Done in %.1fs. Rank %d, %" PRId64 " nz in basis\n", 
+			spasm_wtime() - start, fact->U->n, spasm_nnz(fact->U));
+		echelonize_finalize(fact, m, opts);
+		return fact;
+	}
+	spasm_rowseg_free(L);
+	fact->Ltmp = NULL;
+	spasm_lu_free(fact);
+
+fallback:
+	fprintf(stderr, "[echelonize/refactor] recorded pivots are not valid; full echelonization\n");
+	sym->fallbacks += 1;
+	struct echelonize_opts saved_opts = *opts;
+	symbolic_clear(sym);
+	return echelonize(A, &saved_opts, sym);
+}
@@ -95,55 +95,23 @@ int spasm_ffpack_LU(i64 prime, int n, int m, void *A, int ldA, spasm_datatype da
 	assert(false);
 }
 
-/* code to make the "runtime type selection" mechanisme work */
-
-spasm_ZZp spasm_datatype_read(const void *A, size_t i, spasm_datatype datatype)
+/*
+ * C <-- C - A*B, where A is n x k, B is k x m and C is n x m
+ */
+template<typename T>
+static void ffpack_gemm_sub(i64 prime, int n, int m, int k, const T *A, int ldA, const T *B, int ldB, T *C, int ldC)
 {
-	switch (datatype) {	
-	case SPASM_DOUBLE: return ((double *) A)[i];
-	case SPASM_FLOAT: return ((float *) A)[i];
-	case SPASM_I64: return ((i64 *) A)[i];
-	}	
-	assert(false);
+	Givaro::ModularBalanced<T> GFp(prime);
+	FFLAS::fgemm(GFp, FFLAS::FflasNoTrans, FFLAS::FflasNoTrans, n, m, k, GFp.mOne, A, ldA, B, ldB, GFp.one, C, ldC);
 }
 
-void spasm_datatype_write(void *A, size_t i, spasm_datatype datatype, spasm_ZZp value)
+void spasm_ffpack_gemm_sub(i64 prime, int n, int m, int k, const void *A, int ldA, const void *B, int ldB, 
+	void *C, int ldC, spasm_datatype datatype)
 {
-	switch (datatype) {	
-	case SPASM_DOUBLE: ((double *) A)[i] = value; return;
-	case SPASM_FLOAT: ((float *) A)[i] = value; return;
-	case SPASM_I64: ((i64 *) A)[i] = value; return;
-	}	
+	switch (datatype) {
+	case SPASM_DOUBLE: ffpack_gemm_sub<double>(prime, n, m, k, (const double *) A, ldA, (const double *) B, ldB, (double *) C, ldC); return;
+	case SPASM_FLOAT: ffpack_gemm_sub<float>(prime, n, m, k, (const float *) A, ldA, (const float *) B, ldB, (float *) C, ldC); return;
+	case SPASM_I64: ffpack_gemm_sub<i64>(prime, n, m, k, (const i64 *) A, ldA, (const i64 *) B, ldB, (i64 *) C, ldC); return;
+	}
 	assert(false);
 }
-
-size_t spasm_datatype_size(spasm_datatype datatype)
-{
-	switch (datatype) {	
-	case SPASM_DOUBLE: return sizeof(double);
-	case SPASM_FLOAT: return sizeof(float);
-	case SPASM_I64: return sizeof(i64);
-	}	
-	assert(false);	
-}
-
-spasm_datatype spasm_datatype_choose(i64 prime)
-{
-	// return SPASM_DOUBLE;
-	if (prime <= 8191)
-		return SPASM_FLOAT;
-	else if (prime <= 189812531)
-		return SPASM_DOUBLE;
-	else
-		return SPASM_I64;
-}
-
-const char * spasm_datatype_name(spasm_datatype datatype)
-{
-	switch (datatype) {	
-	case SPASM_DOUBLE: return "double";
-	case SPASM_FLOAT: return "float";
-	case SPASM_I64: return "i64";
-	}	
-	assert(false);	
-}
\ No newline at end of file
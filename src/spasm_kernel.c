@@ -3,10 +3,31 @@
 
 #include "spasm.h"
 
+/*
+ * Kernel rows are produced in parallel and handed to a writer callback, in any order. Row k
+ * is the kernel vector associated with the k-th non-pivotal column (in increasing order); it
+ * is given as nz (column, value) pairs, in buffers that the writer must not keep. The writer is
+ * called concurrently by several threads.
+ */
+
+/* kidx[j] = index of the kernel vector for the non-pivotal column j (-1 for pivotal columns) */
+static int * kernel_index(int m, const int *qinv)
+{
+	int *kidx = spasm_malloc(m * sizeof(*kidx));
+	int k = 0;
+	for (int j = 0; j < m; j++)
+		kidx[j] = (qinv[j] < 0) ? k++ : -1;
+	return kidx;
+}
+
 /* 
- * return a basis of the right kernel of the matrix described by the LU factorization
+ * Compute a basis of the right kernel of the matrix described by the LU factorization, and
+ * stream its rows to the writer. Returns the number of entries in the basis.
+ *
+ * If U has a dense tail, then the kernel vectors are first computed on the dense rows 
+ * (by dense back-substitution), and the right-hand side of the sparse solve is updated.
  */
-struct spasm_csr * spasm_kernel(const struct spasm_lu *fact)
+i64 spasm_kernel_stream(const struct spasm_lu *fact, spasm_kernel_writer writer, void *data)
 {
 	const struct spasm_csr *U = fact->U;
 	const int *qinv = fact->qinv; 
@@ -20,14 +41,9 @@ struct spasm_csr * spasm_kernel(const struct spasm_lu *fact)
 	double start_time = spasm_wtime();
 
 	struct spasm_csr *Ut = spasm_transpose(U, true);
-	
-	struct spasm_csr *K = spasm_csr_alloc(m-n, m, spasm_nnz(U), prime, true);
-	i64 *Kp = K->p;
-	int *Kj = K->j;
-	spasm_ZZp *Kx = K->x;
-	int Kn = 0;         /* #rows in R */
-	i64 nnz = 0;        /* entries in R */
-	int writing = 0;
+	int *kidx = kernel_index(m, qinv);
+	int done = 0;       /* #rows produced */
+	i64 nnz = 0;        /* entries produced */
 
 	int *Utqinv = spasm_malloc(n * sizeof(*Utqinv)); /* locate pivots in Ut */
 	for (int j = 0; j < m; j++) {
@@ -36,107 +52,157 @@ struct spasm_csr * spasm_kernel(const struct spasm_lu *fact)
 			Utqinv[i] = j;
 	}
 
+	/* dense tail: P = its restriction to its pivotal columns (upper-triangular, unit diagonal) */
+	const struct spasm_dense_tail *D = fact->D;
+	int Dn = (D != NULL) ? D->n : 0;
+	int i0 = (D != NULL) ? D->i0 : n;
+	spasm_ZZp *P = NULL;
+	if (D != NULL) {
+		P = spasm_malloc((i64) Dn * Dn * sizeof(*P));
+		for (int r = 0; r < Dn; r++)
+			for (int s = 0; s < Dn; s++)
+				P[(i64) r * Dn + s] = D->x[(i64) r * D->m + D->piv[s]];
+	}
+
+	int *order = spasm_schedule_heavy_first(Ut, NULL, m, Ut, Utqinv);
+
 	/*
 	 * The following code is simiar to spasm_schur and spasm_rref (needs factorization...)
 	 */
-	#pragma omp parallel
+	#pragma omp parallel reduction(+:nnz)
 	{
 		spasm_ZZp *x = spasm_malloc(m * sizeof(*x));
 		int *xj = spasm_malloc(3 * n * sizeof(int));
 		for (int j = 0; j < 3 * n; j++)
 			xj[j] = 0;
+		int *Kj = spasm_malloc((n + 1) * sizeof(*Kj));          /* the current row */
+		spasm_ZZp *Kx = spasm_malloc((n + 1) * sizeof(*Kx));
 		int tid = spasm_get_thread_num();
+		spasm_ZZp *xt = NULL;             /* solution on the dense rows */
+		spasm_ZZp *w = NULL;              /* right-hand side on the sparse rows */
+		int *wmark = NULL;
+		struct spasm_csr *B = NULL;
+		if (D != NULL) {
+			xt = spasm_malloc(Dn * sizeof(*xt));
+			w = spasm_malloc(n * sizeof(*w));
+			wmark = spasm_malloc(n * sizeof(*wmark));
+			for (int i = 0; i < n; i++)
+				wmark[i] = -1;
+			B = spasm_csr_alloc(1, n, n, prime, true);
+		}
 
-		#pragma omp for schedule(guided)
-	  	for (int j = 0; j < m; j++) {
+		#pragma omp for schedule(dynamic, 1)
+	  	for (int k = 0; k < m; k++) {
+	  		int j = order[k];
 	  		if (qinv[j] >= 0)
 	  			continue;         /* skip pivotal row */
-	  		int top = spasm_sparse_triangular_solve(Ut, Ut, j, xj, x, Utqinv);
-
-	  		/* count the NZ in the new row */
-	  		int row_nz = 1;
-	  		for (int px = top; px < n; px++) {
-				int j = xj[px];
-				if (x[j] != 0)
-					row_nz += 1;
-			}
+	  		int top;
+	  		if (D == NULL) {
+	  			top = spasm_sparse_triangular_solve(Ut, Ut, j, xj, x, Utqinv);
+	  		} else {
+	  			/* back-substitution on the dense rows */
+	  			int k = D->cinv[j];
+	  			for (int r = Dn - 1; r >= 0; r--) {
+	  				if (k < 0) {
+	  					xt[r] = 0;
+	  					continue;
+	  				}
+	  				const spasm_ZZp *Pr = P + (i64) r * Dn;
+	  				spasm_ZZp s = D->x[(i64) r * D->m + k];
+	  				for (int t = r + 1; t < Dn; t++)
+	  					s = spasm_ZZp_axpy(U->field, -Pr[t], xt[t], s);
+	  				xt[r] = s;
+	  			}
 
-	  		/* commit the row */
-			int local_i;
-			i64 local_nnz;
-			#pragma omp critical(kernel)
-			{
-				/* not enough room in R ? realloc twice the size */
-				if (nnz + row_nz > K->nzmax) {
-					/* wait until other threads stop writing into R */
-					#pragma omp flush(writing)
-					while (writing > 0) {
-						#pragma omp flush(writing)
-					}
-					fprintf(stderr, "increasing K; %" PRId64 " ---> %" PRId64 "\n", K->nzmax, 2 * K->nzmax + row_nz);
-					spasm_csr_realloc(K, 2 * K->nzmax + row_nz);
-					Kj = K->j;
-					Kx = K->x;
-				}
-				/* save row k */
-				local_i = Kn;
-				Kn += 1;
-				local_nnz = nnz;
-				nnz += row_nz;
-				/* this thread will write into K */
-				#pragma omp atomic update
-				writing += 1;
-			}
+	  			/* rhs on the sparse rows: Ut[j] - sum xt[r] * Ut[pivot of dense row r] */
+	  			int bnz = 0;
+	  			for (int r = -1; r < Dn; r++) {
+	  				int jj = (r < 0) ? j : D->cols[D->piv[r]];
+	  				spasm_ZZp beta = (r < 0) ? 1 : -xt[r];
+	  				if (beta == 0)
+	  					continue;
+	  				for (i64 px = Ut->p[jj]; px < Ut->p[jj + 1]; px++) {
+	  					int i = Ut->j[px];
+	  					if (i >= i0)
+	  						continue;
+	  					if (wmark[i] != j) {
+	  						wmark[i] = j;
+	  						w[i] = 0;
+	  						B->j[bnz] = i;
+	  						bnz += 1;
+	  					}
+	  					w[i] = spasm_ZZp_axpy(U->field, beta, Ut->x[px], w[i]);
+	  				}
+	  			}
+	  			for (int px = 0; px < bnz; px++)
+	  				B->x[px] = w[B->j[px]];
+	  			B->p[1] = bnz;
+	  			top = spasm_sparse_triangular_solve(Ut, B, 0, xj, x, Utqinv);
+	  		}
 
-			/* write the new row in K */
-			Kj[local_nnz] = j;
-			Kx[local_nnz] = -1;
-			local_nnz += 1;
+			/* build the new row */
+			int row_nz = 0;
+			Kj[row_nz] = j;
+			Kx[row_nz] = -1;
+			row_nz += 1;
 			for (int px = top; px < n; px++) {
 				int jj = xj[px];
 				if (x[jj] != 0) {
 					int ii = Utqinv[jj];
-					Kj[local_nnz] = ii;
-					Kx[local_nnz] = x[jj];
-					local_nnz += 1;
+					Kj[row_nz] = ii;
+					Kx[row_nz] = x[jj];
+					row_nz += 1;
 				}
 			}
-			Kp[local_i + 1] = local_nnz;
-
-			/* we're done writing */
-			#pragma omp atomic update
-			writing--;
+			for (int r = 0; r < Dn; r++)
+				if (xt[r] != 0) {
+					Kj[row_nz] = D->cols[D->piv[r]];
+					Kx[row_nz] = xt[r];
+					row_nz += 1;
+				}
+			writer(data, kidx[j], row_nz, Kj, Kx);
+			nnz += row_nz;
 
+			int local_done;
+			#pragma omp atomic capture
+			local_done = ++done;
 			if (tid == 0) {
-				char hnnz[8];
-				spasm_human_format(nnz, hnnz);
-	  			fprintf(stderr, "\rkernel: %d/%d, |K| = %s    ", Kn, m-n, hnnz);
+	  			fprintf(stderr, "\rkernel: %d/%d    ", local_done, m-n);
 	  			fflush(stderr);
 	  		}
 		}
 	  	free(x);
 		free(xj);
+		free(Kj);
+		free(Kx);
+		free(xt);
+		free(w);
+		free(wmark);
+		if (B != NULL)
+			spasm_csr_free(B);
 	}
 
 	fprintf(stderr, "\n");
 	free(Utqinv);
+	free(order);
+	free(kidx);
+	free(P);
 	spasm_csr_free(Ut);
-	spasm_human_format(spasm_nnz(K), hnnz);
+	spasm_human_format(nnz, hnnz);
 	fprintf(stderr, "[kernel] done in %.1fs. NNZ(K) = %s\n", spasm_wtime() - start_time, hnnz);
-	return K;
+	return nnz;
 }
 
 /* 
- * given an echelonized matrix (in RREF), return a basis of its right kernel.
+ * given an echelonized matrix (in RREF), stream a basis of its right kernel to the writer.
  * This is less computationnaly expensive than from a non-RREF matrix
  */
-struct spasm_csr * spasm_kernel_from_rref(const struct spasm_csr *R, const int *qinv)
+i64 spasm_kernel_from_rref_stream(const struct spasm_csr *R, const int *qinv, spasm_kernel_writer writer, void *data)
 {
 	assert(qinv != NULL);
 	int n = R->n;
 	int m = R->m;
 	assert(n <= m);
-	i64 prime = spasm_get_prime(R);
 	struct spasm_csr *Rt = spasm_transpose(R, true);
 	const i64 *Rtp = Rt->p;
 	const int *Rtj = Rt->j;
@@ -150,30 +216,105 @@ struct spasm_csr * spasm_kernel_from_rref(const struct spasm_csr *R, const int *
 		int j = Rj[px];
 		p[i] = j;
 	}
-	struct spasm_csr *K = spasm_csr_alloc(m - n, m, spasm_nnz(R) - n + m - n, prime, true);
-	K->n = 0;
-	i64 *Kp = K->p;
-	int *Kj = K->j;
-	spasm_ZZp *Kx = K->x;
+	int *kidx = kernel_index(m, qinv);
 	i64 nnz = 0;      /* #entries in K */
-	for (int j = 0; j < m; j++) {
-		if (qinv[j] >= 0)
-			continue;           /* skip pivotal columns of R */
-		Kj[nnz] = j;
-		Kx[nnz] = prime - 1;
-		nnz += 1;
-		for (i64 px = Rtp[j]; px < Rtp[j + 1]; px++) {
-			int i = Rtj[px];
-			Kj[nnz] = p[i];
-			Kx[nnz] = Rtx[px];
-			nnz += 1;
+
+	#pragma omp parallel reduction(+:nnz)
+	{
+		int *Kj = spasm_malloc((n + 1) * sizeof(*Kj));
+		spasm_ZZp *Kx = spasm_malloc((n + 1) * sizeof(*Kx));
+		#pragma omp for schedule(dynamic, 1024)
+		for (int j = 0; j < m; j++) {
+			if (qinv[j] >= 0)
+				continue;           /* skip pivotal columns of R */
+			int row_nz = 0;
+			Kj[row_nz] = j;
+			Kx[row_nz] = -1;
+			row_nz += 1;
+			for (i64 px = Rtp[j]; px < Rtp[j + 1]; px++) {
+				int i = Rtj[px];
+				Kj[row_nz] = p[i];
+				Kx[row_nz] = Rtx[px];
+				row_nz += 1;
+			}
+			writer(data, kidx[j], row_nz, Kj, Kx);
+			nnz += row_nz;
 		}
-		K->n += 1;
-		Kp[K->n] = nnz;
+		free(Kj);
+		free(Kx);
 	}
-	assert(K->n == m - n);
 	assert(nnz == spasm_nnz(R) - n + m - n);
+	free(kidx);
 	free(p);
 	spasm_csr_free(Rt);
+	return nnz;
+}
+
+/* a writer that keeps a copy of each row, for spasm_kernel / spasm_kernel_from_rref */
+struct kernel_rows {
+	int **j;
+	spasm_ZZp **x;
+	int *nz;
+};
+
+static void kernel_rows_writer(void *data, int k, int nz, const int *Kj, const spasm_ZZp *Kx)
+{
+	struct kernel_rows *rows = data;
+	rows->nz[k] = nz;
+	rows->j[k] = spasm_malloc(nz * sizeof(*Kj));
+	rows->x[k] = spasm_malloc(nz * sizeof(*Kx));
+	for (int px = 0; px < nz; px++) {
+		rows->j[k][px] = Kj[px];
+		rows->x[k][px] = Kx[px];
+	}
+}
+
+/* assemble the rows in a matrix (row k of the basis is row k of K) */
+static struct spasm_csr * kernel_rows_assemble(struct kernel_rows *rows, int Kn, int m, i64 nnz, i64 prime)
+{
+	struct spasm_csr *K = spasm_csr_alloc(Kn, m, nnz, prime, true);
+	i64 *Kp = K->p;
+	for (int k = 0; k < Kn; k++)
+		Kp[k + 1] = Kp[k] + rows->nz[k];
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (int k = 0; k < Kn; k++) {
+		for (int px = 0; px < rows->nz[k]; px++) {
+			K->j[Kp[k] + px] = rows->j[k][px];
+			K->x[Kp[k] + px] = rows->x[k][px];
+		}
+		free(rows->j[k]);
+		free(rows->x[k]);
+	}
+	free(rows->j);
+	free(rows->x);
+	free(rows->nz);
 	return K;
-}
\ No newline at end of file
+}
+
+static void kernel_rows_alloc(struct kernel_rows *rows, int Kn)
+{
+	rows->j = spasm_malloc(Kn * sizeof(*rows->j));
+	rows->x = spasm_malloc(Kn * sizeof(*rows->x));
+	rows->nz = spasm_malloc(Kn * sizeof(*rows->nz));
+}
+
+/* return a basis of the right kernel of the matrix described by the LU factorization */
+struct spasm_csr * spasm_kernel(const struct spasm_lu *fact)
+{
+	const struct spasm_csr *U = fact->U;
+	int Kn = U->m - U->n;
+	struct kernel_rows rows;
+	kernel_rows_alloc(&rows, Kn);
+	i64 nnz = spasm_kernel_stream(fact, kernel_rows_writer, &rows);
+	return kernel_rows_assemble(&rows, Kn, U->m, nnz, spasm_get_prime(U));
+}
+
+/* given an echelonized matrix (in RREF), return a basis of its right kernel */
+struct spasm_csr * spasm_kernel_from_rref(const struct spasm_csr *R, const int *qinv)
+{
+	int Kn = R->m - R->n;
+	struct kernel_rows rows;
+	kernel_rows_alloc(&rows, Kn);
+	i64 nnz = spasm_kernel_from_rref_stream(R, qinv, kernel_rows_writer, &rows);
+	return kernel_rows_assemble(&rows, Kn, R->m, nnz, spasm_get_prime(R));
+}
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+
+#include "spasm.h"
+
+/*
+ * Level-scheduled parallel triangular solve, for a single (dense) right-hand side.
+ *
+ * To solve x.T = b, where T is (permuted) triangular, the pivots are processed in an order such that
+ * when the pivot T[i, j] is reached, all the other rows k with T[k, j] != 0 have already been dealt
+ * with. Then x[i] = (b[j] - sum_k x[k] * T[k, j]) / T[i, j] (this is a "pull" over column j of T,
+ * i.e. over row j of the transpose of T).
+ * The pivots are partitioned into levels: those of level l only depend on pivots of smaller levels,
+ * so that all the pivots of a level can be computed in parallel. The levels are computed once per
+ * factorization; each solve is then a sequence of parallel sweeps.
+ */
+
+void spasm_levels_free(struct spasm_levels *S)
+{
+	if (S == NULL)
+		return;
+	spasm_csr_free(S->Tt);
+	free(S->row);
+	free(S->col);
+	free(S->inv);
+	free(S->lptr);
+	free(S->free_cols);
+	free(S);
+}
+
+/*
+ * Build the level schedule for x.T = b. The pivots are T[row[k], col[k]] for k in [0:r], in an
+ * order compatible with the sequential solver (T[row[k'], col[k]] == 0 for k' > k).
+ * This takes ownership of row and col.
+ */
+static struct spasm_levels * levels_build(const struct spasm_csr *T, int r, int *row, int *col)
+{
+	int n = T->n;
+	int m = T->m;
+	const i64 *Tp = T->p;
+	const int *Tj = T->j;
+	const spasm_ZZp *Tx = T->x;
+
+	/* level of each pivot */
+	int *colk = spasm_malloc(m * sizeof(*colk));
+	for (int j = 0; j < m; j++)
+		colk[j] = -1;
+	for (int k = 0; k < r; k++)
+		colk[col[k]] = k;
+	int *level = spasm_malloc(r * sizeof(*level));
+	for (int k = 0; k < r; k++)
+		level[k] = 0;
+	int nlevels = 0;
+	spasm_ZZp *pivot = spasm_malloc(r * sizeof(*pivot));
+	for (int k = 0; k < r; k++) {
+		int i = row[k];
+		nlevels = spasm_max(nlevels, level[k] + 1);
+		pivot[k] = 0;
+		for (i64 px = Tp[i]; px < Tp[i + 1]; px++) {
+			int kk = colk[Tj[px]];
+			if (kk == k)
+				pivot[k] = Tx[px];
+			else if (kk >= 0) {
+				assert(kk > k);
+				level[kk] = spasm_max(level[kk], level[k] + 1);
+			}
+		}
+		assert(pivot[k] != 0);
+	}
+
+	/* sort the pivots by level */
+	struct spasm_levels *S = spasm_malloc(sizeof(*S));
+	S->n = n;
+	S->m = m;
+	S->r = r;
+	S->nlevels = nlevels;
+	S->lptr = spasm_malloc((nlevels + 1) * sizeof(*S->lptr));
+	for (int l = 0; l <= nlevels; l++)
+		S->lptr[l] = 0;
+	for (int k = 0; k < r; k++)
+		S->lptr[level[k] + 1] += 1;
+	for (int l = 0; l < nlevels; l++)
+		S->lptr[l + 1] += S->lptr[l];
+	S->row = spasm_malloc(r * sizeof(*S->row));
+	S->col = spasm_malloc(r * sizeof(*S->col));
+	S->inv = spasm_malloc(r * sizeof(*S->inv));
+	int *w = spasm_malloc((nlevels + 1) * sizeof(*w));
+	for (int l = 0; l < nlevels; l++)
+		w[l] = S->lptr[l];
+	for (int k = 0; k < r; k++) {
+		int t = w[level[k]]++;
+		S->row[t] = row[k];
+		S->col[t] = col[k];
+		S->inv[t] = spasm_ZZp_inverse(T->field, pivot[k]);
+	}
+	S->nfree = m - r;
+	S->free_cols = spasm_malloc((m - r) * sizeof(*S->free_cols));
+	int f = 0;
+	for (int j = 0; j < m; j++)
+		if (colk[j] < 0)
+			S->free_cols[f++] = j;
+	S->Tt = spasm_transpose(T, true);
+	free(w);
+	free(level);
+	free(pivot);
+	free(colk);
+	free(row);
+	free(col);
+	return S;
+}
+
+/* level schedule for x.U = b (the pivots of U are processed in the order of the rows) */
+struct spasm_levels * spasm_levels_U(const struct spasm_lu *fact)
+{
+	const struct spasm_csr *U = fact->U;
+	struct spasm_csr *V = (fact->D != NULL) ? spasm_dense_tail_expand(U, fact->D) : NULL;
+	int r = U->n;
+	int *row = spasm_malloc(r * sizeof(*row));
+	int *col = spasm_malloc(r * sizeof(*col));
+	for (int j = 0; j < U->m; j++) {
+		int i = fact->qinv[j];
+		if (i >= 0) {
+			row[i] = i;
+			col[i] = j;
+		}
+	}
+	struct spasm_levels *S = levels_build((V != NULL) ? V : U, r, row, col);
+	if (V != NULL)
+		spasm_csr_free(V);
+	fprintf(stderr, "[levels] U: %d pivots in %d levels\n", r, S->nlevels);
+	return S;
+}
+
+/* level schedule for x.L = b (the columns of L are processed from right to left) */
+struct spasm_levels * spasm_levels_L(const struct spasm_lu *fact)
+{
+	const struct spasm_csr *L = fact->L;
+	assert(L != NULL);
+	int r = L->m;
+	int *row = spasm_malloc(r * sizeof(*row));
+	int *col = spasm_malloc(r * sizeof(*col));
+	for (int k = 0; k < r; k++) {
+		int j = r - 1 - k;
+		row[k] = (fact->p != NULL) ? fact->p[j] : j;
+		col[k] = j;
+	}
+	struct spasm_levels *S = levels_build(L, r, row, col);
+	fprintf(stderr, "[levels] L: %d pivots in %d levels\n", r, S->nlevels);
+	return S;
+}
+
+/*
+ * Solve x.T = b, where S is the level schedule of T. b has size m (#columns of T) and is not
+ * modified; x has size n (#rows of T). Returns true if x.T == b (otherwise x is garbage).
+ */
+bool spasm_levels_solve(const struct spasm_levels *S, const spasm_ZZp *b, spasm_ZZp *x)
+{
+	const struct spasm_csr *Tt = S->Tt;
+	const i64 *Tp = Tt->p;
+	const int *Tj = Tt->j;
+	const spasm_ZZp *Tx = Tt->x;
+	const struct spasm_field_struct *F = Tt->field;
+	int bad = 0;
+
+	#pragma omp parallel
+	{
+		#pragma omp for schedule(static)
+		for (int i = 0; i < S->n; i++)
+			x[i] = 0;
+
+		for (int l = 0; l < S->nlevels; l++) {
+			#pragma omp for schedule(static)
+			for (int k = S->lptr[l]; k < S->lptr[l + 1]; k++) {
+				int i = S->row[k];
+				int j = S->col[k];
+				spasm_ZZp s = b[j];
+				for (i64 px = Tp[j]; px < Tp[j + 1]; px++) {
+					int kk = Tj[px];
+					if (kk != i)
+						s = spasm_ZZp_axpy(F, -Tx[px], x[kk], s);
+				}
+				x[i] = spasm_ZZp_mul(F, s, S->inv[k]);
+			}
+		}
+
+		/* check the non-pivotal columns */
+		#pragma omp for schedule(static) reduction(|:bad)
+		for (int f = 0; f < S->nfree; f++) {
+			int j = S->free_cols[f];
+			spasm_ZZp s = b[j];
+			for (i64 px = Tp[j]; px < Tp[j + 1]; px++)
+				s = spasm_ZZp_axpy(F, -Tx[px], x[Tj[px]], s);
+			if (s != 0)
+				bad = 1;
+		}
+	}
+	return !bad;
+}
+
+/*
+ * Same as spasm_solve (x.A = b), using the level schedules of U and L (see spasm_levels_U /
+ * spasm_levels_L). b is not modified. z is a workspace of size SU->n (the rank), so that
+ * repeated solves do not allocate.
+ */
+bool spasm_solve_levels(const struct spasm_levels *SU, const struct spasm_levels *SL, const spasm_ZZp *b, spasm_ZZp *x, spasm_ZZp *z)
+{
+	bool ok = spasm_levels_solve(SU, b, z);
+	spasm_levels_solve(SL, z, x);
+	return ok;
+}
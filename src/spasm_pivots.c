@@ -362,27 +362,16 @@ static void spasm_pivots_reorder(const struct spasm_csr *A, const int *pinv,
 }
 
 /*
- * Identify stuctural pivots in A, and copy the relevant rows to U / update L if present
- * write p (pivotal rows of A first)
- * return the number of pivots found
+ * Copy the pivotal rows (P*A)[0:npiv] to U and make them unitary; update Uqinv and L if present.
+ * qp[k] is the column of the pivot on row p[k].
+ * Returns false (and leaves U in an unspecified state) if a pivot is zero.
  */
-int spasm_pivots_extract_structural(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, 
-								    int *p, struct echelonize_opts *opts)
+bool spasm_pivots_copy(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, 
+                       const int *p, const int *qp, int npiv)
 {
-	int n = A->n;
-	int m = A->m;
-	int *qinv = spasm_malloc(m * sizeof(*qinv));     /* for pivot search */
-	int *pinv = spasm_malloc(n * sizeof(*pinv));     /* for pivot search */
-
-	/* find structural pivots in A */
-	int npiv = spasm_pivots_find(A, pinv, qinv, opts);
-
-	/* reorder pivots to make U upper-triangular (up to a column permutation) */
-	spasm_pivots_reorder(A, pinv, qinv, npiv, p);
-
 	/* compute total pivot nnz and reallocate U if necessary */
 	struct spasm_csr *U = fact->U;
-	struct spasm_triplet *L = fact->Ltmp;
+	struct spasm_rowseg *L = fact->Ltmp;
 	int *Uqinv = fact->qinv;
 	int *Lp = fact->p;
 	i64 pivot_nnz = 0;
@@ -404,11 +393,9 @@ int spasm_pivots_extract_structural(const struct spasm_csr *A, const int *p_in,
 
 	for (int k = 0; k < npiv; k++) {
 		int i = p[k];
-		int j = pinv[i];
+		int j = qp[k];
 		assert(j >= 0);
-		assert(qinv[j] == i);
 		
-		Uqinv[j] = U->n;          /* register pivot in U */
 		/* locate pivot in row */ 
 		spasm_ZZp pivot = 0;
 		for (i64 px = Ap[i]; px < Ap[i + 1]; px++) {
@@ -417,10 +404,12 @@ int spasm_pivots_extract_structural(const struct spasm_csr *A, const int *p_in,
 				break;
 			}
 		}
-		assert(pivot != 0);
+		if (pivot == 0)
+			return 0;
+		Uqinv[j] = U->n;          /* register pivot in U */
 		if (L != NULL) {
 			int i_out = (p_in != NULL) ? p_in[i] : i;
-			spasm_add_entry(L, i_out, U->n, pivot);
+			spasm_add_entry(L->T, i_out, U->n, pivot);
 			// fprintf(stderr, "Adding L[%d, %d] = %d\n", i_out, U->n, pivot);
 			Lp[U->n] = i_out;
 		}
@@ -442,6 +431,41 @@ int spasm_pivots_extract_structural(const struct spasm_csr *A, const int *p_in,
 		Up[U->n] = unz;
 	}
 	assert(unz <= U->nzmax);
+	return 1;
+}
+
+/*
+ * Identify stuctural pivots in A, and copy the relevant rows to U / update L if present
+ * write p (pivotal rows of A first)
+ * return the number of pivots found
+ */
+int spasm_pivots_extract_structural(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, 
+								    int *p, struct echelonize_opts *opts)
+{
+	int n = A->n;
+	int m = A->m;
+	int *qinv = spasm_malloc(m * sizeof(*qinv));     /* for pivot search */
+	int *pinv = spasm_malloc(n * sizeof(*pinv));     /* for pivot search */
+
+	/* find structural pivots in A */
+	int npiv = spasm_pivots_find(A, pinv, qinv, opts);
+
+	/* reorder pivots to make U upper-triangular (up to a column permutation) */
+	spasm_pivots_reorder(A, pinv, qinv, npiv, p);
+
+	/* copy pivotal rows to U */
+	int *qp = spasm_malloc(npiv * sizeof(*qp));
+	for (int k = 0; k < npiv; k++) {
+		int i = p[k];
+		int j = pinv[i];
+		assert(j >= 0);
+		assert(qinv[j] == i);
+		qp[k] = j;
+	}
+	bool ok = spasm_pivots_copy(A, p_in, fact, p, qp, npiv);
+	assert(ok);
+	(void) ok;
+	free(qp);
 	free(pinv);
 	free(qinv);
 	return npiv;
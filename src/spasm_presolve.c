@@ -0,0 +1,416 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "spasm.h"
+
+/*
+ * Structured Gaussian elimination.
+ *
+ * Repeatedly:
+ *   - pivot on row singletons (this removes a column from the other rows at no cost);
+ *   - pivot on column singletons (this removes a row at no cost);
+ *   - pivot on the lightest row of weight-2 columns and eliminate the column from the
+ *     other row (this "merges" the two rows, creating a bit of fill-in).
+ *
+ * Each pivot is added to U (and L) exactly like a structural pivot. The eliminations
+ * performed on the other rows are recorded in L. What remains is the Schur complement
+ * of the input matrix with respect to these pivots.
+ */
+
+struct presolve {
+	const struct spasm_field_struct *F;
+	int n;
+	int m;
+	/* active rows (a row never contains a pivotal column) */
+	i64 *Rp;               /* row i is in Rj/Rx[Rp[i]:Rp[i] + Rw[i]] */
+	int *Rw;               /* weight of row i; -1 if the row is not active anymore */
+	int *Rj;
+	spasm_ZZp *Rx;
+	i64 rnz;
+	i64 rnzmax;
+	/* columns: list of rows (may contain stale entries) + exact count */
+	i64 *Chead;
+	i64 *Cnext;
+	int *Crow;
+	i64 cnz;
+	i64 cnzmax;
+	int *Ccount;
+	/* work lists */
+	int *rstack;
+	int rtop;
+	bool *rqueued;
+	int *cstack;
+	int ctop;
+	bool *cqueued;
+	/* scratch space */
+	spasm_ZZp *y;
+	int *mark;
+	int stamp;
+	int *fill;
+	/* output */
+	struct spasm_lu *fact;
+	const int *p_in;
+	/* statistics */
+	int row_singletons;
+	int col_singletons;
+	int merges;
+};
+
+static void push_row(struct presolve *P, int i)
+{
+	if (P->rqueued[i])
+		return;
+	P->rqueued[i] = 1;
+	P->rstack[P->rtop++] = i;
+}
+
+static void push_col(struct presolve *P, int j)
+{
+	int c = P->Ccount[j];
+	if (P->cqueued[j] || c == 0 || c > 2 || P->fact->qinv[j] >= 0)
+		return;
+	P->cqueued[j] = 1;
+	P->cstack[P->ctop++] = j;
+}
+
+static void add_to_column(struct presolve *P, int j, int i)
+{
+	if (P->cnz == P->cnzmax) {
+		P->cnzmax = 2 * P->cnzmax + P->m;
+		P->Cnext = spasm_realloc(P->Cnext, P->cnzmax * sizeof(*P->Cnext));
+		P->Crow = spasm_realloc(P->Crow, P->cnzmax * sizeof(*P->Crow));
+	}
+	i64 e = P->cnz++;
+	P->Crow[e] = i;
+	P->Cnext[e] = P->Chead[j];
+	P->Chead[j] = e;
+}
+
+/* returns the position of column j in row i, or -1 */
+static i64 find_in_row(const struct presolve *P, int i, int j)
+{
+	if (P->Rw[i] < 0)
+		return -1;
+	for (i64 px = P->Rp[i]; px < P->Rp[i] + P->Rw[i]; px++)
+		if (P->Rj[px] == j)
+			return px;
+	return -1;
+}
+
+/* make room for a new row of weight w at the end of the row storage */
+static i64 row_alloc(struct presolve *P, int w)
+{
+	if (P->rnz + w > P->rnzmax) {
+		P->rnzmax = 2 * P->rnzmax + w;
+		P->Rj = spasm_realloc(P->Rj, P->rnzmax * sizeof(*P->Rj));
+		P->Rx = spasm_realloc(P->Rx, P->rnzmax * sizeof(*P->Rx));
+	}
+	i64 start = P->rnz;
+	P->rnz += w;
+	return start;
+}
+
+/*
+ * Eliminate column j from row i using row k of U (whose pivot is on column j).
+ * px locates the coefficient on column j in row i.
+ */
+static void eliminate(struct presolve *P, int i, i64 px, int k)
+{
+	const struct spasm_csr *U = P->fact->U;
+	struct spasm_rowseg *L = P->fact->Ltmp;
+	int j = P->Rj[px];
+	spasm_ZZp c = P->Rx[px];
+	if (L != NULL) {
+		int i_out = (P->p_in != NULL) ? P->p_in[i] : i;
+		spasm_add_entry(L->T, i_out, k, c);
+	}
+
+	/* remove column j from row i (swap with last entry) */
+	i64 last = P->Rp[i] + P->Rw[i] - 1;
+	P->Rj[px] = P->Rj[last];
+	P->Rx[px] = P->Rx[last];
+	P->Rw[i] -= 1;
+	P->Ccount[j] -= 1;
+	if (spasm_row_weight(U, k) == 1) {
+		/* no fill-in */
+		if (P->Rw[i] <= 1)
+			push_row(P, i);
+		return;
+	}
+
+	/* row i <-- row i - c * U[k], computed in y */
+	P->stamp += 1;
+	int nfill = 0;
+	for (i64 qx = P->Rp[i]; qx < P->Rp[i] + P->Rw[i]; qx++) {
+		int jj = P->Rj[qx];
+		P->mark[jj] = P->stamp;
+		P->y[jj] = P->Rx[qx];
+	}
+	for (i64 qx = U->p[k] + 1; qx < U->p[k + 1]; qx++) {   /* skip pivot */
+		int jj = U->j[qx];
+		if (P->mark[jj] != P->stamp) {
+			P->mark[jj] = P->stamp;
+			P->y[jj] = 0;
+			P->fill[nfill++] = jj;
+		}
+		P->y[jj] = spasm_ZZp_sub(P->F, P->y[jj], spasm_ZZp_mul(P->F, c, U->x[qx]));
+	}
+
+	/* write the new row at the end of the storage */
+	int w = P->Rw[i];
+	i64 old = P->Rp[i];
+	i64 start = row_alloc(P, w + nfill);
+	i64 rnz = start;
+	for (i64 qx = old; qx < old + w; qx++) {
+		int jj = P->Rj[qx];
+		if (P->y[jj] != 0) {
+			P->Rj[rnz] = jj;
+			P->Rx[rnz] = P->y[jj];
+			rnz += 1;
+		} else {
+			P->Ccount[jj] -= 1;         /* cancellation */
+			push_col(P, jj);
+		}
+	}
+	for (int t = 0; t < nfill; t++) {
+		int jj = P->fill[t];
+		if (P->y[jj] == 0)
+			continue;
+		P->Rj[rnz] = jj;
+		P->Rx[rnz] = P->y[jj];
+		rnz += 1;
+		P->Ccount[jj] += 1;
+		add_to_column(P, jj, i);
+		push_col(P, jj);
+	}
+	P->Rp[i] = start;
+	P->Rw[i] = rnz - start;
+	if (P->Rw[i] <= 1)
+		push_row(P, i);
+}
+
+/* pivot on (i, j). Add row i to U (and L), then eliminate column j from the other rows */
+static void pivot_on(struct presolve *P, int i, int j)
+{
+	struct spasm_csr *U = P->fact->U;
+	struct spasm_rowseg *L = P->fact->Ltmp;
+	int *Uqinv = P->fact->qinv;
+	int *Lp = P->fact->p;
+	int w = P->Rw[i];
+	if (spasm_nnz(U) + w > U->nzmax)
+		spasm_csr_realloc(U, 2 * U->nzmax + P->m);
+
+	i64 px = find_in_row(P, i, j);
+	assert(px >= 0);
+	spasm_ZZp pivot = P->Rx[px];
+	assert(pivot != 0);
+	int k = U->n;
+	Uqinv[j] = k;
+	if (L != NULL) {
+		int i_out = (P->p_in != NULL) ? P->p_in[i] : i;
+		spasm_add_entry(L->T, i_out, k, pivot);
+		Lp[k] = i_out;
+	}
+
+	/* make pivot unitary and add it first */
+	spasm_ZZp alpha = spasm_ZZp_inverse(P->F, pivot);
+	i64 unz = spasm_nnz(U);
+	U->j[unz] = j;
+	U->x[unz] = 1;
+	unz += 1;
+	for (i64 qx = P->Rp[i]; qx < P->Rp[i] + w; qx++) {
+		int jj = P->Rj[qx];
+		P->Ccount[jj] -= 1;
+		if (jj == j)
+			continue;
+		U->j[unz] = jj;
+		U->x[unz] = spasm_ZZp_mul(P->F, alpha, P->Rx[qx]);
+		unz += 1;
+		push_col(P, jj);
+	}
+	U->n += 1;
+	U->p[U->n] = unz;
+	P->Rw[i] = -1;
+
+	/* eliminate column j from the other rows */
+	for (i64 e = P->Chead[j]; e >= 0 && P->Ccount[j] > 0; e = P->Cnext[e]) {
+		int ii = P->Crow[e];
+		i64 qx = find_in_row(P, ii, j);
+		if (qx >= 0)
+			eliminate(P, ii, qx, k);
+	}
+	assert(P->Ccount[j] == 0);
+}
+
+/* find the (at most two) distinct active rows containing column j */
+static int column_rows(const struct presolve *P, int j, int *rows)
+{
+	int r = 0;
+	for (i64 e = P->Chead[j]; e >= 0 && r < P->Ccount[j]; e = P->Cnext[e]) {
+		int i = P->Crow[e];
+		if (r == 1 && rows[0] == i)
+			continue;
+		if (find_in_row(P, i, j) >= 0)
+			rows[r++] = i;
+	}
+	assert(r == P->Ccount[j]);
+	return r;
+}
+
+/*
+ * Perform structured Gaussian elimination on A. The pivots are added to fact (U, qinv and
+ * possibly Ltmp / p), and the remaining non-empty rows are returned (as a matrix of the
+ * same width). Row i of the output corresponds to row p_out[i] of the original matrix.
+ *
+ * Weight-2 columns are eliminated only if the pivotal row has weight <= merge_weight.
+ * It is understood that row i of A corresponds to row p_in[i] of the original matrix.
+ */
+struct spasm_csr *spasm_presolve(const struct spasm_csr *A, const int *p_in, struct spasm_lu *fact, int merge_weight, int *p_out)
+{
+	int n = A->n;
+	int m = A->m;
+	const i64 *Ap = A->p;
+	const int *Aj = A->j;
+	const spasm_ZZp *Ax = A->x;
+	double start = spasm_wtime();
+	int old_un = fact->U->n;
+
+	struct presolve P;
+	P.F = A->field;
+	P.n = n;
+	P.m = m;
+	P.fact = fact;
+	P.p_in = p_in;
+	P.row_singletons = 0;
+	P.col_singletons = 0;
+	P.merges = 0;
+
+	/* copy rows of A, skipping explicit zeros */
+	P.rnzmax = spasm_nnz(A) + m;
+	P.rnz = 0;
+	P.Rp = spasm_malloc(n * sizeof(*P.Rp));
+	P.Rw = spasm_malloc(n * sizeof(*P.Rw));
+	P.Rj = spasm_malloc(P.rnzmax * sizeof(*P.Rj));
+	P.Rx = spasm_malloc(P.rnzmax * sizeof(*P.Rx));
+	for (int i = 0; i < n; i++) {
+		P.Rp[i] = P.rnz;
+		for (i64 px = Ap[i]; px < Ap[i + 1]; px++) {
+			if (Ax[px] == 0)
+				continue;
+			P.Rj[P.rnz] = Aj[px];
+			P.Rx[P.rnz] = Ax[px];
+			P.rnz += 1;
+		}
+		P.Rw[i] = P.rnz - P.Rp[i];
+	}
+
+	/* column lists */
+	P.cnzmax = P.rnz + m;
+	P.cnz = 0;
+	P.Chead = spasm_malloc(m * sizeof(*P.Chead));
+	P.Cnext = spasm_malloc(P.cnzmax * sizeof(*P.Cnext));
+	P.Crow = spasm_malloc(P.cnzmax * sizeof(*P.Crow));
+	P.Ccount = spasm_calloc(m, sizeof(*P.Ccount));
+	for (int j = 0; j < m; j++)
+		P.Chead[j] = -1;
+	for (int i = n - 1; i >= 0; i--)
+		for (i64 px = P.Rp[i]; px < P.Rp[i] + P.Rw[i]; px++) {
+			int j = P.Rj[px];
+			add_to_column(&P, j, i);
+			P.Ccount[j] += 1;
+		}
+
+	P.rstack = spasm_malloc(n * sizeof(*P.rstack));
+	P.rqueued = spasm_calloc(n, sizeof(*P.rqueued));
+	P.cstack = spasm_malloc(m * sizeof(*P.cstack));
+	P.cqueued = spasm_calloc(m, sizeof(*P.cqueued));
+	P.rtop = 0;
+	P.ctop = 0;
+	P.y = spasm_malloc(m * sizeof(*P.y));
+	P.mark = spasm_calloc(m, sizeof(*P.mark));
+	P.fill = spasm_malloc(m * sizeof(*P.fill));
+	P.stamp = 0;
+
+	for (int i = n - 1; i >= 0; i--)
+		if (P.Rw[i] <= 1)
+			push_row(&P, i);
+	for (int j = m - 1; j >= 0; j--)
+		push_col(&P, j);
+
+	/* main loop. Row singletons first, as they never create fill-in */
+	while (P.rtop > 0 || P.ctop > 0) {
+		if (P.rtop > 0) {
+			int i = P.rstack[--P.rtop];
+			P.rqueued[i] = 0;
+			if (P.Rw[i] != 1)
+				continue;            /* empty rows are ignored */
+			pivot_on(&P, i, P.Rj[P.Rp[i]]);
+			P.row_singletons += 1;
+			continue;
+		}
+		int j = P.cstack[--P.ctop];
+		P.cqueued[j] = 0;
+		if (fact->qinv[j] >= 0 || P.Ccount[j] == 0 || P.Ccount[j] > 2)
+			continue;
+		int rows[2];
+		int r = column_rows(&P, j, rows);
+		if (r == 1) {
+			pivot_on(&P, rows[0], j);
+			P.col_singletons += 1;
+			continue;
+		}
+		int i = (P.Rw[rows[0]] <= P.Rw[rows[1]]) ? rows[0] : rows[1];
+		if (P.Rw[i] > merge_weight)
+			continue;
+		pivot_on(&P, i, j);
+		P.merges += 1;
+	}
+
+	/* build the remaining matrix */
+	i64 snz = 0;
+	int Sn = 0;
+	for (int i = 0; i < n; i++)
+		if (P.Rw[i] > 0) {
+			snz += P.Rw[i];
+			Sn += 1;
+		}
+	struct spasm_csr *S = spasm_csr_alloc(Sn, m, snz, spasm_get_prime(A), true);
+	i64 *Sp = S->p;
+	int *Sj = S->j;
+	spasm_ZZp *Sx = S->x;
+	Sn = 0;
+	snz = 0;
+	for (int i = 0; i < n; i++) {
+		if (P.Rw[i] <= 0)
+			continue;
+		for (i64 px = P.Rp[i]; px < P.Rp[i] + P.Rw[i]; px++) {
+			Sj[snz] = P.Rj[px];
+			Sx[snz] = P.Rx[px];
+			snz += 1;
+		}
+		if (p_out != NULL)
+			p_out[Sn] = (p_in != NULL) ? p_in[i] : i;
+		Sn += 1;
+		Sp[Sn] = snz;
+	}
+
+	free(P.Rp);
+	free(P.Rw);
+	free(P.Rj);
+	free(P.Rx);
+	free(P.Chead);
+	free(P.Cnext);
+	free(P.Crow);
+	free(P.Ccount);
+	free(P.rstack);
+	free(P.rqueued);
+	free(P.cstack);
+	free(P.cqueued);
+	free(P.y);
+	free(P.mark);
+	free(P.fill);
+
+	fprintf(stderr, "[presolve] %d row singletons, %d column singletons, %d merges; %d pivots found. Remaining: %d x %d with %" PRId64 " nnz [%.1fs]\n",
+		P.row_singletons, P.col_singletons, P.merges, fact->U->n - old_un, Sn, m, snz, spasm_wtime() - start);
+	return S;
+}
@@ -1,4 +1,6 @@
+#include <stdlib.h>
 #include <arpa/inet.h>           // htonl
+#include <assert.h>
 
 #include "spasm.h"
 
@@ -71,4 +73,140 @@ void spasm_prng_seed_simple(i64 prime, u64 seed, u32 seq, spasm_prng_ctx *ctx)
         for (int i = 2; i < 8; i++)
                 block[i] = 0;
         spasm_prng_seed((u8 *) block, prime, seq, ctx);
-}
\ No newline at end of file
+}
+
+/* 
+ * Fast, non-cryptographic PRNG (xoshiro256**), for randomness that does not end up in a 
+ * certificate. Streams are identified by (seed, seq) and the state is derived with splitmix64, 
+ * so that each thread / each task may use its own independent stream.
+ */
+
+static u64 splitmix64(u64 *x)
+{
+        *x += 0x9e3779b97f4a7c15ull;
+        u64 z = *x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+}
+
+static inline u64 rotl(u64 x, int k)
+{
+        return (x << k) | (x >> (64 - k));
+}
+
+void spasm_rng_seed(i64 prime, u64 seed, u32 seq, spasm_rng_ctx *ctx)
+{
+        u64 x = seed ^ ((u64) seq << 32) ^ seq;
+        x = splitmix64(&x) ^ seed;
+        for (int i = 0; i < 4; i++)
+                ctx->s[i] = splitmix64(&x);
+        ctx->prime = prime;
+        i64 mask = 1;
+        while (mask < prime)
+                mask <<= 1;
+        ctx->mask = mask - 1;
+        spasm_field_init(prime, ctx->field);
+}
+
+u64 spasm_rng_u64(spasm_rng_ctx *ctx)
+{
+        u64 *s = ctx->s;
+        u64 res = rotl(s[1] * 5, 7) * 9;
+        u64 t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return res;
+}
+
+/*
+ * Return a uniformly random integer in [0:n] (Lemire's multiply-and-reject)
+ */
+u32 spasm_rng_below(spasm_rng_ctx *ctx, u32 n)
+{
+        assert(n > 0);
+        u64 m = (spasm_rng_u64(ctx) >> 32) * n;
+        u32 lo = m;
+        if (lo < n) {
+                u32 threshold = -n % n;
+                while (lo < threshold) {
+                        m = (spasm_rng_u64(ctx) >> 32) * n;
+                        lo = m;
+                }
+        }
+        return m >> 32;
+}
+
+/*
+ * Return a uniformly integer modulo prime (rejection sampling)
+ */
+spasm_ZZp spasm_rng_ZZp(spasm_rng_ctx *ctx)
+{
+        for (;;) {
+                u64 r = spasm_rng_u64(ctx);
+                u32 x = r & ctx->mask;
+                if (x < ctx->prime)
+                        return spasm_ZZp_init(ctx->field, x);
+                x = (r >> 32) & ctx->mask;
+                if (x < ctx->prime)
+                        return spasm_ZZp_init(ctx->field, x);
+        }
+}
+
+/*
+ * Return a uniformly random nonzero integer modulo prime
+ */
+spasm_ZZp spasm_rng_nonzero_ZZp(spasm_rng_ctx *ctx)
+{
+        for (;;) {
+                spasm_ZZp x = spasm_rng_ZZp(ctx);
+                if (x != 0)
+                        return x;
+        }
+}
+
+/*
+ * Sparse sketching matrix of dimension N x n: each row contains exactly min(w, n) nonzero entries, 
+ * on distinct random columns (Floyd's sampling), with random nonzero coefficients. The first entry
+ * of each row is 1. Row k only depends on (seed, k), so the result does not depend on the number 
+ * of threads.
+ */
+struct spasm_csr *spasm_sparse_sketch(int N, int n, int w, i64 prime, u64 seed)
+{
+        assert(n > 0);
+        w = spasm_min(w, n);
+        struct spasm_csr *R = spasm_csr_alloc(N, n, (i64) N * w, prime, true);
+        i64 *Rp = R->p;
+        int *Rj = R->j;
+        spasm_ZZp *Rx = R->x;
+        for (int k = 0; k <= N; k++)
+                Rp[k] = (i64) k * w;
+
+        #pragma omp parallel
+        {
+                i64 *mark = spasm_malloc(n * sizeof(*mark));
+                for (int i = 0; i < n; i++)
+                        mark[i] = -1;
+                #pragma omp for schedule(static)
+                for (int k = 0; k < N; k++) {
+                        spasm_rng_ctx ctx;
+                        spasm_rng_seed(prime, seed, k, &ctx);
+                        i64 px = Rp[k];
+                        /* Floyd: for i in [n-w:n], pick t in [0:i+1]; take t if new, i otherwise */
+                        for (int i = n - w; i < n; i++) {
+                                int t = spasm_rng_below(&ctx, i + 1);
+                                int j = (mark[t] == k) ? i : t;
+                                mark[j] = k;
+                                Rj[px] = j;
+                                Rx[px] = (px == Rp[k]) ? 1 : spasm_rng_nonzero_ZZp(&ctx);
+                                px += 1;
+                        }
+                }
+                free(mark);
+        }
+        return R;
+}
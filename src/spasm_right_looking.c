@@ -0,0 +1,484 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "spasm.h"
+
+/*
+ * Right-looking sparse elimination with dynamic Markowitz pivoting.
+ *
+ * The input rows are first reduced w.r.t. the existing pivots (this is just a sparse
+ * Schur complement). Then, the "active" rows are kept explicitly. At each step, a pivot
+ * of low Markowitz cost (w_i - 1) * (c_j - 1) is chosen among the lightest active rows,
+ * moved to U, and eliminated from all the other active rows that contain its column.
+ * These updates are independent and are done in parallel.
+ *
+ * When the density of the active submatrix exceeds a threshold, the elimination stops
+ * and the remaining active rows are returned to the caller (to be echelonized by dense
+ * methods).
+ */
+
+/* number of candidate rows examined during each pivot search */
+#define MARKOWITZ_SEARCH 4
+
+/* trailing updates with less work than this are done sequentially */
+#define PARALLEL_UPDATE_WORK 10000
+
+struct entry {
+	int j;
+	spasm_ZZp x;
+};
+
+struct right_looking {
+	const struct spasm_field_struct *F;
+	int n;
+	int m;
+	/* active rows, sorted by increasing column index */
+	struct entry **R;
+	int *Rw;               /* R[i] has Rw[i] entries (-1 once row i is pivotal or empty) */
+	int *orig;             /* index of row i in the original matrix */
+	i64 anz;               /* nnz in active rows */
+	int arows;             /* #active rows */
+	/* active rows, bucketed by weight (doubly-linked lists) */
+	int *head;
+	int *next;
+	int *prev;
+	int wmin;              /* no non-empty bucket below this */
+	/* column j: rows C[j][0:Cn[j]] (a superset of the rows with an entry on j), Ccount[j] entries */
+	int **C;
+	int *Cn;
+	int *Ccap;
+	int *Ccount;
+	/* scratch space */
+	int *mark;
+	int stamp;
+	int *T;                /* rows to update */
+	spasm_ZZp *Tc;         /* ... and their coefficient on the pivotal column */
+	int *Tw;               /* ... and their new weight */
+};
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct entry *x = a;
+	const struct entry *y = b;
+	return x->j - y->j;
+}
+
+static void bucket_insert(struct right_looking *RL, int i)
+{
+	int w = RL->Rw[i];
+	RL->prev[i] = -1;
+	RL->next[i] = RL->head[w];
+	if (RL->head[w] >= 0)
+		RL->prev[RL->head[w]] = i;
+	RL->head[w] = i;
+	if (w < RL->wmin)
+		RL->wmin = w;
+}
+
+static void bucket_remove(struct right_looking *RL, int i)
+{
+	int w = RL->Rw[i];
+	if (RL->prev[i] >= 0)
+		RL->next[RL->prev[i]] = RL->next[i];
+	else
+		RL->head[w] = RL->next[i];
+	if (RL->next[i] >= 0)
+		RL->prev[RL->next[i]] = RL->prev[i];
+}
+
+static void column_append(struct right_looking *RL, int j, int i)
+{
+	if (RL->Cn[j] == RL->Ccap[j]) {
+		RL->Ccap[j] = 2 * RL->Ccap[j] + 4;
+		RL->C[j] = spasm_realloc(RL->C[j], RL->Ccap[j] * sizeof(int));
+	}
+	RL->C[j][RL->Cn[j]] = i;
+	RL->Cn[j] += 1;
+}
+
+/* position of column j in (sorted) row i, or -1 */
+static int row_find(const struct right_looking *RL, int i, int j)
+{
+	const struct entry *r = RL->R[i];
+	int lo = 0;
+	int hi = RL->Rw[i];
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (r[mid].j < j)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < RL->Rw[i] && r[lo].j == j) ? lo : -1;
+}
+
+/* dynamic Markowitz: examine the MARKOWITZ_SEARCH lightest rows, return the cheapest entry */
+static void choose_pivot(struct right_looking *RL, int *ipiv, int *jpiv)
+{
+	i64 best = -1;
+	int examined = 0;
+	while (RL->head[RL->wmin] < 0)
+		RL->wmin += 1;
+	for (int w = RL->wmin; w <= RL->m && examined < MARKOWITZ_SEARCH; w++) {
+		for (int i = RL->head[w]; i >= 0 && examined < MARKOWITZ_SEARCH; i = RL->next[i]) {
+			const struct entry *r = RL->R[i];
+			for (int px = 0; px < w; px++) {
+				i64 cost = ((i64) w - 1) * (RL->Ccount[r[px].j] - 1);
+				if (best < 0 || cost < best) {
+					best = cost;
+					*ipiv = i;
+					*jpiv = r[px].j;
+				}
+			}
+			if (best == 0)
+				return;
+			examined += 1;
+		}
+	}
+}
+
+/* remove row i from the active submatrix */
+static void deactivate(struct right_looking *RL, int i)
+{
+	bucket_remove(RL, i);
+	const struct entry *r = RL->R[i];
+	for (int px = 0; px < RL->Rw[i]; px++)
+		RL->Ccount[r[px].j] -= 1;
+	RL->anz -= RL->Rw[i];
+	RL->arows -= 1;
+	RL->Rw[i] = -1;
+	free(RL->R[i]);
+	RL->R[i] = NULL;
+}
+
+/*
+ * row[i] <-- row[i] - c * u, where u is the (normalized) pivotal row, without its pivot.
+ * Fill-in is reported in fill[]. Returns the new weight of row i.
+ */
+static int update_row(struct right_looking *RL, int i, spasm_ZZp c, const struct entry *u, int uw, int jpiv, int *fill, int *nfill)
+{
+	const struct spasm_field_struct *F = RL->F;
+	const struct entry *a = RL->R[i];
+	int aw = RL->Rw[i];
+	struct entry *out = spasm_malloc((aw + uw) * sizeof(*out));
+	spasm_ZZp mc = spasm_ZZp_sub(F, 0, c);
+	int pa = 0;
+	int pu = 0;
+	int w = 0;
+	while (pa < aw || pu < uw) {
+		int ja = (pa < aw) ? a[pa].j : RL->m;
+		int ju = (pu < uw) ? u[pu].j : RL->m;
+		if (ja < ju) {
+			if (ja != jpiv)
+				out[w++] = a[pa];
+			pa += 1;
+		} else if (ju < ja) {
+			out[w].j = ju;
+			out[w].x = spasm_ZZp_mul(F, mc, u[pu].x);
+			w += 1;
+			fill[*nfill] = ju;
+			*nfill += 1;
+			#pragma omp atomic update
+			RL->Ccount[ju] += 1;
+			pu += 1;
+		} else {
+			spasm_ZZp x = spasm_ZZp_axpy(F, mc, u[pu].x, a[pa].x);
+			if (x != 0) {
+				out[w].j = ja;
+				out[w].x = x;
+				w += 1;
+			} else {
+				#pragma omp atomic update
+				RL->Ccount[ja] -= 1;
+			}
+			pa += 1;
+			pu += 1;
+		}
+	}
+	free(RL->R[i]);
+	RL->R[i] = out;
+	return w;
+}
+
+/* move the pivot (ipiv, jpiv) to U / L, then eliminate jpiv from the other active rows */
+static void pivot_on(struct right_looking *RL, int ipiv, int jpiv, struct spasm_lu *fact)
+{
+	const struct spasm_field_struct *F = RL->F;
+	struct spasm_csr *U = fact->U;
+	struct spasm_rowseg *L = fact->Ltmp;
+	int m = RL->m;
+	int k = U->n;
+	int uw = RL->Rw[ipiv];
+
+	/* U[k] <-- row[ipiv] / pivot, with the pivot first */
+	struct entry *r = RL->R[ipiv];
+	int ppiv = row_find(RL, ipiv, jpiv);
+	assert(ppiv >= 0);
+	spasm_ZZp v = r[ppiv].x;
+	spasm_ZZp beta = spasm_ZZp_inverse(F, v);
+	i64 unz = spasm_nnz(U);
+	if (unz + uw > U->nzmax)
+		spasm_csr_realloc(U, 2 * U->nzmax + m);
+	U->j[unz] = jpiv;
+	U->x[unz] = 1;
+	unz += 1;
+	struct entry *u = spasm_malloc(uw * sizeof(*u));     /* normalized, without the pivot */
+	int w = 0;
+	for (int px = 0; px < uw; px++) {
+		if (px == ppiv)
+			continue;
+		u[w].j = r[px].j;
+		u[w].x = spasm_ZZp_mul(F, beta, r[px].x);
+		U->j[unz] = u[w].j;
+		U->x[unz] = u[w].x;
+		unz += 1;
+		w += 1;
+	}
+	uw = w;
+	U->n += 1;
+	U->p[U->n] = unz;
+	fact->qinv[jpiv] = k;
+	if (L != NULL) {
+		fact->p[k] = RL->orig[ipiv];
+		spasm_add_entry(L->T, RL->orig[ipiv], k, v);
+	}
+	deactivate(RL, ipiv);
+
+	/* gather the rows to update */
+	RL->stamp += 1;
+	int nt = 0;
+	i64 work = 0;
+	for (int px = 0; px < RL->Cn[jpiv]; px++) {
+		int i = RL->C[jpiv][px];
+		if (RL->Rw[i] < 0 || RL->mark[i] == RL->stamp)
+			continue;       /* stale */
+		RL->mark[i] = RL->stamp;
+		int pj = row_find(RL, i, jpiv);
+		if (pj < 0)
+			continue;       /* stale */
+		RL->T[nt] = i;
+		RL->Tc[nt] = RL->R[i][pj].x;
+		nt += 1;
+		work += RL->Rw[i] + uw;
+	}
+	free(RL->C[jpiv]);
+	RL->C[jpiv] = NULL;
+	RL->Cn[jpiv] = 0;
+	RL->Ccap[jpiv] = 0;
+	RL->Ccount[jpiv] = 0;
+
+	/* eliminate in parallel (the updated rows are distinct); L gets one entry per row, in column k */
+	struct spasm_triplet *LT = (L != NULL) ? L->T : NULL;
+	i64 lnz = 0;
+	if (L != NULL) {
+		if (LT->nz + nt > LT->nzmax)
+			spasm_triplet_realloc(LT, 2 * LT->nzmax + nt + m);
+		lnz = LT->nz;
+		LT->nz += nt;
+	}
+	#pragma omp parallel if (work > PARALLEL_UPDATE_WORK)
+	{
+		int *fill = spasm_malloc(m * sizeof(*fill));
+		int *fill_row = NULL;
+		int *fill_col = NULL;
+		i64 local_nfill = 0;
+		i64 local_cap = 0;
+
+		#pragma omp for schedule(dynamic, 1)
+		for (int t = 0; t < nt; t++) {
+			int i = RL->T[t];
+			int nfill = 0;
+			RL->Tw[t] = update_row(RL, i, RL->Tc[t], u, uw, jpiv, fill, &nfill);
+			if (L != NULL) {
+				LT->i[lnz + t] = RL->orig[i];
+				LT->j[lnz + t] = k;
+				LT->x[lnz + t] = RL->Tc[t];
+			}
+			if (local_nfill + nfill > local_cap) {
+				local_cap = 2 * local_cap + nfill;
+				fill_row = spasm_realloc(fill_row, local_cap * sizeof(*fill_row));
+				fill_col = spasm_realloc(fill_col, local_cap * sizeof(*fill_col));
+			}
+			for (int px = 0; px < nfill; px++) {
+				fill_row[local_nfill] = i;
+				fill_col[local_nfill] = fill[px];
+				local_nfill += 1;
+			}
+		}
+
+		/* register fill-in in the column lists */
+		#pragma omp critical(right_looking_fill)
+		for (i64 px = 0; px < local_nfill; px++)
+			column_append(RL, fill_col[px], fill_row[px]);
+		free(fill);
+		free(fill_row);
+		free(fill_col);
+	}
+
+	/* update the weight buckets */
+	for (int t = 0; t < nt; t++) {
+		int i = RL->T[t];
+		bucket_remove(RL, i);
+		RL->anz += RL->Tw[t] - RL->Rw[i];
+		RL->Rw[i] = RL->Tw[t];
+		if (RL->Rw[i] == 0) {
+			/* the row is a linear combination of U */
+			RL->Rw[i] = -1;
+			RL->arows -= 1;
+			free(RL->R[i]);
+			RL->R[i] = NULL;
+		} else {
+			bucket_insert(RL, i);
+		}
+	}
+	free(u);
+}
+
+/*
+ * Echelonize (P*A)[0:n] by right-looking elimination, adding the pivots to fact.
+ * If the density of the active submatrix exceeds dense_threshold, stop and return the
+ * remaining active rows; p_out gives their index in the original matrix.
+ * Otherwise, an empty matrix is returned.
+ */
+struct spasm_csr *spasm_right_looking(const struct spasm_csr *A, const int *p, int n, const int *p_in,
+	struct spasm_lu *fact, double dense_threshold, int *p_out)
+{
+	int m = A->m;
+	struct spasm_csr *U = fact->U;
+	struct spasm_rowseg *L = fact->Ltmp;
+	double start = spasm_wtime();
+	fprintf(stderr, "[echelonize/right-looking] processing matrix of dimension %d x %d\n", n, m);
+
+	/* reduce w.r.t. the existing pivots */
+	int *orig = spasm_malloc(n * sizeof(*orig));
+	struct spasm_csr *S = spasm_schur(A, p, n, fact, -1, L, p_in, orig);
+
+	struct right_looking RL;
+	RL.F = A->field;
+	RL.n = n;
+	RL.m = m;
+	RL.R = spasm_malloc(n * sizeof(*RL.R));
+	RL.Rw = spasm_malloc(n * sizeof(*RL.Rw));
+	RL.orig = orig;
+	RL.anz = 0;
+	RL.arows = 0;
+	RL.head = spasm_malloc((m + 1) * sizeof(*RL.head));
+	RL.next = spasm_malloc(n * sizeof(*RL.next));
+	RL.prev = spasm_malloc(n * sizeof(*RL.prev));
+	RL.wmin = m;
+	RL.C = spasm_malloc(m * sizeof(*RL.C));
+	RL.Cn = spasm_malloc(m * sizeof(*RL.Cn));
+	RL.Ccap = spasm_malloc(m * sizeof(*RL.Ccap));
+	RL.Ccount = spasm_malloc(m * sizeof(*RL.Ccount));
+	RL.mark = spasm_malloc(n * sizeof(*RL.mark));
+	RL.stamp = 0;
+	RL.T = spasm_malloc(n * sizeof(*RL.T));
+	RL.Tc = spasm_malloc(n * sizeof(*RL.Tc));
+	RL.Tw = spasm_malloc(n * sizeof(*RL.Tw));
+	for (int w = 0; w <= m; w++)
+		RL.head[w] = -1;
+	for (int j = 0; j < m; j++) {
+		RL.C[j] = NULL;
+		RL.Cn[j] = 0;
+		RL.Ccap[j] = 0;
+		RL.Ccount[j] = 0;
+	}
+
+	/* load the active rows */
+	const i64 *Sp = S->p;
+	const int *Sj = S->j;
+	const spasm_ZZp *Sx = S->x;
+	for (int i = 0; i < n; i++) {
+		RL.mark[i] = 0;
+		int w = Sp[i + 1] - Sp[i];
+		if (w == 0) {
+			RL.R[i] = NULL;
+			RL.Rw[i] = -1;
+			continue;
+		}
+		struct entry *r = spasm_malloc(w * sizeof(*r));
+		for (int k = 0; k < w; k++) {
+			r[k].j = Sj[Sp[i] + k];
+			r[k].x = Sx[Sp[i] + k];
+			RL.Ccount[r[k].j] += 1;
+			column_append(&RL, r[k].j, i);
+		}
+		qsort(r, w, sizeof(*r), entry_cmp);
+		RL.R[i] = r;
+		RL.Rw[i] = w;
+		RL.anz += w;
+		RL.arows += 1;
+		bucket_insert(&RL, i);
+	}
+	spasm_csr_free(S);
+
+	/* main loop */
+	int old_un = U->n;
+	int verbose_step = spasm_max(1, n / 1000);
+	int steps = 0;
+	bool dense = 0;
+	while (RL.arows > 0) {
+		if (L == NULL && U->n == m) {
+			fprintf(stderr, "\n[echelonize/right-looking] full rank reached\n");
+			break;
+		}
+		double density = (double) RL.anz / RL.arows / (m - U->n);
+		if (density > dense_threshold) {
+			fprintf(stderr, "\n[echelonize/right-looking] active submatrix is dense (%.1f%%)\n", 100 * density);
+			dense = 1;
+			break;
+		}
+		int ipiv = -1;
+		int jpiv = -1;
+		choose_pivot(&RL, &ipiv, &jpiv);
+		pivot_on(&RL, ipiv, jpiv, fact);
+		if ((steps % verbose_step) == 0) {
+			fprintf(stderr, "\r[echelonize/right-looking] %d active rows [|U| = %" PRId64 " / active nnz = %" PRId64 "] -- density= %.3f --- rank >= %d",
+				RL.arows, spasm_nnz(U), RL.anz, density, U->n);
+			fflush(stderr);
+		}
+		steps += 1;
+	}
+	fprintf(stderr, "\n[echelonize/right-looking] %d new pivots found in %.1fs\n", U->n - old_un, spasm_wtime() - start);
+
+	/* return the remaining active rows */
+	int rn = dense ? RL.arows : 0;
+	struct spasm_csr *D = spasm_csr_alloc(rn, m, dense ? RL.anz : 0, spasm_get_prime(A), true);
+	i64 dnz = 0;
+	int dn = 0;
+	D->p[0] = 0;
+	for (int i = 0; i < n; i++) {
+		if (RL.Rw[i] < 0)
+			continue;
+		if (dense) {
+			for (int px = 0; px < RL.Rw[i]; px++) {
+				D->j[dnz] = RL.R[i][px].j;
+				D->x[dnz] = RL.R[i][px].x;
+				dnz += 1;
+			}
+			p_out[dn] = orig[i];
+			dn += 1;
+			D->p[dn] = dnz;
+		}
+		free(RL.R[i]);
+	}
+	assert(dn == rn);
+
+	for (int j = 0; j < m; j++)
+		free(RL.C[j]);
+	free(RL.R);
+	free(RL.Rw);
+	free(RL.orig);
+	free(RL.head);
+	free(RL.next);
+	free(RL.prev);
+	free(RL.C);
+	free(RL.Cn);
+	free(RL.Ccap);
+	free(RL.Ccount);
+	free(RL.mark);
+	free(RL.T);
+	free(RL.Tc);
+	free(RL.Tw);
+	return D;
+}
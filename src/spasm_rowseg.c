@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spasm.h"
+
+/*
+ * Row-segmented storage, used to accumulate L during the factorization.
+ *
+ * The entries are appended by runs of consecutive entries on the same row (the segments); a given
+ * row may be spread over several segments (one per phase that produced entries on it). This costs
+ * sizeof(int) + sizeof(spasm_ZZp) per entry, plus sizeof(int) + sizeof(i64) per segment, instead
+ * of 2*sizeof(int) + sizeof(spasm_ZZp) per entry in triplet form. Entries produced one at a time by
+ * column-oriented updates (which would yield one segment each) go to the side triplet matrix T.
+ */
+
+struct spasm_rowseg * spasm_rowseg_alloc(int n, int m, i64 nzmax, i64 prime)
+{
+	struct spasm_rowseg *L = spasm_malloc(sizeof(*L));
+	L->n = n;
+	L->m = m;
+	L->nz = 0;
+	L->nzmax = nzmax;
+	L->ns = 0;
+	L->nsmax = spasm_max(1, n);
+	L->si = spasm_malloc(L->nsmax * sizeof(*L->si));
+	L->sp = spasm_malloc((L->nsmax + 1) * sizeof(*L->sp));
+	L->sp[0] = 0;
+	L->j = spasm_malloc(nzmax * sizeof(*L->j));
+	L->x = spasm_malloc(nzmax * sizeof(*L->x));
+	L->open = 0;
+	spasm_field_init(prime, L->field);
+	L->T = spasm_triplet_alloc(n, m, spasm_max(1, n), prime, true);
+	return L;
+}
+
+void spasm_rowseg_free(struct spasm_rowseg *L)
+{
+	if (L == NULL)
+		return;
+	free(L->si);
+	free(L->sp);
+	free(L->j);
+	free(L->x);
+	spasm_triplet_free(L->T);
+	free(L);
+}
+
+/* change the max # of entries and of segments */
+void spasm_rowseg_realloc(struct spasm_rowseg *L, i64 nzmax, i64 nsmax)
+{
+	assert(nzmax >= L->nz);
+	assert(nsmax >= L->ns);
+	L->j = spasm_realloc(L->j, nzmax * sizeof(*L->j));
+	L->x = spasm_realloc(L->x, nzmax * sizeof(*L->x));
+	L->nzmax = nzmax;
+	L->si = spasm_realloc(L->si, nsmax * sizeof(*L->si));
+	L->sp = spasm_realloc(L->sp, (nsmax + 1) * sizeof(*L->sp));
+	L->nsmax = nsmax;
+}
+
+/*
+ * Start a new segment of k entries on row i (enlarge L if necessary). Returns the position of its
+ * first entry: the caller fills j/x[start:start+k]. Not thread-safe.
+ */
+i64 spasm_rowseg_reserve(struct spasm_rowseg *L, int i, i64 k)
+{
+	assert(0 <= i && i < L->n);
+	i64 nzmax = L->nzmax;
+	i64 nsmax = L->nsmax;
+	if (L->nz + k > nzmax)
+		nzmax = 2 * nzmax + k;
+	if (L->ns + 1 > nsmax)
+		nsmax = 2 * nsmax + 1;
+	if (nzmax != L->nzmax || nsmax != L->nsmax)
+		spasm_rowseg_realloc(L, nzmax, nsmax);
+	i64 start = L->nz;
+	L->si[L->ns] = i;
+	L->ns += 1;
+	L->nz += k;
+	L->sp[L->ns] = L->nz;
+	L->open = 0;
+	return start;
+}
+
+/* add an entry on row i; it extends the last segment if possible */
+void spasm_rowseg_add_entry(struct spasm_rowseg *L, int i, int j, spasm_ZZp x)
+{
+	if (!L->open || L->si[L->ns - 1] != i) {
+		spasm_rowseg_reserve(L, i, 0);
+		L->open = 1;
+	}
+	if (L->nz == L->nzmax)
+		spasm_rowseg_realloc(L, 2 * L->nzmax + 1, L->nsmax);
+	L->j[L->nz] = j;
+	L->x[L->nz] = x;
+	L->nz += 1;
+	L->sp[L->ns] = L->nz;
+}
+
+/* the next entry added by spasm_rowseg_add_entry starts a new segment */
+void spasm_rowseg_close(struct spasm_rowseg *L)
+{
+	L->open = 0;
+}
+
+/*
+ * Squeeze the segments s >= s0: only the first len[s - s0] entries of segment s are kept (if len
+ * is not NULL), and only the segments on rows i such that keep[i] (if keep is not NULL, it has
+ * size L->n). Empty segments are removed.
+ */
+void spasm_rowseg_squeeze(struct spasm_rowseg *L, i64 s0, const i64 *len, const bool *keep)
+{
+	i64 nz = L->sp[s0];
+	i64 ns = s0;
+	for (i64 s = s0; s < L->ns; s++) {
+		int i = L->si[s];
+		assert(0 <= i && i < L->n);
+		i64 start = L->sp[s];
+		i64 end = (len != NULL) ? start + len[s - s0] : L->sp[s + 1];
+		assert(end <= L->sp[s + 1]);
+		if (start == end || (keep != NULL && !keep[i]))
+			continue;
+		L->si[ns] = i;
+		L->sp[ns] = nz;
+		for (i64 px = start; px < end; px++) {
+			L->j[nz] = L->j[px];
+			L->x[nz] = L->x[px];
+			nz += 1;
+		}
+		ns += 1;
+	}
+	L->ns = ns;
+	L->nz = nz;
+	L->sp[ns] = nz;
+	L->open = 0;
+}
+
+/*
+ * Build L in CSR form (the segments of a row are concatenated in order, then the isolated entries).
+ * L is freed. The column indices, then the values, are moved and each array of L is released as
+ * soon as it has been copied: at most three arrays of nnz(L) words are allocated at once, instead of
+ * five when a triplet matrix is compressed.
+ */
+struct spasm_csr * spasm_rowseg_assemble(struct spasm_rowseg *L)
+{
+	int n = L->n;
+	i64 ns = L->ns;
+	const i64 *sp = L->sp;
+	const int *si = L->si;
+	const struct spasm_triplet *T = L->T;
+	i64 nnz = L->nz + T->nz;
+	struct spasm_csr *C = spasm_csr_alloc(n, L->m, nnz, L->field->p, false);
+	i64 *Cp = C->p;
+
+	/* row counts */
+	i64 *w = spasm_malloc(n * sizeof(*w));
+	for (int i = 0; i < n; i++)
+		w[i] = 0;
+	for (i64 s = 0; s < ns; s++)
+		w[si[s]] += sp[s + 1] - sp[s];
+	for (i64 px = 0; px < T->nz; px++)
+		w[T->i[px]] += 1;
+	for (int i = 0; i < n; i++) {
+		Cp[i + 1] = Cp[i] + w[i];
+		w[i] = Cp[i];
+	}
+
+	/* destination of each segment, then copy them concurrently */
+	i64 *dst = spasm_malloc(ns * sizeof(*dst));
+	for (i64 s = 0; s < ns; s++) {
+		dst[s] = w[si[s]];
+		w[si[s]] += sp[s + 1] - sp[s];
+	}
+	int *Cj = C->j;
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (i64 s = 0; s < ns; s++)
+		memcpy(Cj + dst[s], L->j + sp[s], (sp[s + 1] - sp[s]) * sizeof(*Cj));
+	free(L->j);
+	L->j = NULL;
+	spasm_ZZp *Cx = spasm_malloc(nnz * sizeof(*Cx));
+	C->x = Cx;
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (i64 s = 0; s < ns; s++)
+		memcpy(Cx + dst[s], L->x + sp[s], (sp[s + 1] - sp[s]) * sizeof(*Cx));
+	free(L->x);
+	L->x = NULL;
+
+	for (i64 px = 0; px < T->nz; px++) {
+		i64 cx = w[T->i[px]]++;
+		Cj[cx] = T->j[px];
+		Cx[cx] = T->x[px];
+	}
+	free(dst);
+	free(w);
+	spasm_rowseg_free(L);
+	return C;
+}
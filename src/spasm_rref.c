@@ -18,11 +18,14 @@
  * This code is similar to src/spasm_schur.c ---> in bad need of factorization
  * On output, Rqinv locates the pivots in R (on column j, pivot is on row Rqinv[i] of R,
  * or Rqinv[j] == -1 if there is no pivot on column j).
+ *
+ * If U has a dense tail, the dense rows are reduced with dense row operations.
  */
 struct spasm_csr * spasm_rref(const struct spasm_lu *fact, int *Rqinv)
 {
 	const struct spasm_csr *U = fact->U;
 	const int *Uqinv = fact->qinv;
+	const struct spasm_dense_tail *D = fact->D;
 
 	int n = U->n;
 	int m = U->m;
@@ -40,6 +43,7 @@ struct spasm_csr * spasm_rref(const struct spasm_lu *fact, int *Rqinv)
 	int writing = 0;
 	const i64 *Up = U->p;
 	const int *Uj = U->j;
+	int *order = spasm_schedule_heavy_first(U, NULL, n, U, Uqinv);
 
 	#pragma omp parallel
 	{
@@ -51,13 +55,27 @@ struct spasm_csr * spasm_rref(const struct spasm_lu *fact, int *Rqinv)
 		int *qinv_local = spasm_malloc(m * sizeof(int));
 		for (int j = 0; j < m; j++)
 			qinv_local[j] = Uqinv[j];
+		spasm_ZZp *y = (D != NULL) ? spasm_malloc(D->m * sizeof(*y)) : NULL;
 	
-		#pragma omp for schedule(guided)
-	  	for (int i = 0; i < n; i++) {
+		#pragma omp for schedule(dynamic, 1)
+	  	for (int k = 0; k < n; k++) {
+	  		int i = order[k];
 	  		int pivot = Uj[Up[i]];
 	  		assert(qinv_local[pivot] == i);
 	  		qinv_local[pivot] = -1;
-	  		int top = spasm_sparse_triangular_solve(U, U, i, xj, x, qinv_local);
+	  		int top;
+	  		if (D != NULL && i >= D->i0) {
+	  			/* dense row: start from the full row, eliminate with the (subsequent) dense rows */
+	  			const spasm_ZZp *Dr = D->x + (i64) (i - D->i0) * D->m;
+	  			for (int k = 0; k < D->m; k++)
+	  				y[k] = Dr[k];
+	  			spasm_dense_tail_eliminate(D, U->field, y, qinv_local, NULL);
+	  			top = spasm_dense_tail_scatter(D, m, xj, x, y);
+	  		} else {
+	  			top = spasm_sparse_triangular_solve(U, U, i, xj, x, qinv_local);
+	  			if (D != NULL)
+	  				top = spasm_dense_tail_solve(D, U->field, top, m, xj, x, y, qinv_local);
+	  		}
 	  		
 			/* ensure R has the "pivot first" property */
 			for (int px = top + 1; px < m; px++)
@@ -127,6 +145,7 @@ struct spasm_csr * spasm_rref(const struct spasm_lu *fact, int *Rqinv)
 	  	free(x);
 		free(xj);
 		free(qinv_local);
+		free(y);
 
 		#pragma omp for
 		for (int j = 0; j < m; j++)
@@ -139,6 +158,7 @@ struct spasm_csr * spasm_rref(const struct spasm_lu *fact, int *Rqinv)
 			Rqinv[j] = i;
 		}
 	}
+	free(order);
 	fprintf(stderr, "\n");
 
 	spasm_human_format(spasm_nnz(R), hnnz);
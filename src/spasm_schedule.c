@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "spasm.h"
+
+/*
+ * Weight-aware scheduling of row-by-row sparse triangular solves (schur complement, rref, kernel).
+ *
+ * The cost of solving a row is dominated by the size of its reach in U, which varies by orders of
+ * magnitude from one row to the next. When the rows are handed to the threads in their natural 
+ * order, a single heavy row near the end leaves one thread working alone. The rows are instead 
+ * processed in decreasing order of their (estimated) cost, one at a time from a shared queue 
+ * (schedule(dynamic, 1)): the heavy rows start first, and the light ones fill the gaps at the end.
+ */
+
+/* log2 of the cost of a row: its weight + the weight of the rows of U reached in one step */
+static int row_cost_class(const struct spasm_csr *A, int i, const struct spasm_csr *U, const int *qinv)
+{
+	const i64 *Ap = A->p;
+	const int *Aj = A->j;
+	const i64 *Up = U->p;
+	i64 cost = 0;
+	for (i64 px = Ap[i]; px < Ap[i + 1]; px++) {
+		int j = Aj[px];
+		int k = qinv[j];
+		cost += 1;
+		if (k >= 0)
+			cost += Up[k + 1] - Up[k];
+	}
+	int c = 0;
+	while (cost > 1) {
+		cost >>= 1;
+		c += 1;
+	}
+	return c;
+}
+
+/*
+ * Returns an ordering of the rows p[0:n] of A (order[k] is an index in [0:n]), by decreasing 
+ * estimated cost of spasm_sparse_triangular_solve(U, A, p[i], ..., qinv). If p == NULL, the rows 
+ * are 0, 1, ..., n-1. The costs are only compared up to a factor of two (bucket sort).
+ */
+int * spasm_schedule_heavy_first(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv)
+{
+	int *order = spasm_malloc(n * sizeof(*order));
+	u8 *cls = spasm_malloc(n * sizeof(*cls));
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < n; k++) {
+		int i = (p != NULL) ? p[k] : k;
+		cls[k] = row_cost_class(A, i, U, qinv);
+	}
+	int count[65];
+	for (int c = 0; c < 65; c++)
+		count[c] = 0;
+	for (int k = 0; k < n; k++)
+		count[63 - cls[k] + 1] += 1;
+	for (int c = 0; c < 64; c++)
+		count[c + 1] += count[c];
+	for (int k = 0; k < n; k++) {
+		int c = 63 - cls[k];
+		order[count[c]] = k;
+		count[c] += 1;
+	}
+	free(cls);
+	return order;
+}
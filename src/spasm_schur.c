@@ -1,21 +1,42 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <err.h>
+#include <math.h>
+#include <string.h>
 
 #include "spasm.h"
 
 /*
- * Samples R rows at random in the schur complement of (P*A)[0:n] w.r.t. U, and return the average density.
+ * Estimates the number of nonzero entries in the schur complement of (P*A)[0:n] w.r.t. U.
  * qinv locates the pivots in U.
+ *
+ * Rows are sampled at random (with replacement, using one PRNG stream per thread), starting
+ * with R samples and doubling the sample size until the 95%-confidence interval on the mean 
+ * row weight is within rel_error of the mean. The cost is bounded: at most 8R (and at most n)
+ * rows are sampled; when this is not enough (heavy-tailed row weights), the wider interval
+ * obtained so far is returned in nnz_lo / nnz_hi. When n <= R, all the rows are processed and
+ * the result is exact.
  */
-double spasm_schur_estimate_density(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv, int R)
+void spasm_schur_estimate(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv, 
+	int R, double rel_error, struct spasm_schur_estimate *est)
 {
-	if (n == 0)
-		return 0;
 	int m = A->m;
-	i64 nnz = 0;
-	if (n == 0)
-		return 0;
+	int Sm = m - U->n;
+	est->density = 0;
+	est->nnz = 0;
+	est->nnz_lo = 0;
+	est->nnz_hi = 0;
+	est->samples = 0;
+	if (n == 0 || Sm == 0)
+		return;
+	bool exact = (n <= R);
+	i64 prime = spasm_get_prime(A);
+	double sum = 0;      /* sum of the row weights */
+	double sum2 = 0;     /* sum of their squares */
+	int samples = 0;
+	int max_samples = (R < n / 8) ? 8 * R : n;
+	int batch = exact ? n : R;
+	bool done = 0;
 
 	#pragma omp parallel
 	{
@@ -24,23 +45,62 @@ double spasm_schur_estimate_density(const struct spasm_csr *A, const int *p, int
 		int *xj = spasm_malloc(3 * m * sizeof(*xj));
 		for (int j = 0; j < 3 * m; j++)
 			xj[j] = 0;
+		spasm_rng_ctx ctx;
+		spasm_rng_seed(prime, U->n, spasm_get_thread_num(), &ctx);
+
+		while (!done) {
+			/* static schedule: the samples do not depend on the timing of the threads */
+			#pragma omp for reduction(+:sum, sum2) schedule(static)
+			for (int k = 0; k < batch; k++) {
+				int inew = exact ? p[k] : p[spasm_rng_below(&ctx, n)];
+				int top = spasm_sparse_triangular_solve(U, A, inew, xj, x, qinv);
+				int w = 0;
+				for (int px = top; px < m; px++) {
+					int j = xj[px];
+					if ((qinv[j] < 0) && (x[j] != 0))
+						w += 1;
+				}
+				sum += w;
+				sum2 += (double) w * w;
+			}
 
-		#pragma omp for reduction(+:nnz) schedule(dynamic)
-		for (int i = 0; i < R; i++) {
-			/* pick a random non-pivotal row in A */
-			int inew = p[rand() % n];
-			int top = spasm_sparse_triangular_solve(U, A, inew, xj, x, qinv);
-			for (int px = top; px < m; px++) {
-				int j = xj[px];
-				if ((qinv[j] < 0) && (x[j] != 0))
-					nnz += 1;
+			#pragma omp single
+			{
+				samples += batch;
+				double mean = sum / samples;
+				double var = (samples > 1) ? (sum2 - samples * mean * mean) / (samples - 1) : 0;
+				double half_width = 1.96 * sqrt(fmax(0, var) / samples);
+				if (exact || half_width <= rel_error * mean || samples >= max_samples)
+					done = 1;
+				batch = spasm_min(samples, max_samples - samples);
+				if (batch <= 0)
+					done = 1;
 			}
 		}
-
 		free(x);
 		free(xj);
 	}
-	return ((double) nnz) / (m - U->n) / R;
+
+	double mean = sum / samples;
+	double var = (samples > 1) ? (sum2 - samples * mean * mean) / (samples - 1) : 0;
+	double half_width = exact ? 0 : 1.96 * sqrt(fmax(0, var) / samples);
+	double max_nnz = (double) n * Sm;
+	est->samples = samples;
+	est->density = mean / Sm;
+	est->nnz = mean * n;
+	est->nnz_lo = fmax(0, mean - half_width) * n;
+	est->nnz_hi = fmin(max_nnz, (mean + half_width) * n);
+}
+
+/*
+ * Samples (at least) R rows at random in the schur complement of (P*A)[0:n] w.r.t. U, and return the average density.
+ * qinv locates the pivots in U.
+ */
+double spasm_schur_estimate_density(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv, int R)
+{
+	struct spasm_schur_estimate est;
+	spasm_schur_estimate(A, p, n, U, qinv, R, 0.05, &est);
+	return est.density;
 }
 
 /*
@@ -56,19 +116,23 @@ double spasm_schur_estimate_density(const struct spasm_csr *A, const int *p, int
  * It is understood that row i of A corresponds to row p_in[i] of the original matrix.
  * if p_out is not NULL, then row i of the output corresponds to row p_out[i] of the original matrix.
  *
- * If the estimated density is unknown, set it to -1: it will be evaluated
+ * est_nnz is the predicted number of nonzero entries in S, used to allocate it. 
+ * If it is unknown, set it to -1: it will be evaluated
  */
 struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, 
-	double est_density, struct spasm_triplet *L, const int *p_in, int *p_out)
+	i64 est_nnz, struct spasm_rowseg *L, const int *p_in, int *p_out)
 {
 	assert(p != NULL);
 
 	int m = A->m;
 	const int *qinv = fact->qinv;
 	int verbose_step = spasm_max(1, n / 1000);
-	if (est_density < 0)
-		est_density = spasm_schur_estimate_density(A, p, n, fact->U, qinv, 100);
-	long long size = (est_density * n) * m;
+	if (est_nnz < 0) {
+		struct spasm_schur_estimate est;
+		spasm_schur_estimate(A, p, n, fact->U, qinv, 100, 0.05, &est);
+		est_nnz = est.nnz_hi;
+	}
+	i64 size = est_nnz + m;
 	i64 prime = spasm_get_prime(A);
 	struct spasm_csr *S = spasm_csr_alloc(n, m, size, prime, true);
 	i64 *Sp = S->p;
@@ -76,12 +140,11 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 	spasm_ZZp *Sx = S->x;
 	i64 snz = 0;                               /* nnz in S at the moment */
 	int Sn = 0;                                /* #rows in S at the moment */
-	i64 lnz = (L != NULL) ? L->nz : 0;         /* nnz in L at the moment */
-	int *Li = (L != NULL) ? L->i : NULL;
 	int *Lj = (L != NULL) ? L->j : NULL;
 	spasm_ZZp *Lx = (L != NULL) ? L->x : NULL;
 	int writing = 0;
 	double start = spasm_wtime();
+	int *order = spasm_schedule_heavy_first(A, p, n, fact->U, qinv);
 
 	#pragma omp parallel
 	{
@@ -92,8 +155,9 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 			xj[j] = 0;
 		int tid = spasm_get_thread_num();
 
-		#pragma omp for schedule(dynamic, verbose_step)
-		for (int i = 0; i < n; i++) {
+		#pragma omp for schedule(dynamic, 1)
+		for (int k = 0; k < n; k++) {
+			int i = order[k];
 			int inew = p[i];
 			int top = spasm_sparse_triangular_solve(fact->U, A, inew, xj, x, qinv);
 
@@ -109,6 +173,7 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 					row_lnz += 1;
 			}
 
+			int i_orig = (p_in != NULL) ? p_in[inew] : inew;
 			int local_i;
 			i64 local_snz, local_lnz;
 			#pragma omp critical(schur_complement)
@@ -130,26 +195,27 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 				local_snz = snz;
 				snz += row_snz;
 
-				if (L != NULL && lnz + row_lnz > L->nzmax) {
-					/* wait until other threads stop writing into it */
-					#pragma omp flush(writing)
-					while (writing > 0) {
+				/* one segment of L for this row */
+				local_lnz = 0;
+				if (L != NULL && row_lnz > 0) {
+					if (L->nz + row_lnz > L->nzmax || L->ns == L->nsmax) {
+						/* wait until other threads stop writing into it */
 						#pragma omp flush(writing)
+						while (writing > 0) {
+							#pragma omp flush(writing)
+						}
+						spasm_rowseg_realloc(L, 2 * L->nzmax + m, 2 * L->nsmax + 1);
+						Lj = L->j;
+						Lx = L->x;
 					}
-					spasm_triplet_realloc(L, 2 * L->nzmax + m);
-					Li = L->i;
-					Lj = L->j;
-					Lx = L->x;
+					local_lnz = spasm_rowseg_reserve(L, i_orig, row_lnz);
 				}
-				local_lnz = lnz;
-				lnz += row_lnz;
 
 				#pragma omp atomic update
 				writing += 1;    /* register as a writing thread */
 			}
 			
 			/* write the new row in L / S */
-			int i_orig = (p_in != NULL) ? p_in[inew] : inew;
 			if (p_out != NULL)
 				p_out[local_i] = i_orig;
 
@@ -162,10 +228,8 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 					Sx[local_snz] = x[j];
 					local_snz += 1;
 				} else if (L != NULL) {
-					Li[local_lnz] = i_orig;
 					Lj[local_lnz] = qinv[j];
 					Lx[local_lnz] = x[j];
-					// fprintf(stderr, "Adding L[%d, %d] = %d\n", i_out, qinv[j], x[j]);
 					local_lnz += 1;
 				}
 			}
@@ -174,7 +238,7 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 			#pragma omp atomic update
 			writing -= 1;        /* unregister as a writing thread */
 
-			if (tid == 0 && (i % verbose_step) == 0) {
+			if (tid == 0 && (k % verbose_step) == 0) {
 				double density =  1.0 * snz / (1.0 * m * Sn);
 				fprintf(stderr, "\rSchur complement: %d/%d [%" PRId64 " nz / density= %.3f]", Sn, n, snz, density);
 				fflush(stderr);
@@ -183,53 +247,350 @@ struct spasm_csr *spasm_schur(const struct spasm_csr *A, const int *p, int n, co
 		free(x);
 		free(xj);
 	}
-	/* finalize S and L */
-	if (L)
-		L->nz = lnz;
+	free(order);
+	/* finalize S */
 	spasm_csr_realloc(S, -1);
 	double density = 1.0 * snz / (1.0 * m * n);
 	fprintf(stderr, "\rSchur complement: %d * %d [%" PRId64 " nz / density= %.3f], %.1fs\n", n, m, snz, density, spasm_wtime() - start);
 	return S;
 }
 
-static void prepare_q(int m, const int *qinv, int *q)
+/*
+ * Same as spasm_schur, but consumes A and reuses its memory (A itself is turned into S and returned). 
+ * The rows of A that are not in p[0:n] are released first, then S is produced by chunks of rows, and written over the rows 
+ * of A that have already been processed. The peak memory usage is thus close to max(|A|, |S|) + 
+ * |chunk|, instead of |A| + |S|. The rows of S come in increasing order of their index in A (up to 
+ * the ordering within each chunk, which depends on the threads); p_out describes it.
+ */
+struct spasm_csr *spasm_schur_streaming(struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, 
+	i64 est_nnz, int nchunks, struct spasm_rowseg *L, const int *p_in, int *p_out)
 {
-	int i = 0;
-	for (int j = 0; j < m; j++)
-		if (qinv[j] < 0) {
-			q[i] = j;
-			i += 1;
+	assert(p != NULL);
+	int m = A->m;
+	double start = spasm_wtime();
+
+	/* keep only the rows p[0:n] of A (in increasing order) */
+	bool *keep = spasm_malloc(A->n * sizeof(*keep));
+	for (int i = 0; i < A->n; i++)
+		keep[i] = 0;
+	for (int k = 0; k < n; k++)
+		keep[p[k]] = 1;
+	int *orig = spasm_malloc(n * sizeof(*orig));        /* row k of the compacted A is row orig[k] of the original matrix */
+	i64 *Ap = A->p;
+	int *Aj = A->j;
+	spasm_ZZp *Ax = A->x;
+	i64 anz = 0;
+	int k = 0;
+	for (int i = 0; i < A->n; i++) {
+		if (!keep[i])
+			continue;
+		i64 len = Ap[i + 1] - Ap[i];
+		memmove(Aj + anz, Aj + Ap[i], len * sizeof(*Aj));
+		memmove(Ax + anz, Ax + Ap[i], len * sizeof(*Ax));
+		Ap[k] = anz;          /* does not overwrite Ap[i + 1], since k <= i */
+		orig[k] = (p_in != NULL) ? p_in[i] : i;
+		anz += len;
+		k += 1;
+	}
+	assert(k == n);
+	Ap[n] = anz;
+	free(keep);
+	i64 released = A->nzmax - anz;
+	spasm_csr_resize(A, n, m);
+	spasm_csr_realloc(A, anz);
+	char tmp[8];
+	spasm_human_format(released * (sizeof(int) + sizeof(spasm_ZZp)), tmp);
+	fprintf(stderr, "[schur/streaming] %s byte released (pivotal rows)\n", tmp);
+
+	/* S[k] is stored in A->j / A->x at Sp[k]:Sp[k+1]; the remaining rows of A are after */
+	i64 *Sp = spasm_malloc((n + 1) * sizeof(*Sp));
+	Sp[0] = 0;
+	i64 snz = 0;
+	int *iota = spasm_malloc(n * sizeof(*iota));
+	for (int i = 0; i < n; i++)
+		iota[i] = i;
+	int chunk = spasm_max(1, (n + nchunks - 1) / spasm_max(1, nchunks));
+	for (int r0 = 0; r0 < n; r0 += chunk) {
+		int r1 = spasm_min(n, r0 + chunk);
+		i64 est_chunk = (double) est_nnz * (r1 - r0) / n;
+		struct spasm_csr *C = spasm_schur(A, iota + r0, r1 - r0, fact, est_chunk, L, orig, p_out + r0);
+		i64 cnz = spasm_nnz(C);
+		Ap = A->p;
+
+		/* not enough room in the space of the processed rows: enlarge and move the remaining rows of A to the end */
+		if (snz + cnz > Ap[r1]) {
+			i64 remaining = Ap[n] - Ap[r1];
+			i64 needed = snz + cnz + remaining;
+			i64 nzmax = needed + needed / 4;
+			spasm_csr_realloc(A, nzmax);
+			i64 delta = nzmax - Ap[n];
+			memmove(A->j + Ap[r1] + delta, A->j + Ap[r1], remaining * sizeof(*A->j));
+			memmove(A->x + Ap[r1] + delta, A->x + Ap[r1], remaining * sizeof(*A->x));
+			for (int i = r1; i <= n; i++)
+				Ap[i] += delta;
+		}
+		for (i64 px = 0; px < cnz; px++) {
+			A->j[snz + px] = C->j[px];
+			A->x[snz + px] = C->x[px];
 		}
+		for (int i = 0; i < r1 - r0; i++)
+			Sp[r0 + i + 1] = snz + C->p[i + 1];
+		snz += cnz;
+		spasm_csr_free(C);
+	}
+	free(iota);
+	free(orig);
+
+	/* A becomes S */
+	free(A->p);
+	A->p = Sp;
+	spasm_csr_realloc(A, -1);
+	fprintf(stderr, "[schur/streaming] %d x %d with %" PRId64 " nz, %.1fs\n", n, m, snz, spasm_wtime() - start);
+	return A;
 }
 
-static void gather(int n, const int *xj, const spasm_ZZp *x, void *A, spasm_datatype datatype)
+/*
+ * Symbolic part of the Schur complement of (P*A)[0:n] w.r.t. U.
+ * Returns a pattern-only matrix R whose row k contains Reach(U, A[p[k]]), in topological order.
+ * This determines the pattern of both row k of the Schur complement and of the 
+ * corresponding elimination coefficients (in L). qinv locates the pivots in U.
+ */
+struct spasm_csr *spasm_schur_symbolic(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv)
 {
-	double *Ad;
-	float *Af;
-	i64 *Ai;
-	switch (datatype) {	
-	case SPASM_DOUBLE:
-		Ad = A;
+	assert(p != NULL);
+	int m = A->m;
+	i64 prime = spasm_get_prime(A);
+	double start = spasm_wtime();
+	int nthreads = omp_get_max_threads();
+	int **buffer = spasm_calloc(nthreads, sizeof(*buffer));     /* per-thread storage for the reaches (the team may be smaller) */
+	int *owner = spasm_malloc(n * sizeof(*owner));              /* thread who computed each reach */
+	i64 *where = spasm_malloc(n * sizeof(*where));              /* location of each reach in the buffer of its owner */
+	struct spasm_csr *R = spasm_csr_alloc(n, m, 0, prime, false);
+	i64 *Rp = R->p;
+
+	#pragma omp parallel
+	{
+		int *xj = spasm_malloc(3 * m * sizeof(*xj));
+		for (int j = 0; j < 3 * m; j++)
+			xj[j] = 0;
+		int tid = spasm_get_thread_num();
+		i64 size = 2 * m;
+		i64 used = 0;
+		int *local = spasm_malloc(size * sizeof(*local));
+
+		#pragma omp for schedule(dynamic, 1000)
 		for (int k = 0; k < n; k++) {
-			int j = xj[k];
-			Ad[k] = x[j];
+			int top = spasm_reach(U, A, p[k], m, xj, qinv);
+			int w = m - top;
+			if (used + w > size) {
+				size = 2 * size + w;
+				local = spasm_realloc(local, size * sizeof(*local));
+			}
+			for (int px = top; px < m; px++)
+				local[used + px - top] = xj[px];
+			owner[k] = tid;
+			where[k] = used;
+			used += w;
+			Rp[k + 1] = w;
+		}
+		buffer[tid] = local;
+		free(xj);
+	}
+
+	/* assemble R */
+	for (int k = 0; k < n; k++)
+		Rp[k + 1] += Rp[k];
+	spasm_csr_realloc(R, Rp[n]);
+	int *Rj = R->j;
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < n; k++) {
+		const int *src = buffer[owner[k]] + where[k];
+		for (i64 px = Rp[k]; px < Rp[k + 1]; px++)
+			Rj[px] = src[px - Rp[k]];
+	}
+	for (int t = 0; t < nthreads; t++)
+		free(buffer[t]);
+	free(buffer);
+	free(owner);
+	free(where);
+	char tmp[8];
+	spasm_human_format(Rp[n], tmp);
+	fprintf(stderr, "[schur/symbolic] %d reaches, %s entries [%.1fs]\n", n, tmp, spasm_wtime() - start);
+	return R;
+}
+
+/*
+ * Numerical part of the Schur complement of (P*A)[0:n] w.r.t. U, given its pattern R
+ * (from spasm_schur_symbolic). Row k of the output is the reduction of row p[k] of A 
+ * (unlike spasm_schur, where the order of rows is unspecified).
+ *
+ * if record is true, the non-pivotal entries of R that turn out to be zero are marked
+ * (j is replaced by -(j+1)).
+ * Otherwise, R is assumed to have been recorded on a matrix with the same pattern, and the 
+ * zero marks are checked: if a marked entry of the Schur complement is non-zero, 
+ * then the pattern of the result would not be contained in the recorded one.
+ * In this case, this returns NULL (and the elimination coefficients appended to L must be ignored).
+ *
+ * L, p_in and p_out are as in spasm_schur.
+ */
+struct spasm_csr *spasm_schur_numeric(const struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, 
+	struct spasm_csr *R, bool record, struct spasm_rowseg *L, const int *p_in, int *p_out)
+{
+	assert(p != NULL);
+	assert(R->n == n);
+	int m = A->m;
+	const struct spasm_csr *U = fact->U;
+	const int *qinv = fact->qinv;
+	i64 prime = spasm_get_prime(A);
+	double start = spasm_wtime();
+	const i64 *Rp = R->p;
+	int *Rj = R->j;
+
+	/* upper-bound the size of each row of S and L; room is reserved in advance */
+	struct spasm_csr *S = spasm_csr_alloc(n, m, 0, prime, true);
+	i64 *Sp = S->p;
+	i64 *Lq = spasm_malloc((n + 1) * sizeof(*Lq));          /* offsets of L entries */
+	Lq[0] = 0;
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < n; k++) {
+		int row_snz = 0;
+		int row_lnz = 0;
+		for (i64 px = Rp[k]; px < Rp[k + 1]; px++) {
+			int j = Rj[px];
+			if (j < 0)
+				continue;
+			if (qinv[j] < 0)
+				row_snz += 1;
+			else
+				row_lnz += 1;
 		}
-		break;
-	case SPASM_FLOAT:
-		Af = A;
+		Sp[k + 1] = row_snz;
+		Lq[k + 1] = row_lnz;
+	}
+	for (int k = 0; k < n; k++)
+		Sp[k + 1] += Sp[k];
+	spasm_csr_realloc(S, Sp[n]);
+	i64 s0 = (L != NULL) ? L->ns : 0;        /* one segment of L per row */
+	if (L != NULL) {
+		i64 total = 0;
+		for (int k = 0; k < n; k++)
+			total += Lq[k + 1];
+		spasm_rowseg_realloc(L, L->nz + total, L->ns + n);
 		for (int k = 0; k < n; k++) {
-			int j = xj[k];
-			Af[k] = x[j];
+			int i_orig = (p_in != NULL) ? p_in[p[k]] : p[k];
+			Lq[k] = spasm_rowseg_reserve(L, i_orig, Lq[k + 1]);
 		}
-		break;
-	case SPASM_I64:
-		Ai = A;
+	}
+	int *Sj = S->j;
+	spasm_ZZp *Sx = S->x;
+	int *Lj = (L != NULL) ? L->j : NULL;
+	spasm_ZZp *Lx = (L != NULL) ? L->x : NULL;
+	i64 *snz = spasm_malloc(n * sizeof(*snz));             /* actual row sizes */
+	i64 *lnz = spasm_malloc(n * sizeof(*lnz));
+	bool ok = 1;
+
+	#pragma omp parallel
+	{
+		spasm_ZZp *x = spasm_malloc(m * sizeof(*x));
+
+		#pragma omp for schedule(dynamic, 1000)
 		for (int k = 0; k < n; k++) {
-			int j = xj[k];
-			Ai[k] = x[j];
+			int inew = p[k];
+
+			/* x <--- A[inew], then eliminate along the (topologically sorted) pattern */
+			for (i64 px = Rp[k]; px < Rp[k + 1]; px++) {
+				int j = Rj[px];
+				x[(j < 0) ? -j - 1 : j] = 0;
+			}
+			spasm_scatter(A, inew, 1, x);
+			for (i64 px = Rp[k]; px < Rp[k + 1]; px++) {
+				int j = Rj[px];
+				if (j < 0 || qinv[j] < 0 || x[j] == 0)
+					continue;
+				spasm_ZZp backup = x[j];
+				spasm_scatter(U, qinv[j], -x[j], x);
+				x[j] = backup;
+			}
+
+			/* write the new row in L / S */
+			int i_orig = (p_in != NULL) ? p_in[inew] : inew;
+			if (p_out != NULL)
+				p_out[k] = i_orig;
+			i64 local_snz = Sp[k];
+			i64 local_lnz = Lq[k];
+			for (i64 px = Rp[k]; px < Rp[k + 1]; px++) {
+				int j = Rj[px];
+				if (j < 0) {
+					if (x[-j - 1] != 0) {
+						#pragma omp atomic write
+						ok = 0;         /* non-zero where the recorded pattern has a zero */
+					}
+					continue;
+				}
+				if (x[j] == 0) {
+					if (record && qinv[j] < 0)
+						Rj[px] = -j - 1;
+					continue;
+				}
+				if (qinv[j] < 0) {
+					Sj[local_snz] = j;
+					Sx[local_snz] = x[j];
+					local_snz += 1;
+				} else if (L != NULL) {
+					Lj[local_lnz] = qinv[j];
+					Lx[local_lnz] = x[j];
+					local_lnz += 1;
+				}
+			}
+			snz[k] = local_snz - Sp[k];
+			lnz[k] = local_lnz - Lq[k];
+		}
+		free(x);
+	}
+
+	if (ok) {
+		/* squeeze out the room reserved for entries that vanished */
+		i64 s = 0;
+		for (int k = 0; k < n; k++) {
+			for (i64 px = Sp[k]; px < Sp[k] + snz[k]; px++) {
+				Sj[s] = Sj[px];
+				Sx[s] = Sx[px];
+				s += 1;
+			}
+			Sp[k] = s - snz[k];
 		}
-		break;
+		Sp[n] = s;
+		if (L != NULL)
+			spasm_rowseg_squeeze(L, s0, lnz, NULL);
+		spasm_csr_realloc(S, -1);
+	} else {
+		spasm_csr_free(S);
+		S = NULL;
+		if (L != NULL) {
+			L->nz = L->sp[s0];
+			L->ns = s0;
+		}
+	}
+	free(Lq);
+	free(snz);
+	free(lnz);
+	if (S != NULL) {
+		double density = 1.0 * spasm_nnz(S) / (1.0 * m * n);
+		fprintf(stderr, "[schur/numeric] %d * %d [%" PRId64 " nz / density= %.3f], %.1fs\n", n, m, spasm_nnz(S), density, spasm_wtime() - start);
+	} else {
+		fprintf(stderr, "[schur/numeric] pattern mismatch [%.1fs]\n", spasm_wtime() - start);
 	}
+	return S;
+}
+
+static void prepare_q(int m, const int *qinv, int *q)
+{
+	int i = 0;
+	for (int j = 0; j < m; j++)
+		if (qinv[j] < 0) {
+			q[i] = j;
+			i += 1;
+		}
 }
 
 static void * row_pointer(void *A, i64 ldA, spasm_datatype datatype, i64 i)
@@ -242,6 +603,93 @@ static void * row_pointer(void *A, i64 ldA, spasm_datatype datatype, i64 i)
 	assert(false);
 }
 
+/*
+ * Rows of the dense schur complement (see spasm_schur_dense): q and order come from
+ * spasm_schur_dense_prepare, and if fact->Ltmp != NULL, it must have room for the new
+ * entries (n segments, n * U->n entries). This is a worksharing loop: inside a parallel region,
+ * all the threads of the team must call it, and they share the rows (a thread that arrives
+ * late, e.g. after an "omp single nowait" block, takes what is left).
+ */
+void spasm_schur_dense_rows(const struct spasm_csr *A, const int *p, int n, const int *p_in, 
+	struct spasm_lu *fact, void *S, spasm_datatype datatype, const int *q, const int *order, int *p_out)
+{
+	const struct spasm_csr *U = fact->U;
+	const int *qinv = fact->qinv;
+	int m = A->m;
+	int Sm = m - U->n;                                   /* #columns of S */
+	int verbose_step = spasm_max(1, n / 1000);
+	struct spasm_rowseg *L = fact->Ltmp;
+	int *Lj = (L != NULL) ? L->j : NULL;
+	spasm_ZZp *Lx = (L != NULL) ? L->x : NULL;
+
+	/* per-thread scratch space */
+	spasm_ZZp *x = spasm_malloc(m * sizeof(*x));
+	int *xj = spasm_malloc(3 * m * sizeof(*xj));
+	for (int j = 0; j < 3 * m; j++)
+		xj[j] = 0;
+	int tid = spasm_get_thread_num();
+
+	#pragma omp for schedule(dynamic, 1)
+	for (int t = 0; t < n; t++) {
+		int k = order[t];      /* row of S */
+		int i = p[k];          /* corresponding row of A */
+		int iorig = (p_in != NULL) ? p_in[i] : i;
+		p_out[k] = iorig;
+
+		/* eliminate known sparse pivots, put result in x */
+		for (int j = 0; j < m; j++)
+			x[j] = 0;
+		int top = spasm_sparse_triangular_solve(U, A, i, xj, x, qinv);
+
+		/* gather x into S[k] */
+		void *Sk = row_pointer(S, Sm, datatype, k);
+		spasm_dense_gather(Sm, q, x, Sk, datatype);
+		
+		/* fill eliminations coeffs in L (one segment) */
+		if (L != NULL) {
+			int row_lnz = 0;
+			for (int px = top; px < m; px++) {
+				int j = xj[px];
+				if (qinv[j] >= 0 && x[j] != 0)
+					row_lnz += 1;
+			}
+			i64 local_nz = 0;
+			if (row_lnz > 0) {
+				#pragma omp critical(schur_dense_L)
+				local_nz = spasm_rowseg_reserve(L, iorig, row_lnz);
+			}
+			for (int px = top; px < m; px++) {
+				int j = xj[px];
+				int i = qinv[j];
+				if (i < 0 || x[j] == 0)
+					continue;
+				Lj[local_nz] = i;
+				Lx[local_nz] = x[j];
+				local_nz += 1;
+			}
+		}
+
+		/* verbosity */
+		if (tid == 0 && (t % verbose_step) == 0) {
+			fprintf(stderr, "\r[schur/dense] %d/%d", t, n);
+			fflush(stderr);
+		}
+	}
+	free(x);
+	free(xj);
+}
+
+/*
+ * Set up the computation of the dense schur complement of (P*A)[0:n] w.r.t. U: q (size at least
+ * m - U->n) sends the columns of S to the non-pivotal columns of A; the rows are processed in the
+ * returned order (heavy first, to be freed by the caller).
+ */
+int * spasm_schur_dense_prepare(const struct spasm_csr *A, const int *p, int n, const struct spasm_lu *fact, int *q)
+{
+	prepare_q(A->m, fact->qinv, q);
+	return spasm_schedule_heavy_first(A, p, n, fact->U, fact->qinv);
+}
+
 /*
  * Computes the dense schur complement of (P*A)[0:n] w.r.t. U. 
  * S must be preallocated of dimension n * (A->m - U->n)
@@ -258,102 +706,50 @@ void spasm_schur_dense(const struct spasm_csr *A, const int *p, int n, const int
 	struct spasm_lu *fact, void *S, spasm_datatype datatype,int *q, int *p_out)
 {
 	assert(p != NULL);
-	const struct spasm_csr *U = fact->U;
-	const int *qinv = fact->qinv;
-	int m = A->m;
-	int Sm = m - U->n;                                   /* #columns of S */
-	prepare_q(m, qinv, q);                               /* FIXME: useless if many invokations */
+	int Sm = A->m - fact->U->n;                          /* #columns of S */
 	fprintf(stderr, "[schur/dense] dimension %d x %d...\n", n, Sm);
 	double start = spasm_wtime();
-	int verbose_step = spasm_max(1, n / 1000);
-	int r = 0;
-	struct spasm_triplet *L = fact->Ltmp;
+	struct spasm_rowseg *L = fact->Ltmp;
 	i64 extra_lnz = 1 + (i64) n * fact->U->n;
-	i64 lnz = 0;
-	if (L != NULL) {
-		lnz = L->nz;
-		spasm_triplet_realloc(L, lnz + extra_lnz);
-	}
-	int *Li = (L != NULL) ? L->i : NULL;
-	int *Lj = (L != NULL) ? L->j : NULL;
-	spasm_ZZp *Lx = (L != NULL) ? L->x : NULL;
-
+	if (L != NULL)
+		spasm_rowseg_realloc(L, L->nz + extra_lnz, L->ns + n);    /* no reallocation below */
+	int *order = spasm_schur_dense_prepare(A, p, n, fact, q);      /* FIXME: q is useless if many invokations */
 	#pragma omp parallel
-	{
-		/* per-thread scratch space */
-		spasm_ZZp *x = spasm_malloc(m * sizeof(*x));
-		int *xj = spasm_malloc(3 * m * sizeof(*xj));
-		for (int j = 0; j < 3 * m; j++)
-			xj[j] = 0;
-		int tid = spasm_get_thread_num();
-
-		#pragma omp for schedule(dynamic, verbose_step)
-		for (int k = 0; k < n; k++) {
-			int i = p[k];          /* corresponding row of A */
-			int iorig = (p_in != NULL) ? p_in[i] : i;
-			p_out[k] = iorig;
-
-			/* eliminate known sparse pivots, put result in x */
-			for (int j = 0; j < m; j++)
-				x[j] = 0;
-			int top = spasm_sparse_triangular_solve(U, A, i, xj, x, qinv);
-
-			/* gather x into S[k] */
-			void *Sk = row_pointer(S, Sm, datatype, k);
-			gather(Sm, q, x, Sk, datatype);
-			
-			/* fill eliminations coeffs in L */
-			if (L != NULL)
-				for (int k = top; k < m; k++) {
-					int j = xj[k];
-					int i = qinv[j];
-					if (i < 0 || x[j] == 0)
-						continue;
-					i64 local_nz;
-					#pragma omp atomic capture
-					{ local_nz = L->nz; L->nz += 1; } 
-					Li[local_nz] = iorig;
-					Lj[local_nz] = i;
-					Lx[local_nz] = x[j];
-				}
-
-			
-			/* verbosity */
-			#pragma omp atomic update
-			r += 1;
-			if (tid == 0 && (r % verbose_step) == 0) {
-				fprintf(stderr, "\r[schur/dense] %d/%d", r, n);
-				fflush(stderr);
-			}
-		}
-		free(x);
-		free(xj);
-	}
-	fprintf(stderr, "\n[schur/dense] finished in %.1fs, rank <= %d\n", spasm_wtime() - start, r);
+	spasm_schur_dense_rows(A, p, n, p_in, fact, S, datatype, q, order, p_out);
+	free(order);
+	fprintf(stderr, "\n[schur/dense] finished in %.1fs, rank <= %d\n", spasm_wtime() - start, n);
 }
 
 
 /*
  * Computes N random linear combinations rows of the Schur complement of (P*A)[0:n] w.r.t. U.
- * Assumes that pivots are first entries of the row
- * if w > 0, take random linear combinations of subsets of w rows, 
+ * if w > 0, take random linear combinations of subsets of w distinct rows (a sparse sketch), 
  *    otherwise, take random linear combinations of all the rows
+ * The randomness is fully determined by seed (not by the number of threads).
  * S must be preallocated of dimension N * (A->m - U->n)
  * S implicitly has dimension N x (m - npiv), row major, lds == m-npiv.
  * q must be preallocated of size at least (m - U->n).
  * on output, q sends columns of S to non-pivotal columns of A
+ *
+ * Each combination is reduced by a sparse triangular solve, so the work is proportional to the
+ * fill of the combination, not to the rank.
  */
 void spasm_schur_dense_randomized(const struct spasm_csr *A, const int *p, int n, const struct spasm_csr *U, const int *qinv, 
-	void *S, spasm_datatype datatype, int *q, int N, int w)
+	void *S, spasm_datatype datatype, int *q, int N, int w, u64 seed)
 {
 	assert(p != NULL);
 	assert(n > 0);
 	int m = A->m;
 	int Sm = m - U->n;
 	i64 prime = spasm_get_prime(A);
-	const i64 *Up = U->p;
-	const int *Uj = U->j;
+	const i64 *Ap = A->p;
+	const int *Aj = A->j;
+	const spasm_ZZp *Ax = A->x;
 	prepare_q(m, qinv, q);
+	int *qj = spasm_malloc(m * sizeof(*qj));            /* column of S for each non-pivotal column */
+	for (int k = 0; k < Sm; k++)
+		qj[q[k]] = k;
+	struct spasm_csr *R = (w > 0) ? spasm_sparse_sketch(N, n, w, prime, seed) : NULL;
 	fprintf(stderr, "[schur/dense/random] dimension %d x %d, weight %d...\n", N, Sm, w);
 	double start = spasm_wtime();
 	int verbose_step = spasm_max(1, N / 1000);
@@ -362,44 +758,55 @@ void spasm_schur_dense_randomized(const struct spasm_csr *A, const int *p, int n
 	{
 		/* per-thread scratch space */
 		spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+		i64 *mark = spasm_malloc(m * sizeof(*mark));
+		for (int j = 0; j < m; j++)
+			mark[j] = -1;
+		spasm_ZZp *x = spasm_malloc(m * sizeof(*x));
+		int *xj = spasm_malloc(3 * m * sizeof(*xj));
+		for (int j = 0; j < 3 * m; j++)
+			xj[j] = 0;
+		spasm_ZZp *row = spasm_malloc(Sm * sizeof(*row));
+		struct spasm_csr *B = spasm_csr_alloc(1, m, m, prime, true);    /* the combination, as a sparse row */
+		const struct spasm_field_struct *F = B->field;
 
 		#pragma omp for schedule(dynamic, verbose_step)
 		for (i64 k = 0; k < N; k++) {
-			spasm_prng_ctx ctx;
-			spasm_prng_seed_simple(prime, k, 0, &ctx);
-
-			for (int j = 0; j < m; j++)
-				y[j] = 0;
-			if (w <= 0) {
-				/* x <--- random linear combinations of all rows */
-				for (int i = 0; i < n; i++) {
-					int inew = p[i];
-					int coeff = spasm_prng_ZZp(&ctx);
-					spasm_scatter(A, inew, coeff, y);
-				}
-			} else {
-				for (int i = 0; i < w; i++) {
-					int inew = p[rand() % n];
-					int coeff = (i == 0) ? 1 : spasm_prng_ZZp(&ctx);
-					spasm_scatter(A, inew, coeff, y);
+			spasm_rng_ctx ctx;
+			spasm_rng_seed(prime, seed, k, &ctx);
+
+			/* y <--- random linear combination of rows (its pattern goes in B) */
+			int bnz = 0;
+			int nrows = (R != NULL) ? R->p[k + 1] - R->p[k] : n;
+			for (int i = 0; i < nrows; i++) {
+				int inew = (R != NULL) ? p[R->j[R->p[k] + i]] : p[i];
+				spasm_ZZp coeff = (R != NULL) ? R->x[R->p[k] + i] : spasm_rng_ZZp(&ctx);
+				for (i64 px = Ap[inew]; px < Ap[inew + 1]; px++) {
+					int j = Aj[px];
+					if (mark[j] != k) {
+						mark[j] = k;
+						y[j] = 0;
+						B->j[bnz] = j;
+						bnz += 1;
+					}
+					y[j] = spasm_ZZp_axpy(F, coeff, Ax[px], y[j]);
 				}
 			}
+			for (int px = 0; px < bnz; px++)
+				B->x[px] = y[B->j[px]];
+			B->p[1] = bnz;
 
 			/* eliminate known sparse pivots */
-			for (int i = 0; i < U->n; i++) {
-				int j = Uj[Up[i]];               // warning: this assumes pivots are first entries on the row
-				if (y[j] == 0)
-					continue;
-				spasm_scatter(U, i, -y[j], y);
-			}
+			int top = spasm_sparse_triangular_solve(U, B, 0, xj, x, qinv);
 			
-			/* gather x into S[k] */
-			void *Sk = row_pointer(S, Sm, datatype, k);
-			gather(Sm, q, y, Sk, datatype);
-			// for (int j = 0; j < Sm; j++) {
-			// 	int jj = q[j];
-			// 	spasm_datatype_write(S, k * Sm + j, datatype, x[jj]);
-			// }
+			/* scatter the non-pivotal part of x into S[k] */
+			for (int j = 0; j < Sm; j++)
+				row[j] = 0;
+			for (int px = top; px < m; px++) {
+				int j = xj[px];
+				if (qinv[j] < 0)
+					row[qj[j]] = x[j];
+			}
+			spasm_dense_from_ZZp(Sm, row, row_pointer(S, Sm, datatype, k), datatype);
 
 			/* verbosity */
 			if ((k % verbose_step) == 0) {
@@ -408,6 +815,14 @@ void spasm_schur_dense_randomized(const struct spasm_csr *A, const int *p, int n
 			}
 		}
 		free(y);
+		free(mark);
+		free(x);
+		free(xj);
+		free(row);
+		spasm_csr_free(B);
 	}
+	free(qj);
+	if (R != NULL)
+		spasm_csr_free(R);
 	fprintf(stderr, "\n[schur/dense/random] finished in %.1fs\n", spasm_wtime() - start);
 }
\ No newline at end of file
@@ -3,6 +3,37 @@
 
 #include "spasm.h"
 
+/*
+ * Move the "diagonal" entry of column j of L (on row p[j]) to the first place of its row, and
+ * store its inverse in fact->Linv[j]. Then the solvers neither search for it nor invert it.
+ */
+void spasm_lu_index_diagonal(struct spasm_lu *fact)
+{
+	struct spasm_csr *L = fact->L;
+	assert(L != NULL);
+	int r = L->m;
+	const i64 *Lp = L->p;
+	int *Lj = L->j;
+	spasm_ZZp *Lx = L->x;
+	free(fact->Linv);
+	fact->Linv = spasm_malloc(r * sizeof(*fact->Linv));
+	for (int j = 0; j < r; j++) {
+		int i = (fact->p != NULL) ? fact->p[j] : j;
+		i64 px = Lp[i];
+		while (px < Lp[i + 1] && Lj[px] != j)
+			px += 1;
+		assert(px < Lp[i + 1]);
+		i64 first = Lp[i];
+		int jj = Lj[first];
+		spasm_ZZp xx = Lx[first];
+		Lj[first] = j;
+		Lx[first] = Lx[px];
+		Lj[px] = jj;
+		Lx[px] = xx;
+		fact->Linv[j] = spasm_ZZp_inverse(L->field, Lx[first]);
+	}
+}
+
 /*
  * Solve x.A = b
  * 
@@ -35,10 +66,14 @@ bool spasm_solve(const struct spasm_lu *fact, const spasm_ZZp *b, spasm_ZZp *x)
 	/* z.U = b  (if possible) */
 	for (int i = 0; i < m; i++)
 		y[i] = b[i];
-	bool ok = spasm_dense_forward_solve(U, y, z, Uq);
+	bool ok;
+	if (fact->D == NULL)
+		ok = spasm_dense_forward_solve(U, y, z, Uq);
+	else
+		ok = spasm_dense_tail_forward_solve(U, fact->D, y, z, Uq, qinv);
 
 	/* y.LU = b */
-	spasm_dense_back_solve(L, z, x, fact->p);
+	spasm_dense_back_solve(L, z, x, fact->p, fact->Linv);
 	
 	free(y);
 	free(z);
@@ -46,6 +81,251 @@ bool spasm_solve(const struct spasm_lu *fact, const spasm_ZZp *b, spasm_ZZp *x)
 	return ok;
 }
 
+/*
+ * Prepared solver for x.A = b, when there are many right-hand sides. The inverse permutation
+ * of U is computed once, and the diagonal of L must have been indexed (see spasm_lu_index_diagonal). The
+ * right-hand sides are processed by blocks of (at most) block vectors: each row of U and L is
+ * then read once per block and applied to all the vectors of the block.
+ * The workspaces are allocated for all the threads of the current parallel setting.
+ */
+struct spasm_solver * spasm_solver_alloc(const struct spasm_lu *fact, int block)
+{
+	const struct spasm_csr *L = fact->L;
+	const struct spasm_csr *U = fact->U;
+	assert(L != NULL);
+	assert(fact->Linv != NULL);
+	assert(block > 0);
+	int m = U->m;
+	int r = U->n;
+
+	struct spasm_solver *S = spasm_malloc(sizeof(*S));
+	S->fact = fact;
+	S->block = block;
+	S->Uq = spasm_malloc(r * sizeof(*S->Uq));
+	for (int j = 0; j < m; j++) {
+		int i = fact->qinv[j];
+		if (i != -1)
+			S->Uq[i] = j;
+	}
+	S->nthreads = omp_get_max_threads();
+	S->work = spasm_malloc(S->nthreads * sizeof(*S->work));
+	for (int t = 0; t < S->nthreads; t++)
+		S->work[t] = spasm_malloc((i64) block * (m + r + 1) * sizeof(**S->work));
+	int Dm = (fact->D != NULL) ? fact->D->m : 0;
+	S->sparse_xj = spasm_malloc(S->nthreads * sizeof(*S->sparse_xj));
+	S->sparse_y = spasm_malloc(S->nthreads * sizeof(*S->sparse_y));
+	for (int t = 0; t < S->nthreads; t++) {
+		S->sparse_xj[t] = spasm_calloc(3 * ((i64) m + r), sizeof(**S->sparse_xj));
+		S->sparse_y[t] = spasm_malloc(((i64) m + r + Dm) * sizeof(**S->sparse_y));
+	}
+	return S;
+}
+
+void spasm_solver_free(struct spasm_solver *S)
+{
+	if (S == NULL)
+		return;
+	for (int t = 0; t < S->nthreads; t++) {
+		free(S->work[t]);
+		free(S->sparse_xj[t]);
+		free(S->sparse_y[t]);
+	}
+	free(S->work);
+	free(S->sparse_xj);
+	free(S->sparse_y);
+	free(S->Uq);
+	free(S);
+}
+
+/*
+ * Solve X[v].A = B[v] for v in [0:k], with k <= S->block. B is k x m, X is k x n (both dense, row-major).
+ * B is not modified. ok[v] is set to true iff X[v].A == B[v] has a solution (X[v] is garbage otherwise).
+ * This uses the workspace of the calling thread, so that several threads may solve different blocks.
+ */
+void spasm_solver_solve(const struct spasm_solver *S, int k, const spasm_ZZp *B, spasm_ZZp *X, bool *ok)
+{
+	const struct spasm_lu *fact = S->fact;
+	const struct spasm_csr *U = fact->U;
+	const struct spasm_csr *L = fact->L;
+	const struct spasm_dense_tail *D = fact->D;
+	const struct spasm_field_struct *F = U->field;
+	int m = U->m;
+	int r = U->n;
+	int n = L->n;
+	assert(k <= S->block);
+	int tid = spasm_get_thread_num();
+	assert(tid < S->nthreads);
+
+	/* interleaved storage: the entries of the k vectors on column j are in b[j*k:(j+1)*k] */
+	spasm_ZZp *b = S->work[tid];              /* size m * k */
+	spasm_ZZp *z = b + (i64) m * k;           /* size r * k */
+	spasm_ZZp *y = z + (i64) r * k;           /* size k */
+	for (int v = 0; v < k; v++)
+		for (int j = 0; j < m; j++)
+			b[(i64) j * k + v] = B[(i64) v * m + j];
+
+	/* Z.U = B (if possible). Sparse rows first */
+	const i64 *Up = U->p;
+	const int *Uj = U->j;
+	const spasm_ZZp *Ux = U->x;
+	int i0 = (D != NULL) ? D->i0 : r;
+	for (int i = 0; i < i0; i++) {
+		spasm_ZZp *bj = b + (i64) S->Uq[i] * k;
+		spasm_ZZp *zi = z + (i64) i * k;
+		bool nonzero = 0;
+		for (int v = 0; v < k; v++) {
+			zi[v] = bj[v];
+			nonzero |= (bj[v] != 0);
+		}
+		if (!nonzero)
+			continue;
+		for (i64 px = Up[i]; px < Up[i + 1]; px++) {
+			spasm_ZZp *bc = b + (i64) Uj[px] * k;
+			for (int v = 0; v < k; v++)
+				bc[v] = spasm_ZZp_axpy(F, -zi[v], Ux[px], bc[v]);
+		}
+	}
+
+	/* dense rows, in order */
+	if (D != NULL) {
+		for (int t = 0; t < D->n; t++) {
+			spasm_ZZp *zi = z + (i64) (i0 + t) * k;
+			for (int v = 0; v < k; v++)
+				zi[v] = 0;
+			int c = D->piv[t];
+			if (fact->qinv[D->cols[c]] != i0 + t)
+				continue;
+			spasm_ZZp *bj = b + (i64) D->cols[c] * k;
+			bool nonzero = 0;
+			for (int v = 0; v < k; v++) {
+				zi[v] = bj[v];
+				nonzero |= (bj[v] != 0);
+			}
+			if (!nonzero)
+				continue;
+			const spasm_ZZp *Dr = D->x + (i64) t * D->m;
+			for (int kk = 0; kk < D->m; kk++) {
+				if (Dr[kk] == 0)
+					continue;
+				spasm_ZZp *bc = b + (i64) D->cols[kk] * k;
+				for (int v = 0; v < k; v++)
+					bc[v] = spasm_ZZp_axpy(F, -zi[v], Dr[kk], bc[v]);
+			}
+		}
+	}
+
+	/* check that everything has been eliminated */
+	for (int v = 0; v < k; v++)
+		ok[v] = 1;
+	for (i64 jv = 0; jv < (i64) m * k; jv++)
+		if (b[jv] != 0)
+			ok[jv % k] = 0;
+
+	/* X.L = Z */
+	const i64 *Lp = L->p;
+	const int *Lj = L->j;
+	const spasm_ZZp *Lx = L->x;
+	for (i64 iv = 0; iv < (i64) n * k; iv++)
+		X[iv] = 0;
+	for (int j = r - 1; j >= 0; j--) {
+		int i = (fact->p != NULL) ? fact->p[j] : j;
+		spasm_ZZp *zj = z + (i64) j * k;
+		bool nonzero = 0;
+		for (int v = 0; v < k; v++) {
+			y[v] = spasm_ZZp_mul(F, fact->Linv[j], zj[v]);
+			X[(i64) v * n + i] = y[v];
+			nonzero |= (y[v] != 0);
+		}
+		if (!nonzero)
+			continue;
+		for (i64 px = Lp[i] + 1; px < Lp[i + 1]; px++) {
+			spasm_ZZp *zc = z + (i64) Lj[px] * k;
+			for (int v = 0; v < k; v++)
+				zc[v] = spasm_ZZp_axpy(F, -y[v], Lx[px], zc[v]);
+		}
+	}
+}
+
+/*
+ * Solve x.A = B[k], when B[k] is sparse. Only the rows of U and L that are reachable from
+ * the nonzero entries of B[k] are used (the pattern of the solution is found by a depth-first
+ * search, first through U, then through L).
+ * On output, the nonzero entries of x are x[xi[t]] == xx[t] for t in [0:nz], where nz is the
+ * return value (xi and xx must have size r). Returns -1 if there is no solution.
+ * This uses the workspace of the calling thread.
+ */
+int spasm_solver_sparse_solve(const struct spasm_solver *S, const struct spasm_csr *B, int k, int *xi, spasm_ZZp *xx)
+{
+	const struct spasm_lu *fact = S->fact;
+	const struct spasm_csr *U = fact->U;
+	const struct spasm_csr *L = fact->L;
+	const struct spasm_dense_tail *D = fact->D;
+	const int *qinv = fact->qinv;
+	const int *p = fact->p;
+	assert(p != NULL || U->n == 0);
+	int m = U->m;
+	int r = U->n;
+	int tid = spasm_get_thread_num();
+	assert(tid < S->nthreads);
+	int *xj = S->sparse_xj[tid];
+	spasm_ZZp *y = S->sparse_y[tid];         /* size m */
+	spasm_ZZp *z = y + m;                    /* size r */
+	int *zj = xj + 3 * m;                    /* size 3 * r */
+
+	/* y.U = B[k] (with the semantics of spasm_sparse_triangular_solve) */
+	int top = spasm_sparse_triangular_solve(U, B, k, xj, y, qinv);
+	if (D != NULL)
+		top = spasm_dense_tail_solve(D, U->field, top, m, xj, y, z + r, qinv);
+
+	/* pattern of z.L = y, where y is now indexed by the columns of L */
+	bool ok = 1;
+	int ztop = r;
+	int *pstack = zj + r;
+	int *marks = pstack + r;
+	for (int px = top; px < m; px++) {
+		int j = xj[px];
+		int i = qinv[j];
+		if (y[j] == 0)
+			continue;
+		if (i < 0) {
+			ok = 0;
+			break;
+		}
+		if (!marks[i])
+			ztop = spasm_dfs(i, L, ztop, zj, pstack, marks, p);
+	}
+	for (int px = ztop; px < r; px++)
+		marks[zj[px]] = 0;
+	if (!ok)
+		return -1;
+
+	/* scatter y in z, then solve z.L = y on the pattern */
+	for (int px = ztop; px < r; px++)
+		z[zj[px]] = 0;
+	for (int px = top; px < m; px++) {
+		int j = xj[px];
+		if (y[j] != 0)
+			z[qinv[j]] = y[j];
+	}
+	const i64 *Lp = L->p;
+	const int *Lj = L->j;
+	const spasm_ZZp *Lx = L->x;
+	int nz = 0;
+	for (int px = ztop; px < r; px++) {
+		int j = zj[px];
+		if (z[j] == 0)
+			continue;
+		int i = p[j];
+		spasm_ZZp a = spasm_ZZp_mul(L->field, fact->Linv[j], z[j]);
+		for (i64 qx = Lp[i] + 1; qx < Lp[i + 1]; qx++)
+			z[Lj[qx]] = spasm_ZZp_axpy(L->field, -a, Lx[qx], z[Lj[qx]]);
+		xi[nz] = i;
+		xx[nz] = a;
+		nz += 1;
+	}
+	return nz;
+}
+
 /* Solve XA == B (returns garbage if a solution does not exist).
  * If ok != NULL, then sets ok[i] == 1 iff xA == B[i] has a solution
  */
@@ -57,36 +337,65 @@ struct spasm_csr * spasm_gesv(const struct spasm_lu *fact, const struct spasm_cs
 	int n = B->n;
 	int m = B->m;
 	int Xm = fact->L->n;
-	struct spasm_triplet *X = spasm_triplet_alloc(n, Xm, (i64) Xm * n, prime, true);
-	int *Xi = X->i;
-	int *Xj = X->j;
-	spasm_ZZp *Xx = X->x;
+	int block = 16;
+	struct spasm_solver *S = spasm_solver_alloc(fact, block);
+	int nblocks = (n + block - 1) / block;
+	struct spasm_triplet **Xt = spasm_malloc(S->nthreads * sizeof(*Xt));
+	for (int t = 0; t < S->nthreads; t++)
+		Xt[t] = NULL;
 
 	#pragma omp parallel
 	{
-		spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
-		spasm_ZZp *x = spasm_malloc(Xm * sizeof(*x));
+		int tid = spasm_get_thread_num();
+		struct spasm_triplet *T = spasm_triplet_alloc(n, Xm, 1 + (i64) Xm * block, prime, true);
+		Xt[tid] = T;
+		spasm_ZZp *b = spasm_malloc((i64) block * m * sizeof(*b));
+		spasm_ZZp *x = spasm_malloc((i64) block * Xm * sizeof(*x));
+		bool *res = spasm_malloc(block * sizeof(*res));
 		#pragma omp for schedule(dynamic)
-		for (int i = 0; i < n; i++) {
-			for (int j = 0; j < m; j++) 
-				b[j] = 0;
-			spasm_scatter(B, i, 1, b);
-			bool res = spasm_solve(fact, b, x);
-			if (ok)
-				ok[i] = res;
-			for (int j = 0; j < Xm; j++) 
-				if (x[j] != 0) {
-					i64 xnz;
-					#pragma omp atomic capture
-					{ xnz = X->nz; X->nz += 1; }
-					Xi[xnz] = i;
-					Xj[xnz] = j;
-					Xx[xnz] = x[j];
-				}
+		for (int t = 0; t < nblocks; t++) {
+			int i0 = t * block;
+			int k = spasm_min(block, n - i0);
+			for (i64 jv = 0; jv < (i64) k * m; jv++)
+				b[jv] = 0;
+			for (int v = 0; v < k; v++)
+				spasm_scatter(B, i0 + v, 1, b + (i64) v * m);
+			spasm_solver_solve(S, k, b, x, res);
+			for (int v = 0; v < k; v++) {
+				if (ok)
+					ok[i0 + v] = res[v];
+				const spasm_ZZp *xv = x + (i64) v * Xm;
+				for (int j = 0; j < Xm; j++)
+					if (xv[j] != 0)
+						spasm_add_entry(T, i0 + v, j, xv[j]);
+			}
 		}
 		free(b);
 		free(x);
+		free(res);
+	}
+
+	/* concatenate the per-thread results */
+	int nthreads = S->nthreads;
+	i64 nz = 0;
+	for (int t = 0; t < nthreads; t++)
+		if (Xt[t] != NULL)
+			nz += Xt[t]->nz;
+	struct spasm_triplet *X = spasm_triplet_alloc(n, Xm, nz, prime, true);
+	for (int t = 0; t < nthreads; t++) {
+		struct spasm_triplet *T = Xt[t];
+		if (T == NULL)
+			continue;
+		for (i64 px = 0; px < T->nz; px++) {
+			X->i[X->nz] = T->i[px];
+			X->j[X->nz] = T->j[px];
+			X->x[X->nz] = T->x[px];
+			X->nz += 1;
+		}
+		spasm_triplet_free(T);
 	}
+	free(Xt);
+	spasm_solver_free(S);
 	struct spasm_csr *XX = spasm_compress(X);
 	spasm_triplet_free(X);
 	return XX;
@@ -17,8 +17,10 @@
  * 
  * p[j] == i indicates if the "diagonal" entry on column j is on row i
  * 
+ * If Linv != NULL, then the "diagonal" entry of column j is the first of its row, and
+ * its inverse is Linv[j] (see spasm_lu_index_diagonal). Otherwise it is searched for.
  */
-void spasm_dense_back_solve(const struct spasm_csr *L, spasm_ZZp *b, spasm_ZZp *x, const int *p)
+void spasm_dense_back_solve(const struct spasm_csr *L, spasm_ZZp *b, spasm_ZZp *x, const int *p, const spasm_ZZp *Linv)
 {
 	int n = L->n;
 	int r = L->m;
@@ -34,17 +36,23 @@ void spasm_dense_back_solve(const struct spasm_csr *L, spasm_ZZp *b, spasm_ZZp *
 		assert(0 <= i);
 		assert(i < n);
 
-		/* scan L[i] to locate the "diagonal" entry on column j */
-		spasm_ZZp diagonal_entry = 0;
-		for (i64 px = Lp[i]; px < Lp[i + 1]; px++)
-			if (Lj[px] == j) {
-				diagonal_entry = Lx[px];
-				break; 
-			}
-		assert(diagonal_entry != 0);
+		spasm_ZZp alpha;
+		if (Linv != NULL) {
+			assert(Lj[Lp[i]] == j);
+			alpha = Linv[j];
+		} else {
+			/* scan L[i] to locate the "diagonal" entry on column j */
+			spasm_ZZp diagonal_entry = 0;
+			for (i64 px = Lp[i]; px < Lp[i + 1]; px++)
+				if (Lj[px] == j) {
+					diagonal_entry = Lx[px];
+					break; 
+				}
+			assert(diagonal_entry != 0);
+			alpha = spasm_ZZp_inverse(L->field, diagonal_entry);
+		}
 
 		/* axpy - inplace */
-		spasm_ZZp alpha = spasm_ZZp_inverse(L->field, diagonal_entry);
 		x[i] = spasm_ZZp_mul(L->field, alpha, b[j]);
 		spasm_ZZp backup = x[i];
 		spasm_scatter(L, i, -x[i], b);
@@ -209,7 +209,9 @@ void spasm_lu_free(struct spasm_lu *N)
 {
 	free(N->qinv);
 	free(N->p);
+	free(N->Linv);
 	spasm_csr_free(N->U);
 	spasm_csr_free(N->L);
+	spasm_dense_tail_free(N->D);
 	free(N);
 }
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	/* many sparse rounds, each one in a compact index space */
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	opts.enable_column_compaction = 1;
+	opts.max_round = 10;
+	opts.min_pivot_proportion = 0;
+	opts.sparsity_threshold = 0.5;
+	struct spasm_lu *fact = spasm_echelonize(A, &opts);
+	if (!spasm_check_echelonization(A, fact, 1, "column compaction"))
+		exit(1);
+	printf("ok - echelonization with column compaction\n");
+	spasm_lu_free(fact);
+	spasm_csr_free(A);
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	int n = T->n;
+	int m = T->m;
+	
+	/* B = diag(A, A) */
+	i64 nz = T->nz;
+	for (i64 px = 0; px < nz; px++)
+		spasm_add_entry(T, n + T->i[px], m + T->j[px], T->x[px]);
+	T->n = 2 * n;
+	T->m = 2 * m;
+	struct spasm_csr *B = spasm_compress(T);
+	spasm_triplet_free(T);
+	struct spasm_csr *A = spasm_submatrix(B, 0, n, 0, m, true);
+
+	int *rcomp = spasm_malloc(2 * n * sizeof(*rcomp));
+	int *ccomp = spasm_malloc(2 * m * sizeof(*ccomp));
+	int ncomp_A = spasm_connected_components(A, rcomp, ccomp);
+	int ncomp_B = spasm_connected_components(B, rcomp, ccomp);
+	printf("# %d components in A\n", ncomp_A);
+	if (ncomp_B != 2 * ncomp_A) {
+		printf("not ok - %d components in diag(A, A), %d in A\n", ncomp_B, ncomp_A);
+		exit(1);
+	}
+	/* entries must stay within a component */
+	for (int i = 0; i < B->n; i++)
+		for (i64 px = B->p[i]; px < B->p[i + 1]; px++)
+			assert(rcomp[i] >= 0 && rcomp[i] == ccomp[B->j[px]]);
+
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+
+	spasm_echelonize_init_opts(&opts);
+	opts.complete = 1;
+	struct spasm_lu *fact = spasm_echelonize_components(B, &opts);
+	if (fact->r != 2 * ref->r) {
+		printf("not ok - rank(diag(A, A)) = %d, rank(A) = %d\n", fact->r, ref->r);
+		exit(1);
+	}
+	if (!spasm_factorization_verify(B, fact, 1337)) {
+		printf("not ok - B != L*U\n");
+		exit(1);
+	}
+
+	/* right kernel, assembled from the block-diagonal U */
+	struct spasm_csr *K = spasm_kernel(fact);
+	if (K->n != B->m - fact->r) {
+		printf("not ok - kernel has dimension %d instead of %d\n", K->n, B->m - fact->r);
+		exit(1);
+	}
+	spasm_ZZp *x = spasm_malloc(B->m * sizeof(*x));
+	spasm_ZZp *y = spasm_malloc(B->n * sizeof(*y));
+	for (int k = 0; k < K->n; k++) {
+		for (int j = 0; j < B->m; j++)
+			x[j] = 0;
+		for (i64 px = K->p[k]; px < K->p[k + 1]; px++)
+			x[K->j[px]] = K->x[px];
+		for (int i = 0; i < B->n; i++)
+			y[i] = 0;
+		spasm_Axpy(B, x, y);
+		for (int i = 0; i < B->n; i++)
+			if (y[i] != 0) {
+				printf("not ok - kernel vector %d is incorrect\n", k);
+				exit(1);
+			}
+	}
+	printf("ok - connected components\n");
+	free(x);
+	free(y);
+	free(rcomp);
+	free(ccomp);
+	spasm_csr_free(K);
+	spasm_lu_free(ref);
+	spasm_lu_free(fact);
+	spasm_csr_free(A);
+	spasm_csr_free(B);
+	return 0;
+}
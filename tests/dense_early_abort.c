@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	int n = T->n;
+
+	/* B = [A; A; A; A] has many dependent rows at the tail */
+	i64 nz = T->nz;
+	for (int k = 1; k < 4; k++)
+		for (i64 px = 0; px < nz; px++)
+			spasm_add_entry(T, k * n + T->i[px], T->j[px], T->x[px]);
+	T->n = 4 * n;
+	struct spasm_csr *B = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+
+	/* dense mode only, small blocks */
+	spasm_echelonize_init_opts(&opts);
+	opts.enable_presolve = 0;
+	opts.enable_tall_and_skinny = 0;
+	opts.max_round = 0;
+	opts.sparsity_threshold = -1;
+	opts.dense_block_size = 8 + n / 16;
+	struct spasm_lu *fact = spasm_echelonize(B, &opts);
+	/* the rows of U are in the row space of A, so they span it iff the ranks match */
+	if (fact->r != ref->r) {
+		printf("not ok - rank %d for [A; A; A; A] vs %d for A\n", fact->r, ref->r);
+		exit(1);
+	}
+	/* the completion test needs at least 10 dependent rows; then the copies of A are not all processed */
+	if (n >= 16 && fact->dense_skipped == 0) {
+		printf("not ok - no early abort on [A; A; A; A]\n");
+		exit(1);
+	}
+
+	/* C = [I; B]: all columns are pivotal after the identity block */
+	int m = B->m;
+	T = spasm_triplet_alloc(m + B->n, m, spasm_nnz(B) + m, prime, true);
+	for (int j = 0; j < m; j++)
+		spasm_add_entry(T, j, j, 1);
+	for (int i = 0; i < B->n; i++)
+		for (i64 px = B->p[i]; px < B->p[i + 1]; px++)
+			spasm_add_entry(T, m + i, B->j[px], B->x[px]);
+	struct spasm_csr *C = spasm_compress(T);
+	spasm_triplet_free(T);
+	opts.dense_block_size = 8 + m / 16;
+	struct spasm_lu *factC = spasm_echelonize(C, &opts);
+	if (factC->r != m) {
+		printf("not ok - rank %d for [I; B] instead of %d\n", factC->r, m);
+		exit(1);
+	}
+	/* full rank is reached at the end of the block that contains row m - 1; the rest is skipped */
+	int last = ((m + opts.dense_block_size - 1) / opts.dense_block_size) * opts.dense_block_size;
+	if (C->n > last && factC->dense_skipped != C->n - last) {
+		printf("not ok - %d rows of [I; B] skipped instead of %d\n", factC->dense_skipped, C->n - last);
+		exit(1);
+	}
+	spasm_lu_free(factC);
+	spasm_csr_free(C);
+	printf("ok - dense early abort\n");
+	spasm_lu_free(ref);
+	spasm_lu_free(fact);
+	spasm_csr_free(A);
+	spasm_csr_free(B);
+	return 0;
+}
@@ -23,7 +23,7 @@ int main(int argc, char **argv)
 		y[i] = b[i];
 	}
 
-	spasm_dense_back_solve(G, y, x, SPASM_IDENTITY_PERMUTATION);
+	spasm_dense_back_solve(G, y, x, SPASM_IDENTITY_PERMUTATION, NULL);
 
 	for (int i = 0; i < m; i++)
 		y[i] = 0;
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+/* 
+ * check that A and B have the same rows, up to the order of the rows (rows are matched by their first
+ * entry) and of the entries (explicit zeros are ignored)
+ */
+bool same_rows(const struct spasm_csr *A, const struct spasm_csr *B)
+{
+	if (A->n != B->n)
+		return 0;
+	int m = spasm_max(A->m, B->m);
+	int *row = spasm_malloc(m * sizeof(*row));
+	for (int j = 0; j < m; j++)
+		row[j] = -1;
+	for (int i = 0; i < B->n; i++)
+		row[B->j[B->p[i]]] = i;
+	spasm_ZZp *x = spasm_calloc(m, sizeof(*x));
+	bool ok = 1;
+	for (int i = 0; i < A->n && ok; i++) {
+		int k = row[A->j[A->p[i]]];
+		if (k < 0) {
+			ok = 0;
+			break;
+		}
+		spasm_scatter(A, i, 1, x);
+		spasm_scatter(B, k, -1, x);
+		for (i64 px = A->p[i]; px < A->p[i + 1]; px++)
+			if (x[A->j[px]] != 0)
+				ok = 0;
+		for (i64 px = B->p[k]; px < B->p[k + 1]; px++)
+			if (x[B->j[px]] != 0)
+				ok = 0;
+		for (i64 px = A->p[i]; px < A->p[i + 1]; px++)
+			x[A->j[px]] = 0;
+		for (i64 px = B->p[k]; px < B->p[k + 1]; px++)
+			x[B->j[px]] = 0;
+	}
+	free(x);
+	free(row);
+	return ok;
+}
+
+/* solve x.A = A[i] for a few rows, and x.A = b for a few vectors b; record the outcome */
+void solve_some(const struct spasm_csr *A, const struct spasm_lu *fact, bool *res)
+{
+	int n = A->n;
+	int m = A->m;
+	spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
+	spasm_ZZp *x = spasm_malloc(n * sizeof(*x));
+	spasm_prng_ctx ctx;
+	spasm_prng_seed_simple(prime, 0, 0, &ctx);
+	for (int k = 0; k < 10; k++) {
+		for (int j = 0; j < m; j++)
+			b[j] = 0;
+		if (k < 5)
+			spasm_scatter(A, spasm_prng_u32(&ctx) % n, 1, b);
+		else
+			for (int j = 0; j < m; j++)
+				b[j] = spasm_prng_ZZp(&ctx);
+		res[k] = spasm_solve(fact, b, x);
+	}
+	free(b);
+	free(x);
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+	int m = A->m;
+
+	/* default settings, then the dense finisher on the whole matrix (this gives a larger dense tail) */
+	for (int k = 0; k < 2; k++) {
+		struct echelonize_opts opts;
+		spasm_echelonize_init_opts(&opts);
+		opts.L = 1;
+		if (k == 1) {
+			if ((i64) n * m > 100000)
+				break;         /* too slow */
+			opts.enable_presolve = 0;
+			opts.max_round = 0;
+			opts.sparsity_threshold = -1;
+		}
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		struct spasm_csr *U = spasm_submatrix(fact->U, 0, fact->U->n, 0, m, true);
+		int *Rqinv = spasm_malloc(m * sizeof(*Rqinv));
+		struct spasm_csr *R1 = spasm_rref(fact, Rqinv);
+		struct spasm_csr *K1 = spasm_kernel(fact);
+		bool res1[10], res2[10];
+		if (n > 0)
+			solve_some(A, fact, res1);
+
+		/* same thing with the hybrid storage */
+		bool packed = spasm_lu_pack_dense_tail(fact);
+		struct spasm_csr *R2 = spasm_rref(fact, Rqinv);
+		struct spasm_csr *K2 = spasm_kernel(fact);
+		if (n > 0)
+			solve_some(A, fact, res2);
+		if (!same_rows(R1, R2)) {
+			printf("not ok - RREF differs with the dense tail\n");
+			exit(1);
+		}
+		if (!same_rows(K1, K2)) {
+			printf("not ok - kernel differs with the dense tail\n");
+			exit(1);
+		}
+		for (int t = 0; t < 10 && n > 0; t++)
+			if (res1[t] != res2[t] || (t < 5 && !res2[t])) {
+				printf("not ok - solve differs with the dense tail\n");
+				exit(1);
+			}
+		spasm_lu_unpack_dense_tail(fact);
+		if (!same_rows(U, fact->U)) {
+			printf("not ok - U differs after pack / unpack\n");
+			exit(1);
+		}
+		printf("ok - dense tail, config %d (%s)\n", k, packed ? "packed" : "not packed");
+		spasm_csr_free(R1);
+		spasm_csr_free(R2);
+		spasm_csr_free(K1);
+		spasm_csr_free(K2);
+		spasm_csr_free(U);
+		free(Rqinv);
+		spasm_lu_free(fact);
+	}
+	spasm_csr_free(A);
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+
+	/* dense mode only, small blocks, 4 blocks at once --> tree */
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	opts.enable_presolve = 0;
+	opts.enable_tall_and_skinny = 0;
+	opts.max_round = 0;
+	opts.sparsity_threshold = -1;
+	opts.dense_block_size = 1 + n / 8;
+	opts.dense_tree_width = 4;
+#ifdef _OPENMP
+	omp_set_num_threads(4);
+#endif
+	struct spasm_lu *fact = spasm_echelonize(A, &opts);
+	if (!spasm_check_echelonization(A, fact, 1, "the tree-parallel dense code"))
+		exit(1);
+	printf("ok - tree-parallel dense echelonization\n");
+	spasm_lu_free(fact);
+	spasm_csr_free(A);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+	int m = A->m;
+
+	/* b = x.A, for a random x: it involves all the rows of A */
+	spasm_ZZp *x = spasm_malloc(n * sizeof(*x));
+	spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
+	spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+	spasm_prng_ctx ctx;
+	spasm_prng_seed_simple(prime, 0, 0, &ctx);
+	for (int i = 0; i < n; i++)
+		x[i] = spasm_prng_ZZp(&ctx);
+	for (int j = 0; j < m; j++)
+		b[j] = 0;
+	spasm_xApy(x, A, b);
+
+	/* reference rank */
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+
+	/* DM blocks first (with or without presolve), then complete factorization */
+	for (int presolve = 0; presolve < 2; presolve++) {
+		spasm_echelonize_init_opts(&opts);
+		opts.enable_presolve = presolve;
+		opts.enable_dm_blocks = 1;
+		opts.complete = 1;
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		if (fact->r != ref->r) {
+			printf("not ok - rank %d with DM blocks (presolve=%d), %d without\n", fact->r, presolve, ref->r);
+			exit(1);
+		}
+		if (!spasm_factorization_verify(A, fact, 1337)) {
+			printf("not ok - A != L*U with DM blocks (presolve=%d)\n", presolve);
+			exit(1);
+		}
+		if (!spasm_is_echelon_order(fact, "DM blocks"))
+			exit(1);
+		for (int j = 0; j < m; j++)
+			y[j] = 0;
+		if (spasm_solve(fact, b, x))
+			spasm_xApy(x, A, y);
+		for (int j = 0; j < m; j++)
+			if (y[j] != b[j]) {
+				printf("not ok - x.A = b not solved with DM blocks (presolve=%d)\n", presolve);
+				exit(1);
+			}
+		spasm_lu_free(fact);
+	}
+	printf("ok - DM blocks\n");
+	spasm_lu_free(ref);
+	spasm_csr_free(A);
+	free(x);
+	free(b);
+	free(y);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+/* GPLU only */
+struct spasm_lu * GPLU(const struct spasm_csr *A, int nthreads, bool complete)
+{
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	opts.enable_presolve = 0;
+	opts.enable_dense = 0;
+	opts.enable_tall_and_skinny = 0;
+	opts.max_round = 0;
+	opts.complete = complete;
+#ifdef _OPENMP
+	omp_set_num_threads(nthreads);
+#else
+	(void) nthreads;
+#endif
+	return spasm_echelonize(A, &opts);
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int m = A->m;
+
+	/* the speculative version must produce the same U as the sequential one */
+	struct spasm_lu *seq = GPLU(A, 1, 0);
+	struct spasm_lu *par = GPLU(A, 4, 1);
+	if (seq->r != par->r) {
+		printf("not ok - rank %d with speculative GPLU, %d with sequential GPLU\n", par->r, seq->r);
+		exit(1);
+	}
+	spasm_ZZp *x = spasm_calloc(m, sizeof(*x));
+	for (int j = 0; j < m; j++)
+		assert(seq->qinv[j] == par->qinv[j]);
+	for (int i = 0; i < seq->r; i++) {
+		const struct spasm_csr *U = seq->U;
+		for (i64 px = U->p[i]; px < U->p[i + 1]; px++)
+			x[U->j[px]] = U->x[px];
+		U = par->U;
+		for (i64 px = U->p[i]; px < U->p[i + 1]; px++) {
+			if (x[U->j[px]] != U->x[px]) {
+				printf("not ok - row %d of U differs\n", i);
+				exit(1);
+			}
+			x[U->j[px]] = 0;
+		}
+		for (int j = 0; j < m; j++)
+			assert(x[j] == 0);
+	}
+
+	if (!spasm_factorization_verify(A, par, 1337)) {
+		printf("not ok - A != L*U with speculative GPLU\n");
+		exit(1);
+	}
+	printf("ok - speculative GPLU\n");
+	free(x);
+	spasm_lu_free(seq);
+	spasm_lu_free(par);
+	spasm_csr_free(A);
+	return 0;
+}
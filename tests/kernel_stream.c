@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+	struct option longopts[] = {
+		{"modulus", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	char ch;
+	while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'p':
+			prime = atoll(optarg);
+			break;
+		default:
+			errx(1, "Unknown option\n");
+		}
+	}
+}
+
+/* check the tags: row k must start with -1 on the k-th non-pivotal column */
+struct check {
+	const int *free_cols;
+	int *seen;
+	int bad;
+};
+
+static void check_writer(void *data, int k, int nz, const int *Kj, const spasm_ZZp *Kx)
+{
+	struct check *C = data;
+	#pragma omp atomic update
+	C->seen[k] += 1;
+	if (nz == 0 || Kj[0] != C->free_cols[k] || Kx[0] != -1) {
+		#pragma omp atomic write
+		C->bad = 1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+	int m = A->m;
+
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *fact = spasm_echelonize(A, &opts);
+	int Kn = m - fact->r;
+
+	/* streaming: each row is produced exactly once, with the right tag */
+	struct check C;
+	int *free_cols = spasm_malloc(m * sizeof(*free_cols));
+	int f = 0;
+	for (int j = 0; j < m; j++)
+		if (fact->qinv[j] < 0)
+			free_cols[f++] = j;
+	assert(f == Kn);
+	C.free_cols = free_cols;
+	C.seen = spasm_calloc(Kn + 1, sizeof(*C.seen));
+	C.bad = 0;
+	spasm_kernel_stream(fact, check_writer, &C);
+	for (int k = 0; k < Kn; k++)
+		if (C.seen[k] != 1)
+			C.bad = 1;
+	if (C.bad) {
+		printf("not ok - streamed kernel rows are not tagged correctly\n");
+		exit(1);
+	}
+
+	/* both bases are made of the unique kernel vectors with -1 on one free column and 0 on the others */
+	struct spasm_csr *K1 = spasm_kernel(fact);
+	int *Rqinv = spasm_malloc(m * sizeof(*Rqinv));
+	struct spasm_csr *R = spasm_rref(fact, Rqinv);
+	struct spasm_csr *K2 = spasm_kernel_from_rref(R, Rqinv);
+	if (K1->n != Kn || K2->n != Kn) {
+		printf("not ok - kernel has dimension %d / %d instead of %d\n", K1->n, K2->n, Kn);
+		exit(1);
+	}
+	spasm_ZZp *x = spasm_calloc(m, sizeof(*x));
+	for (int k = 0; k < Kn; k++) {
+		spasm_scatter(K1, k, 1, x);
+		spasm_scatter(K2, k, -1, x);
+		for (int j = 0; j < m; j++)
+			if (x[j] != 0) {
+				printf("not ok - kernel row %d differs with the RREF\n", k);
+				exit(1);
+			}
+
+		/* A.x == 0 */
+		spasm_scatter(K1, k, 1, x);
+		for (int i = 0; i < n; i++) {
+			spasm_ZZp y = 0;
+			for (i64 px = A->p[i]; px < A->p[i + 1]; px++)
+				y = spasm_ZZp_axpy(A->field, A->x[px], x[A->j[px]], y);
+			if (y != 0) {
+				printf("not ok - row %d is not in the kernel\n", k);
+				exit(1);
+			}
+		}
+		for (i64 px = K1->p[k]; px < K1->p[k + 1]; px++)
+			x[K1->j[px]] = 0;
+	}
+	printf("ok - streamed kernel basis\n");
+	free(x);
+	free(free_cols);
+	free(C.seen);
+	free(Rqinv);
+	spasm_csr_free(K1);
+	spasm_csr_free(K2);
+	spasm_csr_free(R);
+	spasm_lu_free(fact);
+	spasm_csr_free(A);
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+
+	/* dense mode only with a tight budget (U + a few blocks) and L, then default settings with an ample budget */
+	i64 budgets[2] = {13 * (i64) spasm_min(A->n, A->m) * A->m + 1024, 1 << 30};
+	for (int k = 0; k < 2; k++) {
+		spasm_echelonize_init_opts(&opts);
+		if (k == 0) {
+			opts.enable_presolve = 0;
+			opts.max_round = 0;
+			opts.sparsity_threshold = -1;
+			opts.complete = 1;
+		}
+		opts.memory_budget = budgets[k];
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		if (fact->r != ref->r) {
+			printf("not ok - rank %d with a memory budget of %" PRId64 " bytes, %d with default\n", fact->r, budgets[k], ref->r);
+			exit(1);
+		}
+		if (opts.complete && !spasm_factorization_verify(A, fact, 1337)) {
+			printf("not ok - A != L*U with a memory budget of %" PRId64 " bytes\n", budgets[k]);
+			exit(1);
+		}
+		spasm_lu_free(fact);
+	}
+	printf("ok - memory budget\n");
+	spasm_lu_free(ref);
+	spasm_csr_free(A);
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	/* reference rank, without presolve */
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	opts.enable_presolve = 0;
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+
+	/* presolve with aggressive merges, then complete factorization */
+	for (int w = 0; w < 20; w += 10) {
+		spasm_echelonize_init_opts(&opts);
+		opts.enable_presolve = 1;
+		opts.presolve_merge_weight = w;
+		opts.complete = 1;
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		if (fact->r != ref->r) {
+			printf("not ok - rank %d with presolve (merge weight %d), %d without\n", fact->r, w, ref->r);
+			exit(1);
+		}
+		if (!spasm_factorization_verify(A, fact, 1337)) {
+			printf("not ok - A != L*U after presolve (merge weight %d)\n", w);
+			exit(1);
+		}
+		spasm_lu_free(fact);
+	}
+
+	/* presolve, then straight to the dense finisher, with L (the rows of L are those of A, not of the presolved matrix) */
+	spasm_echelonize_init_opts(&opts);
+	opts.enable_presolve = 1;
+	opts.L = 1;
+	opts.max_round = 0;
+	opts.sparsity_threshold = -1;
+	opts.enable_tall_and_skinny = 0;
+	opts.dense_block_size = 7;
+	struct spasm_lu *fact = spasm_echelonize(A, &opts);
+	if (fact->r != ref->r) {
+		printf("not ok - rank %d with presolve and the dense finisher, %d without\n", fact->r, ref->r);
+		exit(1);
+	}
+	if (!spasm_factorization_verify(A, fact, 1337)) {
+		printf("not ok - A != L*U after presolve and the dense finisher\n");
+		exit(1);
+	}
+	spasm_lu_free(fact);
+	printf("ok - presolve\n");
+	spasm_lu_free(ref);
+	spasm_csr_free(A);
+	return 0;
+}
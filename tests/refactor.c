@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+	struct option longopts[] = {
+		{"modulus", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	char ch;
+	while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'p':
+			prime = atoll(optarg);
+			break;
+		default:
+			errx(1, "Unknown option\n");
+		}
+	}
+}
+
+/* same pattern, new random (non-zero) values */
+struct spasm_csr * new_values(const struct spasm_csr *A, u64 seed)
+{
+	struct spasm_csr *B = spasm_csr_alloc(A->n, A->m, spasm_nnz(A), prime, true);
+	spasm_prng_ctx ctx;
+	spasm_prng_seed_simple(prime, seed, 0, &ctx);
+	for (int i = 0; i <= A->n; i++)
+		B->p[i] = A->p[i];
+	for (i64 px = 0; px < spasm_nnz(A); px++) {
+		B->j[px] = A->j[px];
+		do {
+			B->x[px] = spasm_prng_ZZp(&ctx);
+		} while (B->x[px] == 0);
+	}
+	return B;
+}
+
+/* D1 * A * D2, for random non-singular diagonal D1, D2: the eliminations cancel the same entries */
+struct spasm_csr * scaled_values(const struct spasm_csr *A, u64 seed)
+{
+	struct spasm_csr *B = spasm_csr_alloc(A->n, A->m, spasm_nnz(A), prime, true);
+	spasm_prng_ctx ctx;
+	spasm_prng_seed_simple(prime, seed, 0, &ctx);
+	spasm_ZZp *c = spasm_malloc(A->m * sizeof(*c));
+	for (int j = 0; j < A->m; j++)
+		do {
+			c[j] = spasm_prng_ZZp(&ctx);
+		} while (c[j] == 0);
+	for (int i = 0; i <= A->n; i++)
+		B->p[i] = A->p[i];
+	for (int i = 0; i < A->n; i++) {
+		spasm_ZZp r;
+		do {
+			r = spasm_prng_ZZp(&ctx);
+		} while (r == 0);
+		for (i64 px = A->p[i]; px < A->p[i + 1]; px++) {
+			int j = A->j[px];
+			B->j[px] = j;
+			B->x[px] = spasm_ZZp_mul(B->field, r, spasm_ZZp_mul(B->field, A->x[px], c[j]));
+		}
+	}
+	free(c);
+	return B;
+}
+
+void check(const struct spasm_csr *A, struct spasm_lu *fact)
+{
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+	if (ref->r != fact->r) {
+		printf("not ok - refactorization has rank %d instead of %d\n", fact->r, ref->r);
+		exit(1);
+	}
+	if (!spasm_factorization_verify(A, fact, 42)) {
+		printf("not ok - refactorization is incorrect\n");
+		exit(1);
+	}
+	spasm_lu_free(ref);
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	opts.L = 1;
+	struct spasm_symbolic *sym;
+	struct spasm_lu *fact = spasm_echelonize_analyze(A, &opts, &sym);
+
+	/* same values: replay must succeed */
+	struct spasm_lu *fact2 = spasm_echelonize_refactor(A, sym);
+	if (sym->fallbacks != 0) {
+		printf("not ok - replay on the analyzed matrix failed\n");
+		exit(1);
+	}
+	if (fact2->r != fact->r) {
+		printf("not ok - replay has rank %d instead of %d\n", fact2->r, fact->r);
+		exit(1);
+	}
+	spasm_lu_free(fact2);
+
+	/* scaled values: the pattern of every step is the same, so the replay must succeed */
+	struct spasm_csr *C = scaled_values(A, 42);
+	struct spasm_lu *factC = spasm_echelonize_refactor(C, sym);
+	if (sym->fallbacks != 0) {
+		printf("not ok - refactorization on D1*A*D2 fell back to a full echelonization\n");
+		exit(1);
+	}
+	check(C, factC);
+	spasm_lu_free(factC);
+	spasm_csr_free(C);
+
+	/* new values (their pattern may differ: fallbacks are allowed) */
+	struct spasm_csr *B = new_values(A, 1337);
+	struct spasm_lu *factB = spasm_echelonize_refactor(B, sym);
+	check(B, factB);
+	printf("# %d refactorizations, %d fallbacks\n", sym->refactorizations, sym->fallbacks);
+	spasm_lu_free(factB);
+	spasm_csr_free(B);
+	spasm_lu_free(fact);
+	spasm_symbolic_free(sym);
+	printf("ok - symbolic analysis + refactorization\n");
+	spasm_csr_free(A);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	/* reference rank */
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *ref = spasm_echelonize(A, &opts);
+
+	/* right-looking only, then with a hand-over to the dense code */
+	for (int dense = 0; dense < 2; dense++) {
+		spasm_echelonize_init_opts(&opts);
+		opts.enable_presolve = 0;
+		opts.enable_right_looking = 1;
+		opts.enable_dense = dense;
+		opts.sparsity_threshold = 0.2;
+		opts.max_round = 0;
+		opts.complete = 1;
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		if (fact->r != ref->r) {
+			printf("not ok - rank %d with right-looking elimination (dense=%d), %d with default\n", fact->r, dense, ref->r);
+			exit(1);
+		}
+		if (!spasm_factorization_verify(A, fact, 1337)) {
+			printf("not ok - A != L*U with right-looking elimination (dense=%d)\n", dense);
+			exit(1);
+		}
+		spasm_lu_free(fact);
+	}
+	printf("ok - right-looking elimination\n");
+	spasm_lu_free(ref);
+	spasm_csr_free(A);
+	return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+/* floor(log2(cost)), as in spasm_schedule.c */
+int cost_class(const struct spasm_csr *A, int i, const struct spasm_csr *U, const int *qinv)
+{
+	i64 cost = 0;
+	for (i64 px = A->p[i]; px < A->p[i + 1]; px++) {
+		int k = qinv[A->j[px]];
+		cost += 1 + ((k >= 0) ? U->p[k + 1] - U->p[k] : 0);
+	}
+	int c = 0;
+	for (; cost > 1; cost >>= 1)
+		c += 1;
+	return c;
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	struct spasm_lu *fact = spasm_echelonize(A, &opts);
+	const struct spasm_csr *U = fact->U;
+
+	/* schedule the odd rows of A */
+	int *p = spasm_malloc(n * sizeof(*p));
+	int k = 0;
+	for (int i = 1; i < n; i += 2)
+		p[k++] = i;
+	int *order = spasm_schedule_heavy_first(A, p, k, U, fact->qinv);
+
+	/* this must be a permutation of [0:k], by decreasing cost class */
+	char *seen = spasm_malloc(k + 1);
+	for (int i = 0; i < k; i++)
+		seen[i] = 0;
+	int prev = 64;
+	for (int t = 0; t < k; t++) {
+		int i = order[t];
+		if (i < 0 || i >= k || seen[i]) {
+			printf("not ok - not a permutation\n");
+			exit(1);
+		}
+		seen[i] = 1;
+		int c = cost_class(A, p[i], U, fact->qinv);
+		if (c > prev) {
+			printf("not ok - row %d (class %d) scheduled after a lighter one (class %d)\n", p[i], c, prev);
+			exit(1);
+		}
+		prev = c;
+	}
+	printf("ok - heavy-first schedule\n");
+	free(seen);
+	free(order);
+	free(p);
+	spasm_lu_free(fact);
+	spasm_csr_free(A);
+	return 0;
+}
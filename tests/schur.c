@@ -70,6 +70,24 @@ int main(int argc, char **argv)
 		}
 	}
 	printf("ok - elimination coeffs are really absent\n");
+
+	/* the estimator is exact when all rows are sampled */
+	struct spasm_schur_estimate est;
+	spasm_schur_estimate(A, p + npiv, n - npiv, U, qinv, n, 0.05, &est);
+	if (est.nnz != spasm_nnz(S) || est.nnz_lo != est.nnz || est.nnz_hi != est.nnz) {
+		printf("not ok - exact estimate gives %" PRId64 " nnz, schur complement has %" PRId64 "\n", est.nnz, spasm_nnz(S));
+		exit(1);
+	}
+	spasm_schur_estimate(A, p + npiv, n - npiv, U, qinv, 4, 0.05, &est);
+	if (est.nnz_lo > est.nnz || est.nnz > est.nnz_hi || est.nnz_hi > (i64) Sn * (m - U->n)) {
+		printf("not ok - inconsistent estimate %" PRId64 " in [%" PRId64 ", %" PRId64 "]\n", est.nnz, est.nnz_lo, est.nnz_hi);
+		exit(1);
+	}
+	if (est.samples > 8 * 4) {
+		printf("not ok - %d samples drawn, the budget is %d\n", est.samples, 8 * 4);
+		exit(1);
+	}
+	printf("ok - schur complement size estimate\n");
 	spasm_csr_free(S);
 
 	/* phase II: check the elimination coeffs */
@@ -53,7 +53,7 @@ int main(int argc, char **argv)
 	fact.U = U;
 	fact.qinv = Uqinv;
 	fact.L = NULL;
-	fact.Ltmp = spasm_triplet_alloc(n, n, spasm_nnz(A), prime, true);
+	fact.Ltmp = spasm_rowseg_alloc(n, n, spasm_nnz(A), prime);
 
 	/* find pivots, copy to U, update L */
 	int npiv = spasm_pivots_extract_structural(A, NULL, &fact, p, &opts);
@@ -72,7 +72,8 @@ int main(int argc, char **argv)
 	size_t *Sqinv = spasm_malloc(Sm * sizeof(*Sqinv));                   /* for FFPACK */
 	size_t *Sp = spasm_malloc(Sn * sizeof(*Sp));                         /* for FFPACK */
 	spasm_schur_dense(A, p + npiv, Sn, NULL, &fact, S, datatype, q, p_out);
-	struct spasm_csr *L = spasm_compress(fact.Ltmp);
+	struct spasm_csr *L = spasm_rowseg_assemble(fact.Ltmp);
+	fact.Ltmp = NULL;
 	i64 *Lp = L->p;
 	int *Lj = L->j;
 	spasm_ZZp *Lx = L->x;
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+        struct option longopts[] = {
+                {"modulus", required_argument, NULL, 'p'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'p':
+                        prime = atoll(optarg);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+}
+
+int main(int argc, char **argv) 
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+
+	int n = A->n;
+	int m = A->m;
+ 
+	int *p = spasm_malloc(n * sizeof(*p));
+	int *qinv = spasm_malloc(m * sizeof(*qinv));
+	struct echelonize_opts opts;
+	spasm_echelonize_init_opts(&opts);
+	
+	struct spasm_csr *U = spasm_csr_alloc(n, m, spasm_nnz(A), prime, true);
+	U->n = 0;
+	for (int j = 0; j < m; j++)
+		qinv[j] = -1;
+
+	struct spasm_lu fact;
+	fact.U = U;
+	fact.qinv = qinv;
+	fact.L = NULL;
+	fact.Ltmp = NULL;
+	fact.p = NULL;
+
+	int npiv = spasm_pivots_extract_structural(A, NULL, &fact, p, &opts);
+	int Sn = n - npiv;
+	int *p_out = spasm_malloc(Sn * sizeof(*p_out));
+	struct spasm_csr *S = spasm_schur(A, p + npiv, Sn, &fact, -1, NULL, NULL, p_out);
+
+	/* consume a copy of A, in 3 chunks, with a bad size estimate */
+	struct spasm_csr *B = spasm_submatrix(A, 0, n, 0, m, true);
+	int *B_out = spasm_malloc(Sn * sizeof(*B_out));
+	struct spasm_csr *R = spasm_schur_streaming(B, p + npiv, Sn, &fact, 1, 3, NULL, NULL, B_out);
+	if (R->n != Sn || spasm_nnz(R) != spasm_nnz(S)) {
+		printf("not ok - streaming schur complement has %d rows / %" PRId64 " nz, expected %d / %" PRId64 "\n", 
+			R->n, spasm_nnz(R), Sn, spasm_nnz(S));
+		exit(1);
+	}
+
+	/* compare the rows (they may come in a different order) */
+	int *where = spasm_malloc(n * sizeof(*where));
+	for (int i = 0; i < Sn; i++)
+		where[p_out[i]] = i;
+	spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+	for (int j = 0; j < m; j++)
+		y[j] = 0;
+	for (int k = 0; k < Sn; k++) {
+		int i = where[B_out[k]];
+		for (i64 px = S->p[i]; px < S->p[i + 1]; px++)
+			y[S->j[px]] = S->x[px];
+		for (i64 px = R->p[k]; px < R->p[k + 1]; px++) {
+			int j = R->j[px];
+			if (y[j] != R->x[px]) {
+				printf("not ok - row %d (from row %d of A) differs on column %d\n", k, B_out[k], j);
+				exit(1);
+			}
+		}
+		for (i64 px = S->p[i]; px < S->p[i + 1]; px++)
+			y[S->j[px]] = 0;
+		if (S->p[i + 1] - S->p[i] != R->p[k + 1] - R->p[k]) {
+			printf("not ok - row %d (from row %d of A) has the wrong weight\n", k, B_out[k]);
+			exit(1);
+		}
+	}
+	printf("ok - streaming schur complement\n");
+
+	free(y);
+	free(where);
+	free(p_out);
+	free(B_out);
+	free(p);
+	spasm_csr_free(R);
+	spasm_csr_free(S);
+	spasm_csr_free(A);
+	spasm_csr_free(U);
+	free(qinv);
+	exit(EXIT_SUCCESS);
+}
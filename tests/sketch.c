@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+/* fast PRNG: outputs in range, streams differ, and below(n) is roughly uniform */
+void check_rng(i64 prime)
+{
+	spasm_rng_ctx a, b;
+	spasm_rng_seed(prime, 42, 0, &a);
+	spasm_rng_seed(prime, 42, 1, &b);
+	int same = 0;
+	int count[10] = {0};
+	for (int k = 0; k < 10000; k++) {
+		spasm_ZZp x = spasm_rng_ZZp(&a);
+		spasm_ZZp y = spasm_rng_nonzero_ZZp(&b);
+		assert(x <= prime / 2);
+		assert(x >= -prime / 2);
+		assert(y != 0);
+		same += (x == y);
+		u32 r = spasm_rng_below(&a, 10);
+		assert(r < 10);
+		count[r] += 1;
+	}
+	for (int r = 0; r < 10; r++)
+		assert(800 < count[r] && count[r] < 1200);
+	assert(same < 10000 / 2);
+	printf("ok rng mod %" PRId64 "\n", prime);
+}
+
+/* sketch: w distinct columns per row, first coefficient is 1, all nonzero, deterministic */
+void check_sketch(int N, int n, int w, i64 prime)
+{
+	struct spasm_csr *R = spasm_sparse_sketch(N, n, w, prime, 1337);
+	struct spasm_csr *S = spasm_sparse_sketch(N, n, w, prime, 1337);
+	int ww = spasm_min(w, n);
+	int *mark = spasm_malloc(n * sizeof(*mark));
+	for (int j = 0; j < n; j++)
+		mark[j] = -1;
+	for (int k = 0; k < N; k++) {
+		assert(R->p[k + 1] - R->p[k] == ww);
+		for (i64 px = R->p[k]; px < R->p[k + 1]; px++) {
+			int j = R->j[px];
+			assert(0 <= j && j < n);
+			assert(mark[j] != k);
+			mark[j] = k;
+			assert(R->x[px] != 0);
+			assert(px > R->p[k] || R->x[px] == 1);
+			assert(S->j[px] == j && S->x[px] == R->x[px]);
+		}
+	}
+	free(mark);
+	spasm_csr_free(R);
+	spasm_csr_free(S);
+	printf("ok sketch %d x %d, weight %d\n", N, n, w);
+}
+
+int main()
+{
+	check_rng(3);
+	check_rng(257);
+	check_rng(42013);
+	check_rng(4294967291);
+
+	check_sketch(100, 1000, 10, 257);
+	check_sketch(50, 20, 20, 3);
+	check_sketch(50, 20, 100, 65537);
+	check_sketch(1000, 1, 1, 42013);
+	exit(EXIT_SUCCESS);
+}
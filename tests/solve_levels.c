@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+	struct option longopts[] = {
+		{"modulus", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	char ch;
+	while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'p':
+			prime = atoll(optarg);
+			break;
+		default:
+			errx(1, "Unknown option\n");
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+	int m = A->m;
+
+	spasm_ZZp *x = spasm_malloc(n * sizeof(*x));
+	spasm_ZZp *x_ref = spasm_malloc(n * sizeof(*x_ref));
+	spasm_ZZp *y = spasm_malloc(m * sizeof(*y));
+	spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
+	spasm_ZZp *b_ref = spasm_malloc(m * sizeof(*b_ref));
+	spasm_ZZp *z = spasm_malloc(n * sizeof(*z));       /* workspace, at least the rank */
+#ifdef _OPENMP
+	omp_set_num_threads(4);
+#endif
+
+	/* with and without a dense tail in U */
+	for (int config = 0; config < 2; config++) {
+		struct echelonize_opts opts;
+		spasm_echelonize_init_opts(&opts);
+		opts.L = 1;
+		opts.enable_dense_tail = config;
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		struct spasm_levels *SU = spasm_levels_U(fact);
+		struct spasm_levels *SL = spasm_levels_L(fact);
+
+		/* forge valid solution */
+		spasm_prng_ctx ctx;
+		spasm_prng_seed_simple(prime, config, 0, &ctx);
+		for (int i = 0; i < n; i++)
+			x[i] = spasm_prng_ZZp(&ctx);
+		for (int j = 0; j < m; j++)
+			b[j] = 0;
+		spasm_xApy(x, A, b);
+		for (int j = 0; j < m; j++)
+			b_ref[j] = b[j];
+
+		if (!spasm_solve_levels(SU, SL, b, x, z)) {
+			printf("not ok - level-scheduled solver [solution not found]\n");
+			exit(1);
+		}
+		for (int j = 0; j < m; j++)   /* check solution */
+			y[j] = 0;
+		spasm_xApy(x, A, y);
+		for (int j = 0; j < m; j++)
+			if (y[j] != b[j]) {
+				printf("not ok - level-scheduled solver [incorrect solution found]\n");
+				exit(1);
+			}
+		spasm_solve(fact, b_ref, x_ref);  /* same as the sequential solver */
+		for (int i = 0; i < n; i++)
+			if (x[i] != x_ref[i]) {
+				printf("not ok - level-scheduled solver [differs from spasm_solve]\n");
+				exit(1);
+			}
+
+		/* bogus RHS: add e_j, for a non-pivotal j, to a valid one */
+		int jfree = -1;
+		for (int j = 0; j < m; j++)
+			if (fact->qinv[j] < 0)
+				jfree = j;
+		if (jfree >= 0) {
+			b[jfree] = spasm_ZZp_add(A->field, b[jfree], 1);
+			if (spasm_solve_levels(SU, SL, b, x, z)) {
+				printf("not ok - level-scheduled solver [bogus solution found]\n");
+				exit(1);
+			}
+		}
+		spasm_levels_free(SU);
+		spasm_levels_free(SL);
+		spasm_lu_free(fact);
+	}
+	printf("ok - level-scheduled solver\n");
+	spasm_csr_free(A);
+	free(x);
+	free(x_ref);
+	free(y);
+	free(b);
+	free(b_ref);
+	free(z);
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+	struct option longopts[] = {
+		{"modulus", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	char ch;
+	while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'p':
+			prime = atoll(optarg);
+			break;
+		default:
+			errx(1, "Unknown option\n");
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+	int m = A->m;
+	int block = 5;
+	int nrhs = 12;                /* the last block is incomplete */
+
+	spasm_ZZp *B = spasm_malloc((i64) nrhs * m * sizeof(*B));
+	spasm_ZZp *X = spasm_malloc((i64) nrhs * n * sizeof(*X));
+	spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
+	spasm_ZZp *x_ref = spasm_malloc(n * sizeof(*x_ref));
+	bool *ok = spasm_malloc(nrhs * sizeof(*ok));
+
+	/* with and without a dense tail in U */
+	for (int config = 0; config < 2; config++) {
+		struct echelonize_opts opts;
+		spasm_echelonize_init_opts(&opts);
+		opts.L = 1;
+		opts.enable_dense_tail = config;
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		struct spasm_solver *S = spasm_solver_alloc(fact, block);
+
+		/* even RHS are valid, odd ones get e_j added, for a non-pivotal j (if any) */
+		int jfree = -1;
+		for (int j = 0; j < m; j++)
+			if (fact->qinv[j] < 0)
+				jfree = j;
+		spasm_prng_ctx ctx;
+		spasm_prng_seed_simple(prime, config, 0, &ctx);
+		for (int v = 0; v < nrhs; v++) {
+			spasm_ZZp *x = X + (i64) v * n;
+			spasm_ZZp *Bv = B + (i64) v * m;
+			for (int i = 0; i < n; i++)
+				x[i] = spasm_prng_ZZp(&ctx);
+			for (int j = 0; j < m; j++)
+				Bv[j] = 0;
+			spasm_xApy(x, A, Bv);
+			if ((v & 1) && jfree >= 0)
+				Bv[jfree] = spasm_ZZp_add(A->field, Bv[jfree], 1);
+		}
+
+		for (int v0 = 0; v0 < nrhs; v0 += block) {
+			int k = spasm_min(block, nrhs - v0);
+			spasm_solver_solve(S, k, B + (i64) v0 * m, X + (i64) v0 * n, ok + v0);
+		}
+
+		/* compare with the sequential solver, one RHS at a time */
+		for (int v = 0; v < nrhs; v++) {
+			for (int j = 0; j < m; j++)
+				b[j] = B[(i64) v * m + j];
+			bool res = spasm_solve(fact, b, x_ref);
+			if (res != ok[v] || res != !((v & 1) && jfree >= 0)) {
+				printf("not ok - batched solver [wrong solvability]\n");
+				exit(1);
+			}
+			if (!res)
+				continue;
+			for (int i = 0; i < n; i++)
+				if (X[(i64) v * n + i] != x_ref[i]) {
+					printf("not ok - batched solver [differs from spasm_solve]\n");
+					exit(1);
+				}
+		}
+		spasm_solver_free(S);
+		spasm_lu_free(fact);
+	}
+	printf("ok - batched solver\n");
+	spasm_csr_free(A);
+	free(B);
+	free(X);
+	free(b);
+	free(x_ref);
+	free(ok);
+	return 0;
+}
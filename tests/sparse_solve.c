@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "spasm.h"
+#include "test_tools.h"
+
+i64 prime = 42013;
+
+void parse_command_line_options(int argc, char **argv)
+{
+	struct option longopts[] = {
+		{"modulus", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+	char ch;
+	while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'p':
+			prime = atoll(optarg);
+			break;
+		default:
+			errx(1, "Unknown option\n");
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	parse_command_line_options(argc, argv);
+	struct spasm_triplet *T = spasm_triplet_load(stdin, prime, NULL);
+	struct spasm_csr *A = spasm_compress(T);
+	spasm_triplet_free(T);
+	int n = A->n;
+	int m = A->m;
+	int nrhs = spasm_min(n, 50);
+
+	spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
+	spasm_ZZp *x = spasm_malloc(n * sizeof(*x));
+	spasm_ZZp *x_ref = spasm_malloc(n * sizeof(*x_ref));
+
+	/* with and without a dense tail in U */
+	for (int config = 0; config < 2; config++) {
+		struct echelonize_opts opts;
+		spasm_echelonize_init_opts(&opts);
+		opts.L = 1;
+		opts.enable_dense_tail = config;
+		struct spasm_lu *fact = spasm_echelonize(A, &opts);
+		struct spasm_solver *S = spasm_solver_alloc(fact, 1);
+		int r = fact->U->n;
+		int *xi = spasm_malloc(r * sizeof(*xi));
+		spasm_ZZp *xx = spasm_malloc(r * sizeof(*xx));
+
+		/* the rows of A are valid RHS; compare with the dense solver */
+		for (int k = 0; k < nrhs; k++) {
+			int nz = spasm_solver_sparse_solve(S, A, k, xi, xx);
+			if (nz < 0) {
+				printf("not ok - sparse RHS solver [solution not found]\n");
+				exit(1);
+			}
+			for (int i = 0; i < n; i++)
+				x[i] = 0;
+			for (int t = 0; t < nz; t++)
+				x[xi[t]] = xx[t];
+			for (int j = 0; j < m; j++)
+				b[j] = 0;
+			spasm_scatter(A, k, 1, b);
+			spasm_solve(fact, b, x_ref);
+			for (int i = 0; i < n; i++)
+				if (x[i] != x_ref[i]) {
+					printf("not ok - sparse RHS solver [differs from spasm_solve]\n");
+					exit(1);
+				}
+		}
+
+		/* bogus RHS: A[0] + e_j, for a non-pivotal j */
+		int jfree = -1;
+		for (int j = 0; j < m; j++)
+			if (fact->qinv[j] < 0)
+				jfree = j;
+		if (n > 0 && jfree >= 0) {
+			struct spasm_triplet *E = spasm_triplet_alloc(1, m, 1 + spasm_row_weight(A, 0), prime, true);
+			for (i64 px = A->p[0]; px < A->p[1]; px++)
+				spasm_add_entry(E, 0, A->j[px], A->x[px]);
+			spasm_add_entry(E, 0, jfree, 1);
+			struct spasm_csr *B = spasm_compress(E);
+			spasm_triplet_free(E);
+			if (spasm_solver_sparse_solve(S, B, 0, xi, xx) >= 0) {
+				printf("not ok - sparse RHS solver [bogus solution found]\n");
+				exit(1);
+			}
+			spasm_csr_free(B);
+		}
+		free(xi);
+		free(xx);
+		spasm_solver_free(S);
+		spasm_lu_free(fact);
+	}
+	printf("ok - sparse RHS solver\n");
+	spasm_csr_free(A);
+	free(b);
+	free(x);
+	free(x_ref);
+	return 0;
+}
@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "spasm.h"
 #include "test_tools.h"
 
@@ -52,3 +55,65 @@ int spasm_is_lower_triangular(const struct spasm_csr *A)
         return 1;
 }
 
+
+/*
+ * Check that the rows of U are in echelon order: row k has no entry on the pivot column of a
+ * previous row (the triangular solvers process them in this order). Print "not ok - ..." otherwise.
+ */
+int spasm_is_echelon_order(const struct spasm_lu *fact, const char *what)
+{
+        const struct spasm_csr *U = fact->U;
+        for (int k = 0; k < U->n; k++)
+                for (i64 px = U->p[k]; px < U->p[k + 1]; px++) {
+                        int i = fact->qinv[U->j[px]];
+                        if (i >= 0 && i < k) {
+                                printf("not ok - row %d of U has the pivot of row %d with %s\n", k, i, what);
+                                return 0;
+                        }
+                }
+        return 1;
+}
+
+/*
+ * Check an echelonization of A obtained with non-default options: it must have the same rank as
+ * the default one, U must be in echelon form (and order) and the rows A[0:n:stride] must be in its row space.
+ * On failure, print "not ok - ..." (what describes the options) and return 0.
+ */
+int spasm_check_echelonization(const struct spasm_csr *A, const struct spasm_lu *fact, int stride, const char *what)
+{
+        struct echelonize_opts opts;
+        spasm_echelonize_init_opts(&opts);
+        struct spasm_lu *ref = spasm_echelonize(A, &opts);
+        int ref_r = ref->r;
+        spasm_lu_free(ref);
+        if (fact->r != ref_r) {
+                printf("not ok - rank %d with %s, %d with default\n", fact->r, what, ref_r);
+                return 0;
+        }
+
+        const struct spasm_csr *U = fact->U;
+        for (int i = 0; i < U->n; i++) {
+                i64 px = U->p[i];
+                if (U->p[i + 1] == px || U->x[px] != 1 || fact->qinv[U->j[px]] != i) {
+                        printf("not ok - U is not in echelon form with %s\n", what);
+                        return 0;
+                }
+        }
+        if (!spasm_is_echelon_order(fact, what))
+                return 0;
+
+        int n = A->n;
+        int *p = spasm_malloc(n * sizeof(*p));
+        int k = 0;
+        for (int i = 0; i < n; i += stride)
+                p[k++] = i;
+        struct spasm_csr *S = spasm_schur(A, p, k, fact, -1, NULL, NULL, NULL);
+        i64 snz = spasm_nnz(S);
+        spasm_csr_free(S);
+        free(p);
+        if (snz != 0) {
+                printf("not ok - rows of A are not in the row space of U with %s\n", what);
+                return 0;
+        }
+        return 1;
+}
@@ -2,3 +2,5 @@
 
 int spasm_is_upper_triangular(const struct spasm_csr *A);
 int spasm_is_lower_triangular(const struct spasm_csr *A);
+int spasm_is_echelon_order(const struct spasm_lu *fact, const char *what);
+int spasm_check_echelonization(const struct spasm_csr *A, const struct spasm_lu *fact, int stride, const char *what);
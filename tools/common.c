@@ -42,26 +42,34 @@ struct argp input_argp = { input_options, parse_input_opt, NULL, NULL, NULL, NUL
 
 /* The options of the echelonization code */
 enum ech_opt_key {
-	NO_LOW_RANK, NO_DENSE, NO_GPLU,
-	MAX_ITER, DENSE_THR, MIN_PIV_RATIO,
-	DENSE_BLKSZ, MIN_RANK_RATIO, MAX_ASPECT_RATIO
+	PRESOLVE, DM_BLOCKS, NO_LOW_RANK, NO_DENSE, NO_GPLU, RIGHT_LOOKING,
+	MAX_ITER, DENSE_THR, MIN_PIV_RATIO, STREAMING, COMPACT,
+	DENSE_BLKSZ, MIN_RANK_RATIO, MAX_ASPECT_RATIO, MEMORY_BUDGET, DENSE_TAIL, DENSE_TREE
 };
 
 struct argp_option echelonize_options[] = {
 	{0,                     0,                 0, 0, "Echelonization sub-algorithms", -2},
+	{"presolve",            PRESOLVE,          0, 0, "Start with structured Gaussian elimination", -2 },
+	{"dm-blocks",           DM_BLOCKS,         0, 0, "Echelonize the diagonal blocks of the DM decomposition first", -2 },
 	{"no-low-rank-mode",    NO_LOW_RANK,       0, 0, "Disable the (dense) low-rank mode", -2 },
 	{"no-dense-mode",       NO_DENSE,          0, 0, "Don't use FFPACK", -2 },
 	{"no-GPLU",             NO_GPLU,           0, 0, "Don't use GPLU", -2 },
+	{"right-looking",       RIGHT_LOOKING,     0, 0, "Use right-looking elimination (Markowitz pivoting) instead of GPLU", -2 },
 
 	{0,                     0,                 0,  0, "Main echelonization options", -3 },
 	{"max-iterations",      MAX_ITER,         "N", 0, "Compute at most N sparse Schur complements ", -3},
 	{"dense-threshold",     DENSE_THR,        "D", 0, "Use FFPACK when the density is greater than D", -3},
 	{"min-pivot-proportion", MIN_PIV_RATIO,   "P", 0, "Stop if the proportion of pivots found is less than P", -3},
+	{"streaming-schur",     STREAMING,         0,  0, "Build the Schur complements by chunks, over the memory of the previous matrix", -3},
+	{"compact-columns",     COMPACT,           0,  0, "Renumber the non-pivotal columns after each Schur complement", -3},
 
 	{0,                     0,                 0,  0, "Dense code options", -4},
 	{"dense-block-size",    DENSE_BLKSZ,      "N", 0, "Use dense matrices of at most N rows", -4},
 	{"min-rank-ratio",      MIN_RANK_RATIO,   "R", 0, "Use low-rank mode if k rows have rank <= k * X", -4},
 	{"max-aspect-ratio",    MAX_ASPECT_RATIO, "R", 0, "Use low-rank mode if #rows / #columns >= R", -4},
+	{"memory-budget",       MEMORY_BUDGET,    "B", 0, "Size the dense blocks to use at most B bytes (suffixes K, M, G allowed)", -4},
+	{"dense-tail",          DENSE_TAIL,         0, 0, "Store the dense trailing rows of U as a dense block", -4},
+	{"dense-tree",          DENSE_TREE,       "K", 0, "Echelonize K dense blocks in parallel, then merge them", -4},
 	
 	{ 0 }
 };
@@ -74,6 +82,12 @@ error_t parse_ech_opt(int key, char *arg, struct argp_state *state)
 	case ARGP_KEY_INIT:  /* set defaults */
 		spasm_echelonize_init_opts(opts);
 		break;
+	case PRESOLVE:
+		opts->enable_presolve = 1;
+		break;
+	case DM_BLOCKS:
+		opts->enable_dm_blocks = 1;
+		break;
 	case NO_LOW_RANK:
 		opts->enable_tall_and_skinny = 0;
 		break;
@@ -83,6 +97,9 @@ error_t parse_ech_opt(int key, char *arg, struct argp_state *state)
 	case NO_GPLU:
 		opts->enable_GPLU = 0;
 		break;
+	case RIGHT_LOOKING:
+		opts->enable_right_looking = 1;
+		break;
 	case MAX_ITER:
 		opts->max_round = atoi(arg);
 		break;
@@ -92,6 +109,12 @@ error_t parse_ech_opt(int key, char *arg, struct argp_state *state)
 	case MIN_PIV_RATIO:
 		opts->min_pivot_proportion = atof(arg);
 		break;
+	case STREAMING:
+		opts->enable_streaming_schur = 1;
+		break;
+	case COMPACT:
+		opts->enable_column_compaction = 1;
+		break;
 	case DENSE_BLKSZ:
 		opts->dense_block_size = atoi(arg);
 		break;
@@ -101,6 +124,23 @@ error_t parse_ech_opt(int key, char *arg, struct argp_state *state)
 	case MAX_ASPECT_RATIO:
 		opts->tall_and_skinny_ratio = atof(arg);
 		break;
+	case MEMORY_BUDGET: {
+		char *end;
+		double budget = strtod(arg, &end);
+		switch (*end) {
+		case 'G': case 'g': budget *= 1024;     /* fall through */
+		case 'M': case 'm': budget *= 1024;     /* fall through */
+		case 'K': case 'k': budget *= 1024;
+		}
+		opts->memory_budget = budget;
+		break;
+	}
+	case DENSE_TAIL:
+		opts->enable_dense_tail = 1;
+		break;
+	case DENSE_TREE:
+		opts->dense_tree_width = atoi(arg);
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -75,6 +75,7 @@ int main(int argc, char **argv)
 		spasm_csr_free(R);
 		free(Rqinv);
 	} else {
+		spasm_lu_unpack_dense_tail(fact);
 		spasm_csr_save(fact->U, stdout);
 	}
 	spasm_lu_free(fact);
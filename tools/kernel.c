@@ -66,6 +66,22 @@ struct argp_child children_parsers[] = {
 struct argp argp = { options, parse_ker_opt, NULL, doc, children_parsers, NULL, NULL };
 
 
+/*
+ * Kernel vectors are written as soon as they are computed (in any order), so that the kernel
+ * basis is never held in memory. Each row is formatted by the thread that produced it.
+ */
+static void write_kernel_row(void *data, int k, int nz, const int *Kj, const spasm_ZZp *Kx)
+{
+	FILE *f = data;
+	char *buffer = spasm_malloc((i64) nz * 40 + 1);
+	i64 len = 0;
+	for (int px = 0; px < nz; px++)
+		len += sprintf(buffer + len, "%d %d %" PRId64 "\n", k + 1, Kj[px] + 1, (i64) Kx[px]);
+	#pragma omp critical(kernel_output)
+	fwrite(buffer, 1, len, f);
+	free(buffer);
+}
+
 int main(int argc, char **argv)
 {
 	/* process command-line options */
@@ -85,10 +101,13 @@ int main(int argc, char **argv)
 	struct spasm_lu *fact = spasm_echelonize(A, &args.opts);
 	spasm_csr_free(A);
 
-	/* kernel basis */
-	struct spasm_csr *K = spasm_kernel(fact);
-	fprintf(stderr, "Kernel basis matrix is %d x %d with %" PRId64 " nz\n", K->n, K->m, spasm_nnz(K));
-	
+	/* kernel basis, streamed to the output */
+	int Kn = fact->U->m - fact->U->n;
+	int Km = fact->U->m;
 	FILE *f = open_output(args.output_filename);
-	spasm_csr_save(K, f);
+	fprintf(f, "%d %d M\n", Kn, Km);
+	i64 nnz = spasm_kernel_stream(fact, write_kernel_row, f);
+	fprintf(f, "0 0 0\n");
+	fprintf(stderr, "Kernel basis matrix is %d x %d with %" PRId64 " nz\n", Kn, Km, nnz);
+	spasm_lu_free(fact);
 }
\ No newline at end of file
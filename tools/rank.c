@@ -20,12 +20,16 @@ struct cmdline_args {
 	bool certificate;
 	char *cert_file;           /* for the certificate */
 	bool allow_transpose;	   /* transpose ON by default */
+	bool split;                /* echelonize connected components separately */
+	bool tree;                 /* tree-parallel echelonization */
 };
 
 /* The options we understand. */
 struct argp_option options[] = {
 	{0,               0,   0,     0, "Rank options", 2 },
 	{"no-transpose", 't', 0,      0, "Do not transpose the input matrix", 2},
+	{"split",        's', 0,      0, "Echelonize the connected components separately", 2},
+	{"tree",         'T', 0,      0, "Echelonize blocks of rows independently, then merge them", 2},
 	{"certificate",  'c', 0,      0, "Output a rank certificate", 2 },
 	{"output",       'o', "FILE", 0, "Write the rank certificate in FILE", 2 },
 	{ 0 }
@@ -39,6 +43,12 @@ error_t parse_rank_opt(int key, char *arg, struct argp_state *state)
 	case 't':
 		arguments->allow_transpose = 0;
 		break;
+	case 's':
+		arguments->split = 1;
+		break;
+	case 'T':
+		arguments->tree = 1;
+		break;
 	case 'c':
 		arguments->certificate = 1;
 		break;
@@ -48,8 +58,17 @@ error_t parse_rank_opt(int key, char *arg, struct argp_state *state)
 	case ARGP_KEY_ARG:
 		fprintf(stderr, "ERROR: invalid argument ``%s''\n", arg);
 		exit(1);
+	case ARGP_KEY_END:
+		/* the tree-parallel code computes neither L nor the components */
+		if (arguments->tree && (arguments->certificate || arguments->split)) {
+			fprintf(stderr, "ERROR: --tree cannot be combined with --certificate or --split\n");
+			exit(1);
+		}
+		break;
 	case ARGP_KEY_INIT:
 		arguments->allow_transpose = 1;
+		arguments->split = 0;
+		arguments->tree = 0;
 		arguments->certificate = 0;
 		arguments->cert_file = NULL;
 		state->child_inputs[0] = &arguments->input;
@@ -98,12 +117,19 @@ int main(int argc, char **argv)
 		args.opts.L = 1;
 
 	double start_time = spasm_wtime();
-	struct spasm_lu *fact = spasm_echelonize(A, &args.opts);   /* NULL = default options */
+	struct spasm_lu *fact;
+	if (args.tree)
+		fact = spasm_echelonize_tree(A, &args.opts);
+	else if (args.split)
+		fact = spasm_echelonize_components(A, &args.opts);
+	else
+		fact = spasm_echelonize(A, &args.opts);
 	double end_time = spasm_wtime();
 	fprintf(stderr, "done in %.3f s rank = %d\n", end_time - start_time, fact->U->n);
 	
 
 	if (args.certificate) {
+		spasm_lu_unpack_dense_tail(fact);
 		assert(spasm_factorization_verify(A, fact, 42));
 		assert(spasm_factorization_verify(A, fact, 1337));
 		assert(spasm_factorization_verify(A, fact, 21011984));
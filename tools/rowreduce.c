@@ -93,6 +93,7 @@ int main(int argc, char **argv)
 		free(Rqinv);
 		free(p);
 	} else {
+		spasm_lu_unpack_dense_tail(fact);
 		spasm_csr_save(fact->U, stdout);
 	}
 	spasm_lu_free(fact);
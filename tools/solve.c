@@ -19,6 +19,8 @@ struct cmdline_args {
 	/* options specific to the solve program */
 	char *rhs_filename;
 	char *output_filename;
+	bool levels;
+	bool sparse;
 };
 
 /* The options we understand. */
@@ -26,6 +28,8 @@ struct argp_option options[] = {
 	{0,               0,   0,     0, "solve options", 2 },
 	{"rhs",          'r', "FILE", 0, "Load the RHS matrix from FILE", 2 },
 	{"output",       'o', "FILE", 0, "Write the solution matrix in FILE", 2 },
+	{"levels",       'l', 0,      0, "Solve the systems one at a time, with level-scheduled parallel triangular solves", 2 },
+	{"sparse-rhs",   's', 0,      0, "Only visit the rows of L and U reachable from the RHS (for very sparse RHS)", 2 },
 	{ 0 }
 };
 
@@ -40,12 +44,20 @@ error_t parse_solve_opt(int key, char *arg, struct argp_state *state)
 	case 'o':
 		arguments->output_filename = arg;
 		break;
+	case 'l':
+		arguments->levels = 1;
+		break;
+	case 's':
+		arguments->sparse = 1;
+		break;
 	case ARGP_KEY_ARG:
 		fprintf(stderr, "ERROR: invalid argument ``%s''\n", arg);
 		exit(1);
 	case ARGP_KEY_INIT:
 		arguments->rhs_filename = NULL;
 		arguments->output_filename = NULL;
+		arguments->levels = 0;
+		arguments->sparse = 0;
 		state->child_inputs[0] = &arguments->input;
 		state->child_inputs[1] = &arguments->opts;
 		break;
@@ -65,6 +77,88 @@ struct argp_child children_parsers[] = {
 struct argp argp = { options, parse_solve_opt, NULL, doc, children_parsers, NULL, NULL };
 
 
+/* same as spasm_gesv, but each system is solved in parallel (latency-oriented) */
+static struct spasm_csr * solve_levels(const struct spasm_lu *fact, const struct spasm_csr *B, bool *ok)
+{
+	int n = B->n;
+	int m = B->m;
+	int Xm = fact->L->n;
+	struct spasm_levels *SU = spasm_levels_U(fact);
+	struct spasm_levels *SL = spasm_levels_L(fact);
+	struct spasm_triplet *X = spasm_triplet_alloc(n, Xm, spasm_nnz(B), B->field->p, true);
+	spasm_ZZp *b = spasm_malloc(m * sizeof(*b));
+	spasm_ZZp *x = spasm_malloc(Xm * sizeof(*x));
+	spasm_ZZp *z = spasm_malloc(SU->n * sizeof(*z));
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < m; j++)
+			b[j] = 0;
+		spasm_scatter(B, i, 1, b);
+		ok[i] = spasm_solve_levels(SU, SL, b, x, z);
+		for (int j = 0; j < Xm; j++)
+			if (x[j] != 0)
+				spasm_add_entry(X, i, j, x[j]);
+	}
+	free(b);
+	free(x);
+	free(z);
+	spasm_levels_free(SU);
+	spasm_levels_free(SL);
+	struct spasm_csr *XX = spasm_compress(X);
+	spasm_triplet_free(X);
+	return XX;
+}
+
+/* same as spasm_gesv, with sparse triangular solves */
+static struct spasm_csr * solve_sparse(const struct spasm_lu *fact, const struct spasm_csr *B, bool *ok)
+{
+	int n = B->n;
+	int Xm = fact->L->n;
+	int r = fact->U->n;
+	struct spasm_solver *S = spasm_solver_alloc(fact, 1);
+	int **Rj = spasm_malloc(n * sizeof(*Rj));
+	spasm_ZZp **Rx = spasm_malloc(n * sizeof(*Rx));
+	i64 *Xp = spasm_malloc((n + 1) * sizeof(*Xp));
+	Xp[0] = 0;
+
+	#pragma omp parallel
+	{
+		int *xi = spasm_malloc(r * sizeof(*xi));
+		spasm_ZZp *xx = spasm_malloc(r * sizeof(*xx));
+		#pragma omp for schedule(dynamic)
+		for (int i = 0; i < n; i++) {
+			int nz = spasm_solver_sparse_solve(S, B, i, xi, xx);
+			ok[i] = (nz >= 0);
+			nz = spasm_max(nz, 0);
+			Xp[i + 1] = nz;
+			Rj[i] = spasm_malloc(nz * sizeof(**Rj));
+			Rx[i] = spasm_malloc(nz * sizeof(**Rx));
+			for (int t = 0; t < nz; t++) {
+				Rj[i][t] = xi[t];
+				Rx[i][t] = xx[t];
+			}
+		}
+		free(xi);
+		free(xx);
+	}
+	for (int i = 0; i < n; i++)
+		Xp[i + 1] += Xp[i];
+	struct spasm_csr *X = spasm_csr_alloc(n, Xm, Xp[n], B->field->p, true);
+	for (int i = 0; i < n; i++) {
+		X->p[i + 1] = Xp[i + 1];
+		for (i64 px = Xp[i]; px < Xp[i + 1]; px++) {
+			X->j[px] = Rj[i][px - Xp[i]];
+			X->x[px] = Rx[i][px - Xp[i]];
+		}
+		free(Rj[i]);
+		free(Rx[i]);
+	}
+	free(Rj);
+	free(Rx);
+	free(Xp);
+	spasm_solver_free(S);
+	return X;
+}
+
 /** solve several sparse linear systems */
 int main(int argc, char **argv)
 {
@@ -101,7 +195,13 @@ int main(int argc, char **argv)
 	
 	fprintf(stderr, "Solving XA == B\n");
 	bool *ok = spasm_malloc(B->n * sizeof(*ok));
-	struct spasm_csr *X = spasm_gesv(fact, B, ok);
+	struct spasm_csr *X;
+	if (args.levels)
+		X = solve_levels(fact, B, ok);
+	else if (args.sparse)
+		X = solve_sparse(fact, B, ok);
+	else
+		X = spasm_gesv(fact, B, ok);
 	for (int i = 0; i < B->n; i++)
 		if (!ok[i])
 			fprintf(stderr, "WARNING: no solution for row %d\n", i);